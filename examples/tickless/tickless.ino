@@ -0,0 +1,145 @@
+/*
+   MIT License
+
+  Copyright (c) 2023 Felix Biego
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  ______________  _____
+  ___  __/___  /_ ___(_)_____ _______ _______
+  __  /_  __  __ \__  / _  _ \__  __ `/_  __ \
+  _  __/  _  /_/ /_  /  /  __/_  /_/ / / /_/ /
+  /_/     /_.___/ /_/   \___/ _\__, /  \____/
+                              /____/
+
+*/
+
+
+/*
+  Tickless loop example
+
+  Instead of calling watch.loop() continuously, the loop task blocks until the next
+  library deadline or until BLE data arrives. Every 10 seconds the example prints how
+  often loop() ran and the measured split between the time the loop task was awake and
+  the time it was blocked. Press the BOOT button to switch to the usual polling loop and
+  compare the numbers.
+
+  With CONFIG_PM_ENABLE (ESP-IDF / custom Arduino builds) automatic light sleep is
+  enabled, so the blocked time can be spent in light sleep. The idle current gain on
+  your board is the blocked share times the difference between its active and light
+  sleep current; check it with a current meter.
+*/
+
+#include <ChronosESP32.h>
+#if CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#endif
+
+#define BUTTON_PIN 0
+#define REPORT_INTERVAL 10000 // ms
+#define POLL_INTERVAL 10      // ms, polling mode delay
+
+ChronosESP32 watch("Chronos Tickless"); // set the bluetooth name
+
+TaskHandle_t loopTask = nullptr;
+volatile bool tickless = true;
+
+uint32_t loopCalls = 0;
+int64_t awakeTime = 0;   // us spent running loop()
+int64_t blockedTime = 0; // us spent waiting for the next deadline (tickless) or in delay() (polling)
+int64_t windowStart = 0;
+
+void IRAM_ATTR buttonISR()
+{
+  tickless = !tickless;
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(loopTask, &woken); // wake the loop task to apply the mode
+  portYIELD_FROM_ISR(woken);
+}
+
+void connectionCallback(bool state)
+{
+  Serial.print("Connection state: ");
+  Serial.println(state ? "Connected" : "Disconnected");
+}
+
+void report(int id)
+{
+  int64_t now = esp_timer_get_time();
+  double elapsed = (now - windowStart) / 1000000.0;
+  // time of the loop task outside watch.loop() and the wait, mostly the bookkeeping above
+  int64_t otherTime = max((now - windowStart) - awakeTime - blockedTime, (int64_t)0);
+
+  Serial.printf("[%s] loop: %.1f calls/s, in loop(): %.1f ms (%.2f%%), blocked: %.1f ms (%.2f%%), other: %.1f ms\n",
+                tickless ? "tickless" : "polling", loopCalls / elapsed,
+                awakeTime / 1000.0, awakeTime / (elapsed * 10000.0),
+                blockedTime / 1000.0, blockedTime / (elapsed * 10000.0),
+                otherTime / 1000.0);
+
+  loopCalls = 0;
+  awakeTime = 0;
+  blockedTime = 0;
+  windowStart = now;
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  pinMode(BUTTON_PIN, INPUT_PULLUP);
+
+  loopTask = xTaskGetCurrentTaskHandle();
+  watch.setLoopNotifyTask(loopTask); // wake this task when BLE data arrives or a timer is set
+
+  watch.setConnectionCallback(connectionCallback);
+  watch.begin();
+  watch.setBattery(80);
+
+#if CONFIG_PM_ENABLE
+  esp_pm_config_t pm = {};
+  pm.max_freq_mhz = 240;
+  pm.min_freq_mhz = 40;
+  pm.light_sleep_enable = true;
+  esp_pm_configure(&pm);
+#endif
+
+  attachInterrupt(BUTTON_PIN, buttonISR, FALLING);
+
+  windowStart = esp_timer_get_time();
+  watch.startTimer(REPORT_INTERVAL, report, true); // the report also runs from watch.loop()
+}
+
+void loop()
+{
+  int64_t start = esp_timer_get_time();
+  uint32_t wait = watch.loop(); // handles internal routine functions, returns ms until the next deadline
+  loopCalls++;
+  int64_t ready = esp_timer_get_time();
+  awakeTime += ready - start;
+
+  if (tickless)
+  {
+    // sleep until the next deadline, BLE data or the button
+    ulTaskNotifyTake(pdTRUE, wait == CS_NO_DEADLINE ? portMAX_DELAY : pdMS_TO_TICKS(wait));
+  }
+  else
+  {
+    delay(POLL_INTERVAL);
+  }
+  blockedTime += esp_timer_get_time() - ready;
+}
@@ -33,8 +33,12 @@
 #include <Arduino.h>
 #include "ChronosESP32.h"
 
-BLECharacteristic *ChronosESP32::pCharacteristicTX;
-BLECharacteristic *ChronosESP32::pCharacteristicRX;
+ChronosESP32::ServerRouter ChronosESP32::_serverRouter;
+ChronosESP32 *ChronosESP32::_instances[CS_MAX_INSTANCES];
+portMUX_TYPE ChronosESP32::_instanceMux = portMUX_INITIALIZER_UNLOCKED;
+RTC_DATA_ATTR ChronosESP32::RtcState ChronosESP32::_rtcState;
+ChronosESP32 *ChronosESP32::_rtcOwner = nullptr;
+ChronosESP32 *ChronosESP32::_healthOwner = nullptr;
 
 /*!
 	@brief  Constructor for ChronosESP32
@@ -51,8 +55,58 @@ ChronosESP32::ChronosESP32()
 	_notifications[0].app = "Chronos";
 	_notifications[0].message = "Download from Google Play to sync time and receive notifications";
 
-	_infoTimer.duration = 3 * 1000;	 // 3 seconds for info timer
-	_findTimer.duration = 30 * 1000; // 30 seconds for find phone
+	memset(_reminders, 0, sizeof(_reminders));
+	for (int i = 0; i < CS_MAX_CONNECTIONS; i++)
+	{
+		_conns[i].handle = BLE_HS_CONN_HANDLE_NONE;
+		_conns[i].transport = nullptr;
+		_conns[i].incoming.length = 0;
+		_conns[i].users = 0;
+	}
+	memset(_transports, 0, sizeof(_transports));
+	memset(_navIcons, 0, sizeof(_navIcons));
+	memset(_iconCache, 0, sizeof(_iconCache));
+	memset(_healthMark, 0, sizeof(_healthMark));
+	memset(_healthSyncs, 0, sizeof(_healthSyncs));
+	memset(_aggHour, 0, sizeof(_aggHour));
+	memset(_aggDay, 0, sizeof(_aggDay));
+	memset(_aggSlots, 0, sizeof(_aggSlots));
+	memset(_aggSlotMinute, 0, sizeof(_aggSlotMinute));
+	memset(_rtChannels, 0, sizeof(_rtChannels));
+	memset(&_otaStats, 0, sizeof(_otaStats));
+	memset(_weatherTemp, 0, sizeof(_weatherTemp));
+	memset(_weatherHigh, 0, sizeof(_weatherHigh));
+	memset(_weatherLow, 0, sizeof(_weatherLow));
+	memset(_weatherPressure, 0, sizeof(_weatherPressure));
+	memset(_weatherIcon, 0, sizeof(_weatherIcon));
+	memset(_weatherDay, 0, sizeof(_weatherDay));
+	memset(_weatherUv, 0, sizeof(_weatherUv));
+	memset(_forecastTemp, 0, sizeof(_forecastTemp));
+	memset(_forecastWind, 0, sizeof(_forecastWind));
+	memset(_forecastDay, 0, sizeof(_forecastDay));
+	memset(_forecastHour, 0, sizeof(_forecastHour));
+	memset(_forecastIcon, 0, sizeof(_forecastIcon));
+	memset(_forecastUv, 0, sizeof(_forecastUv));
+	memset(_forecastHumidity, 0, sizeof(_forecastHumidity));
+	memset(_forecastTime, 0, sizeof(_forecastTime));
+
+	// within the iOS accessory guidelines, Android accepts them as well
+	_linkParams[LINK_DEFAULT] = {0, 0, 0, 0};
+	_linkParams[LINK_FAST] = {12, 24, 0, 400};	 // 15-30 ms, 4 s timeout
+	_linkParams[LINK_SLOW] = {120, 144, 4, 600}; // 150-180 ms, skip 4 events, 6 s timeout
+	memset(&_linkStats, 0, sizeof(_linkStats));
+
+	_advProfile = advertisingPreset(ADV_CONSTANT);
+	memset(&_advStats, 0, sizeof(_advStats));
+
+	// frames the app resends unchanged on every sync
+	memset(_frameFilter, 0, sizeof(_frameFilter));
+	setDuplicateFilter(0x7E, true); // weather & hourly forecast
+	setDuplicateFilter(0x88, true); // weather high/low
+	setDuplicateFilter(0x8A, true); // uv & pressure
+	setDuplicateFilter(0x93, true); // time
+	setDuplicateFilter(0x9D, true); // music info
+	setDuplicateFilter(0xEF, true); // navigation data
 }
 
 /*!
@@ -62,11 +116,37 @@ ChronosESP32::ChronosESP32()
 	@param  screen
 			screen config
 */
-ChronosESP32::ChronosESP32(String name, ChronosScreen screen)
+ChronosESP32::ChronosESP32(String name, ChronosScreen screen) : ChronosESP32()
 {
 	_watchName = name;
 	_screenConf = screen;
-	ChronosESP32();
+}
+
+/*!
+	@brief  Destructor for ChronosESP32, removes the service of a running instance and releases the flash writer, locks and icon cache
+*/
+ChronosESP32::~ChronosESP32()
+{
+	if (_inited)
+	{
+		stop();
+	}
+	stopBulkWriter();
+	releaseShared(_rtcOwner);
+	releaseShared(_healthOwner);
+	if (_rxLock != nullptr)
+	{
+		vSemaphoreDelete(_rxLock);
+	}
+	if (_healthLock != nullptr)
+	{
+		vSemaphoreDelete(_healthLock);
+	}
+	if (_touchSignal != nullptr)
+	{
+		vSemaphoreDelete(_touchSignal);
+	}
+	clearIconCache();
 }
 
 /*!
@@ -79,6 +159,22 @@ void ChronosESP32::setName(String name)
 	_watchName = name;
 }
 
+/*!
+	@brief  set the GATT service of this instance (call before begin function), instances sharing the BLE server need different services
+	@param  service
+			service UUID
+	@param  rx
+			UUID of the characteristic the app writes to
+	@param  tx
+			UUID of the characteristic the watch notifies on
+*/
+void ChronosESP32::setServiceUUID(String service, String rx, String tx)
+{
+	_serviceUUID = service;
+	_rxUUID = rx;
+	_txUUID = tx;
+}
+
 /*!
 	@brief  set screen config (call before begin function)
 	@param  screen
@@ -89,33 +185,124 @@ void ChronosESP32::setScreen(ChronosScreen screen)
 	_screenConf = screen;
 }
 
+/*!
+	@brief  initializes bluetooth LE server with an advertising profile
+	@param  profile
+			advertising intervals, durations and TX power
+*/
+void ChronosESP32::begin(AdvProfile profile)
+{
+	_advProfile = profile;
+	begin();
+}
+
 /*!
 	@brief  initializes bluetooth LE server
 */
 void ChronosESP32::begin()
 {
-	BLEDevice::init(_watchName.c_str());
-	BLEServer *pServer = BLEDevice::createServer();
-	BLEDevice::setMTU(517);
-	pServer->setCallbacks(this, false);
+	beginEngine(true);
+}
 
-	BLEService *pService = pServer->createService(CS_SERVICE_UUID);
-	pCharacteristicTX = pService->createCharacteristic(CS_CHARACTERISTIC_UUID_TX, NIMBLE_PROPERTY::NOTIFY);
-	pCharacteristicRX = pService->createCharacteristic(CS_CHARACTERISTIC_UUID_RX, NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_NR);
-	pCharacteristicRX->setCallbacks(this);
-	pCharacteristicTX->setCallbacks(this);
-	pService->start();
+/*!
+	@brief  initializes the protocol engine on a wired transport, without bluetooth LE
+	@param  transport
+			UART, TCP or another ChronosTransport
+*/
+void ChronosESP32::begin(ChronosTransport &transport)
+{
+	addTransport(transport);
+	beginEngine(false);
+}
 
-	BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
-	pAdvertising->addServiceUUID(CS_SERVICE_UUID);
-	pAdvertising->enableScanResponse(true);
-	pAdvertising->setPreferredParams(0x06, 0x12); // functions that help with iPhone connections issue
-	pAdvertising->setName(_watchName.c_str());
-	pAdvertising->start();
+/*!
+	@brief  serve the app on another transport as well, eg. a UART next to bluetooth LE
+	@param  transport
+			UART, TCP or another ChronosTransport, polled from loop()
+	@return false if CS_MAX_TRANSPORTS are attached or the transport belongs to an instance
+*/
+bool ChronosESP32::addTransport(ChronosTransport &transport)
+{
+	if (_transportCount >= CS_MAX_TRANSPORTS || transport._watch != nullptr)
+	{
+		return false;
+	}
+	transport._watch = this;
+	_transports[_transportCount++] = &transport;
+	return true;
+}
+
+/*!
+	@brief  restore the retained state and start the protocol engine
+	@param  ble
+			also start the bluetooth LE server
+*/
+void ChronosESP32::beginEngine(bool ble)
+{
+	if (_inited || (ble && !registerInstance()))
+	{
+		// already running, or CS_MAX_INSTANCES are
+		return;
+	}
+
+	if (_rtcEnabled)
+	{
+		restoreSleepState();
+	}
+	if (_stateEnabled)
+	{
+		// the ui has data before the phone connects, RTC memory already holds the settings and alarms after a warm wake
+		loadState(_wakeStats.warm ? (uint32_t)(STATE_ALL & ~(STATE_SETTINGS | STATE_ALARMS)) : (uint32_t)STATE_ALL);
+	}
+
+	if (_rxLock == nullptr)
+	{
+		_rxLock = xSemaphoreCreateMutex();
+	}
+
+	if (ble)
+	{
+		// a second instance adds its service to the server of the first
+		_bleOwner = !BLEDevice::isInitialized();
+		if (_bleOwner)
+		{
+			BLEDevice::init(_watchName.c_str());
+			BLEDevice::setMTU(517);
+		}
+		BLEServer *pServer = BLEDevice::createServer();
+		pServer->setCallbacks(&_serverRouter, false);
+
+		pService = pServer->createService(_serviceUUID.c_str());
+		pCharacteristicTX = pService->createCharacteristic(_txUUID.c_str(), NIMBLE_PROPERTY::NOTIFY);
+		pCharacteristicRX = pService->createCharacteristic(_rxUUID.c_str(), NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_NR);
+		pCharacteristicRX->setCallbacks(this);
+		pCharacteristicTX->setCallbacks(this);
+		pService->start();
+		_bleTransport._tx = pCharacteristicTX;
+		_bleTransport._watch = this;
+
+		BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
+		pAdvertising->addServiceUUID(_serviceUUID.c_str());
+		if (_bleOwner)
+		{
+			pAdvertising->enableScanResponse(true);
+			pAdvertising->setPreferredParams(0x06, 0x12); // functions that help with iPhone connections issue
+			pAdvertising->setName(_watchName.c_str());
+			_advBasePower = BLEDevice::getPower();
+			_advPower = _advBasePower;
+			startAdvertisingPhase(ADV_FAST);
+		}
 
-	_address = BLEDevice::getAddress().toString().c_str();
+		_address = BLEDevice::getAddress().toString().c_str();
+	}
+
+	if (_touchSignal == nullptr)
+	{
+		_touchSignal = xSemaphoreCreateBinary();
+	}
 
 	_inited = true;
+	_wakeStats.started = millis();
 }
 
 /*!
@@ -123,8 +310,76 @@ void ChronosESP32::begin()
 */
 void ChronosESP32::stop(bool clearAll)
 {
-	BLEDevice::deinit(clearAll);
+	if (_stateEnabled && _stateDirty != 0)
+	{
+		saveState();
+	}
+
+	for (int i = 0; i < _transportCount; i++)
+	{
+		_transports[i]->close();
+		_transports[i]->_watch = nullptr;
+	}
+	_transportCount = 0;
+
+	ChronosESP32 *next = unregisterInstance();
+	if (_inited && pService == nullptr)
+	{
+		// started on a wired transport, the stack belongs to others
+	}
+	else if (next == nullptr)
+	{
+		BLEDevice::deinit(clearAll);
+	}
+	else if (_inited)
+	{
+		// the other instances keep the stack, only this service goes
+		BLEDevice::getAdvertising()->removeServiceUUID(_serviceUUID.c_str());
+		BLEDevice::getServer()->removeService(pService, true);
+		if (_bleOwner)
+		{
+			next->_advBasePower = _advBasePower;
+			next->_bleOwner = true;
+			next->startAdvertisingPhase(next->_bleCount < next->_maxConnections ? ADV_FAST : ADV_OFF);
+		}
+	}
+	pService = nullptr;
+	pCharacteristicTX = nullptr;
+	pCharacteristicRX = nullptr;
+	_bleTransport._tx = nullptr;
+	_bleTransport._watch = nullptr;
+	_bleOwner = false;
 	_inited = false;
+
+	// the stack is gone without disconnect events
+	portENTER_CRITICAL(&_connMux);
+	for (int i = 0; i < CS_MAX_CONNECTIONS; i++)
+	{
+		if (_conns[i].handle != BLE_HS_CONN_HANDLE_NONE)
+		{
+			_conns[i].handle = BLE_HS_CONN_HANDLE_NONE;
+			_conns[i].incoming.length = 0;
+			_connCount--;
+		}
+	}
+	_bleCount = 0;
+	portEXIT_CRITICAL(&_connMux);
+	portENTER_CRITICAL(&_dirtyMux);
+	for (int i = 0; i < CS_MAX_CONNECTIONS; i++)
+	{
+		_healthSyncs[i].request = 0;
+		_healthSyncs[i].lost = true;
+	}
+	portEXIT_CRITICAL(&_dirtyMux);
+	_connected = false;
+	_subscribed = false;
+
+	portENTER_CRITICAL(&_advMux);
+	accrueAdvTime(millis());
+	_advPhase = ADV_OFF;
+	portEXIT_CRITICAL(&_advMux);
+	disarmTimer(TIMER_ADV);
+	disarmTimer(TIMER_LINK);
 }
 
 /*!
@@ -137,48 +392,313 @@ bool ChronosESP32::isRunning()
 
 /*!
 	@brief  handles routine functions
+	@return time in milliseconds until loop() has work to do, the caller may block or sleep until then
 */
-void ChronosESP32::loop()
+uint32_t ChronosESP32::loop()
 {
+	_timeSnapshot = captureTime();
+
 	if (!_inited)
 	{
 		// begin not called. do nothing
-		return;
+		return CS_NO_DEADLINE;
+	}
+
+	for (int i = 0; i < _transportCount; i++)
+	{
+		_transports[i]->poll();
+	}
+
+	// wraparound safe, only the earliest deadline is checked
+	if (_timerPending && (long)(millis() - _nextDeadline) >= 0)
+	{
+		runTimers();
+	}
+
+	uint32_t wait = getTimeToNextEvent();
+	// wired transports are polled, their input cannot wake the loop task
+	return _transportCount > 0 ? min(wait, (uint32_t)CS_TRANSPORT_POLL) : wait;
+}
+
+/*!
+	@brief  time until the next internal or application timer expires
+	@return milliseconds, 0 if a timer is due, CS_NO_DEADLINE if no timer is running
+*/
+uint32_t ChronosESP32::getTimeToNextEvent()
+{
+	portENTER_CRITICAL(&_timerMux);
+	bool pending = _timerPending;
+	long remaining = (long)(_nextDeadline - millis());
+	portEXIT_CRITICAL(&_timerMux);
+
+	if (!pending)
+		return CS_NO_DEADLINE;
+
+	return remaining > 0 ? (uint32_t)remaining : 0;
+}
+
+/*!
+	@brief  set a task to be notified (xTaskNotifyGive) when loop() has new work, eg. after BLE data is received
+	@param  task
+			task handle, usually the task calling loop(). nullptr disables notifications
+*/
+void ChronosESP32::setLoopNotifyTask(TaskHandle_t task)
+{
+	_loopTask = task;
+}
+
+/*!
+	@brief  wake the loop task if one is registered
+*/
+void ChronosESP32::notifyLoop()
+{
+	if (_loopTask != nullptr)
+	{
+		xTaskNotifyGive(_loopTask);
 	}
+}
 
-	if (_connected)
+/*!
+	@brief  start an application timer, the callback is called from loop()
+	@param  duration
+			time to expiry in milliseconds
+	@param  callback
+			function called on expiry, receives the timer id
+	@param  repeat
+			restart the timer after each expiry
+	@return timer id, -1 if all CS_TIMER_SIZE timers are in use
+*/
+int ChronosESP32::startTimer(unsigned long duration, void (*callback)(int), bool repeat)
+{
+	for (int i = 0; i < CS_TIMER_SIZE; i++)
 	{
-		if (_infoTimer.active)
+		if (!_timers[TIMER_INTERNAL + i].active)
 		{
-			if (_infoTimer.time + _infoTimer.duration < millis())
-			{
-				// timer end
-				_infoTimer.active = false;
+			armTimer(TIMER_INTERNAL + i, duration, repeat, callback);
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*!
+	@brief  stop an application timer
+	@param  id
+			timer id returned by startTimer
+*/
+void ChronosESP32::stopTimer(int id)
+{
+	if (id >= 0 && id < CS_TIMER_SIZE)
+	{
+		disarmTimer(TIMER_INTERNAL + id);
+	}
+}
+
+/*!
+	@brief  check whether an application timer is running
+	@param  id
+			timer id returned by startTimer
+*/
+bool ChronosESP32::isTimerActive(int id)
+{
+	return id >= 0 && id < CS_TIMER_SIZE && _timers[TIMER_INTERNAL + id].active;
+}
+
+/*!
+	@brief  start or restart a timer slot
+	@param  id
+			timer slot
+	@param  duration
+			time to expiry in milliseconds
+	@param  repeat
+			restart the timer after each expiry
+	@param  callback
+			application callback
+*/
+void ChronosESP32::armTimer(int id, unsigned long duration, bool repeat, void (*callback)(int))
+{
+	portENTER_CRITICAL(&_timerMux);
+	ChronosTimer &timer = _timers[id];
+	timer.time = millis();
+	timer.duration = duration;
+	timer.repeat = repeat;
+	timer.callback = callback;
+	timer.active = true;
+
+	unsigned long deadline = timer.time + duration;
+	if (!_timerPending || (long)(deadline - _nextDeadline) < 0)
+	{
+		_nextDeadline = deadline;
+		_timerPending = true;
+	}
+	portEXIT_CRITICAL(&_timerMux);
+
+	// the loop task may be blocked until a later deadline
+	notifyLoop();
+}
+
+/*!
+	@brief  stop a timer slot
+	@param  id
+			timer slot
+*/
+void ChronosESP32::disarmTimer(int id)
+{
+	// the cached deadline is left as is, runTimers() will recompute it
+	portENTER_CRITICAL(&_timerMux);
+	_timers[id].active = false;
+	portEXIT_CRITICAL(&_timerMux);
+}
+
+/*!
+	@brief  handle expired timers and find the next deadline
+*/
+void ChronosESP32::runTimers()
+{
+	static_assert(TIMER_COUNT <= 32, "timer slots must fit in the expiry mask");
+
+	unsigned long now = millis();
+	uint32_t expired = 0;
+
+	portENTER_CRITICAL(&_timerMux);
+	_timerPending = false;
+	for (int i = 0; i < TIMER_COUNT; i++)
+	{
+		ChronosTimer &timer = _timers[i];
+		if (!timer.active)
+			continue;
 
-				sendInfo();
-				sendBattery();
-				setNotifyBattery(_notifyPhone);
+		unsigned long deadline = timer.time + timer.duration;
+		if ((long)(now - deadline) >= 0)
+		{
+			expired |= (1UL << i);
+			if (!timer.repeat)
+			{
+				timer.active = false;
+				continue;
 			}
+			// keep the period, unless the loop fell behind by more than one period
+			timer.time = (long)(now - deadline) < timer.duration ? deadline : now;
+			deadline = timer.time + timer.duration;
+		}
+		if (!_timerPending || (long)(deadline - _nextDeadline) < 0)
+		{
+			_nextDeadline = deadline;
+			_timerPending = true;
+		}
+	}
+	portEXIT_CRITICAL(&_timerMux);
+
+	for (int i = 0; expired != 0; i++, expired >>= 1)
+	{
+		if (expired & 1)
+		{
+			timerExpired(i);
 		}
-		if (_findTimer.active)
+	}
+}
+
+/*!
+	@brief  timer expiry handler
+	@param  id
+			timer slot
+*/
+void ChronosESP32::timerExpired(int id)
+{
+	switch (id)
+	{
+	case TIMER_INFO:
+		if (_connected)
 		{
-			if (_findTimer.time + _findTimer.duration < millis())
+			_batteryChanged = false;
+			sendInfo();
+			sendBattery();
+			setNotifyBattery(_notifyPhone);
+			if (_wakeStats.ready == 0)
 			{
-				// timer end
-				_findTimer.active = false;
-				findPhone(false); // auto cancel the command
+				_wakeStats.ready = millis();
 			}
 		}
-		if (_batteryChanged)
+		break;
+	case TIMER_FIND:
+		if (_connected)
+		{
+			findPhone(false); // auto cancel the command
+		}
+		break;
+	case TIMER_BATTERY:
+		if (_connected && _batteryChanged)
 		{
 			_batteryChanged = false;
 			sendBattery();
 		}
-		if (_sendESP)
+		break;
+	case TIMER_ESP:
+		if (_connected)
 		{
-			_sendESP = false;
 			sendESP();
 		}
+		break;
+	case TIMER_RX:
+		// the rest of a packet never arrived, drop it
+		checkIncoming(true);
+		break;
+	case TIMER_SEDENTARY:
+		reminderExpired(REMINDER_SEDENTARY);
+		break;
+	case TIMER_WATER:
+		reminderExpired(REMINDER_WATER);
+		break;
+	case TIMER_LINK:
+		if (_bleCount > 0 && _linkEnabled)
+		{
+			unsigned long idle = millis() - _linkLast;
+			if (idle < _linkIdleTimeout)
+			{
+				// traffic since the timer was armed, wait for the rest of the idle period
+				armTimer(TIMER_LINK, _linkIdleTimeout - idle);
+				break;
+			}
+			_linkIdleArmed = false;
+			requestLinkMode(LINK_SLOW);
+		}
+		break;
+	case TIMER_ADV:
+		if (_bleCount < _maxConnections)
+		{
+			startAdvertisingPhase(ADV_SLOW);
+		}
+		break;
+	case TIMER_BULK:
+		bulkFinish();
+		break;
+	case TIMER_OTA:
+		if (_bulkConn == BLE_HS_CONN_HANDLE_NONE)
+		{
+			bulkAbort(); // not resumed in time
+		}
+		break;
+	case TIMER_STATE:
+		saveState();
+		break;
+	case TIMER_HEALTH:
+		streamHealth();
+		break;
+	case TIMER_AGGREGATE:
+		finishHealthHour();
+		break;
+	case TIMER_REALTIME:
+		streamRealtime();
+		break;
+	case TIMER_ALARM:
+		scheduleAlarms();
+		break;
+	default:
+		if (_timers[id].callback != nullptr)
+		{
+			_timers[id].callback(id - TIMER_INTERNAL);
+		}
+		break;
 	}
 }
 
@@ -189,7 +709,49 @@ void ChronosESP32::loop()
 */
 void ChronosESP32::setChunkedTransfer(bool chunked)
 {
+	portENTER_CRITICAL(&_connMux);
 	_chunked = chunked;
+	for (int i = 0; i < CS_MAX_CONNECTIONS; i++)
+	{
+		_conns[i].chunked = chunked;
+	}
+	portEXIT_CRITICAL(&_connMux);
+}
+
+/*!
+	@brief  set how many centrals can be connected at once, advertising continues until they are
+			wired peers do not count
+	@param  count
+			1 to CS_MAX_CONNECTIONS
+*/
+void ChronosESP32::setMaxConnections(uint8_t count)
+{
+	_maxConnections = constrain(count, 1, CS_MAX_CONNECTIONS);
+}
+
+/*!
+	@brief  get the number of connected peers, centrals and wired peers
+*/
+int ChronosESP32::getConnectionCount()
+{
+	return _connCount;
+}
+
+/*!
+	@brief  get a connected central
+	@param  index
+			0 to getConnectionCount() - 1
+	@return the central, handle BLE_HS_CONN_HANDLE_NONE if the index is out of range
+*/
+ChronosPeer ChronosESP32::getConnection(int index)
+{
+	ChronosPeer list[CS_MAX_CONNECTIONS];
+	int count = peers(list);
+	if (index < 0 || index >= count)
+	{
+		return {BLE_HS_CONN_HANDLE_NONE, 0, false, false};
+	}
+	return list[index];
 }
 
 /*!
@@ -216,6 +778,7 @@ bool ChronosESP32::isSubscribed()
 void ChronosESP32::set24Hour(bool mode)
 {
 	_hour24 = mode;
+	markState(STATE_SETTINGS);
 }
 
 /*!
@@ -231,14 +794,17 @@ bool ChronosESP32::is24Hour()
 */
 bool ChronosESP32::isQuietActive()
 {
-	if (!_quietEnabled)
-		return false;
-
-	uint16_t now = (this->getHour(true) * 60) + this->getMinute();
-	if (_quietStart <= _quietEnd)
-		return now >= _quietStart && now < _quietEnd;
+	return isQuietActive(captureTime());
+}
 
-	return now >= _quietStart || now < _quietEnd;
+/*!
+	@brief  check whether quiet hours are active at the snapshot time
+	@param  now
+			time snapshot
+*/
+bool ChronosESP32::isQuietActive(const TimeSnapshot &now)
+{
+	return isWindowActive(_quietEnabled, _quietStart, _quietEnd, now.minuteOfDay);
 }
 
 /*!
@@ -246,29 +812,189 @@ bool ChronosESP32::isQuietActive()
 */
 bool ChronosESP32::isSleepActive()
 {
-	if (!_sleepEnabled)
+	return isSleepActive(captureTime());
+}
+
+/*!
+	@brief  check whether sleep time is active at the snapshot time
+	@param  now
+			time snapshot
+*/
+bool ChronosESP32::isSleepActive(const TimeSnapshot &now)
+{
+	return isWindowActive(_sleepEnabled, _sleepStart, _sleepEnd, now.minuteOfDay);
+}
+
+/*!
+	@brief  check whether a daily window (minutes of the day) contains the given minute
+	@param  enabled
+			window enabled state
+	@param  start
+			start minute of the day
+	@param  end
+			end minute of the day, may be lower than start for windows past midnight
+	@param  now
+			minute of the day to check
+*/
+bool ChronosESP32::isWindowActive(bool enabled, uint16_t start, uint16_t end, uint16_t now)
+{
+	if (!enabled)
 		return false;
 
-	uint16_t now = (this->getHour(true) * 60) + this->getMinute();
-	if (_sleepStart <= _sleepEnd)
-		return now >= _sleepStart && now < _sleepEnd;
+	if (start <= end)
+		return now >= start && now < end;
 
-	return now >= _sleepStart || now < _sleepEnd;
+	return now >= start || now < end;
 }
 
 /*!
-	@brief  return the mac address
+	@brief  get a reminder schedule
+	@param  type
+			reminder type
 */
-String ChronosESP32::getAddress()
+Reminder &ChronosESP32::getReminder(ReminderType type)
 {
-	return _address;
+	return _reminders[type];
 }
 
 /*!
-	@brief  set the battery level
-	@param	level
-			battery level
-	@param	charging
+	@brief  set a reminder schedule
+	@param  type
+			reminder type
+	@param  reminder
+			the reminder schedule
+*/
+void ChronosESP32::setReminder(ReminderType type, Reminder reminder)
+{
+	_reminders[type] = reminder;
+	scheduleReminder(type);
+	markState(STATE_SETTINGS);
+}
+
+/*!
+	@brief  get the time of the next reminder
+	@param  type
+			reminder type
+	@return epoch in the same base as getEpoch(), 0 if the reminder is disabled
+*/
+unsigned long ChronosESP32::getNextReminderTime(ReminderType type)
+{
+	return _reminderTime[type];
+}
+
+/*!
+	@brief  compute the next reminder time and arm its timer
+	@param  type
+			reminder type
+*/
+void ChronosESP32::scheduleReminder(ReminderType type)
+{
+	Reminder &reminder = _reminders[type];
+	int timer = type == REMINDER_SEDENTARY ? TIMER_SEDENTARY : TIMER_WATER;
+
+	_reminderTime[type] = 0;
+	disarmTimer(timer);
+
+	if (!reminder.enabled || reminder.interval == 0)
+		return;
+
+	TimeSnapshot now = captureTime();
+	unsigned long midnight = now.epoch - ((now.minuteOfDay * 60UL) + now.second);
+	int length = (reminder.end + 1440 - reminder.start) % 1440;
+	if (length == 0)
+		length = 1440; // same start and end, remind all day
+
+	// the window may have started yesterday, or be later today or tomorrow
+	for (int d = -1; d <= 1 && _reminderTime[type] == 0; d++)
+	{
+		for (int m = reminder.interval; m < length; m += reminder.interval)
+		{
+			unsigned long time = midnight + (d * 86400L) + ((reminder.start + m) * 60UL);
+			if (time <= now.epoch)
+				continue;
+
+			uint16_t minute = (reminder.start + m) % 1440;
+			if (isWindowActive(_quietEnabled, _quietStart, _quietEnd, minute) || isWindowActive(_sleepEnabled, _sleepStart, _sleepEnd, minute))
+				continue;
+
+			_reminderTime[type] = time;
+			break;
+		}
+	}
+
+	if (_reminderTime[type] != 0)
+	{
+		armTimer(timer, (_reminderTime[type] - now.epoch) * 1000UL);
+	}
+}
+
+/*!
+	@brief  reschedule all reminders, eg. after the time or quiet/sleep windows change
+*/
+void ChronosESP32::scheduleReminders()
+{
+	scheduleReminder(REMINDER_SEDENTARY);
+	scheduleReminder(REMINDER_WATER);
+}
+
+/*!
+	@brief  reminder timer expiry
+	@param  type
+			reminder type
+*/
+void ChronosESP32::reminderExpired(ReminderType type)
+{
+	// millis and the clock can drift apart, only fire when the clock has reached the reminder
+	if (_reminderTime[type] != 0 && this->getEpoch() + 1 >= _reminderTime[type])
+	{
+		if (reminderCallback != nullptr)
+		{
+			reminderCallback(type);
+		}
+	}
+	scheduleReminder(type);
+}
+
+/*!
+	@brief  capture the current time once for several schedule queries
+*/
+TimeSnapshot ChronosESP32::captureTime()
+{
+	tm local = this->getTimeStruct();
+
+	TimeSnapshot now;
+	now.epoch = this->getEpoch();
+	now.second = local.tm_sec;
+	now.minute = local.tm_min;
+	now.hour = local.tm_hour;
+	now.dayOfWeek = local.tm_wday;
+	now.dayOfYear = local.tm_yday;
+	now.minuteOfDay = (local.tm_hour * 60) + local.tm_min;
+	now.repeatMask = local.tm_wday == 0 ? (1 << 6) : (1 << (local.tm_wday - 1));
+	return now;
+}
+
+/*!
+	@brief  get the time snapshot taken by the last loop() call
+*/
+const TimeSnapshot &ChronosESP32::getTimeSnapshot()
+{
+	return _timeSnapshot;
+}
+
+/*!
+	@brief  return the mac address
+*/
+String ChronosESP32::getAddress()
+{
+	return _address;
+}
+
+/*!
+	@brief  set the battery level
+	@param	level
+			battery level
+	@param	charging
 			charging state
 */
 void ChronosESP32::setBattery(uint8_t level, bool charging)
@@ -278,6 +1004,7 @@ void ChronosESP32::setBattery(uint8_t level, bool charging)
 		_batteryChanged = true;
 		_batteryLevel = level;
 		_isCharging = charging;
+		armTimer(TIMER_BATTERY, 0);
 	}
 }
 
@@ -335,6 +1062,7 @@ void ChronosESP32::clearNotifications()
 void ChronosESP32::setContact(int index, Contact contact)
 {
 	_contacts[index % CS_CONTACTS_SIZE] = contact;
+	markState(STATE_CONTACTS);
 }
 
 /*!
@@ -369,6 +1097,7 @@ Contact &ChronosESP32::getSoSContact()
 void ChronosESP32::setSOSContactIndex(int index)
 {
 	_sosContact = index;
+	markState(STATE_CONTACTS);
 }
 
 /*!
@@ -384,7 +1113,7 @@ int ChronosESP32::getSOSContactIndex()
 */
 int ChronosESP32::getWeatherCount()
 {
-	return _weatherSize;
+	return max(0, _weatherSize - weatherOffset(captureTime()));
 }
 
 /*!
@@ -404,23 +1133,283 @@ String ChronosESP32::getWeatherTime()
 }
 
 /*!
-	@brief  return the weather at the buffer index
+	@brief  return the weather for a day, days that passed since the weather was received are skipped
+			the entry is built from the packed arrays
 	@param  index
-			position of the weather to be returned
+			days from today
 */
-Weather &ChronosESP32::getWeatherAt(int index)
+Weather ChronosESP32::getWeatherAt(int index)
 {
-	return _weather[index % CS_WEATHER_SIZE];
+	return weatherEntry(weatherOffset(captureTime()) + (index % CS_WEATHER_SIZE));
 }
 
 /*!
-	@brief  return the weatherforecast for the hour
+	@brief  return the weather forecast for the hour
+			the entry is built from the packed arrays
 	@param  hour
-			position of the weather to be returned
+			hour of today, values from 24 continue into the next days
+*/
+HourlyForecast ChronosESP32::getForecastHour(int hour)
+{
+	TimeSnapshot now = captureTime();
+	if (now.epoch < CS_EPOCH_VALID)
+	{
+		// time not synced, forecast is stored by hour of the day
+		return forecastEntry(hour % CS_FORECAST_SIZE);
+	}
+
+	unsigned long midnight = now.epoch - ((now.minuteOfDay * 60UL) + now.second);
+	unsigned long time = midnight + (hour * 3600UL);
+	int slot = getForecastSlot(time);
+	// a slot not received or left over from an older forecast gives an empty entry
+	return forecastEntry(_forecastTime[slot] == time ? slot : -1);
+}
+
+/*!
+	@brief  get the daily weather for the day containing a time
+	@param  time
+			epoch (same base as getEpoch)
+	@param  weather
+			receives the weather
+	@return false if there is no weather for that day
+*/
+bool ChronosESP32::getWeatherOn(unsigned long time, Weather &weather)
+{
+	if (_weatherStart == 0 || time < _weatherStart)
+	{
+		return false;
+	}
+	unsigned long k = (time - _weatherStart) / 86400UL;
+	if (k >= (unsigned long)_weatherSize)
+	{
+		return false;
+	}
+	weather = weatherEntry(k);
+	return true;
+}
+
+/*!
+	@brief  get the forecast for the hour containing a time
+	@param  time
+			epoch (same base as getEpoch)
+	@param  forecast
+			receives the forecast
+	@return false if there is no forecast for that hour
+*/
+bool ChronosESP32::getForecastAt(unsigned long time, HourlyForecast &forecast)
+{
+	if (time < CS_EPOCH_VALID)
+	{
+		return false;
+	}
+	time -= time % 3600UL;
+	int slot = getForecastSlot(time);
+	if (_forecastTime[slot] != time)
+	{
+		return false;
+	}
+	forecast = forecastEntry(slot);
+	return true;
+}
+
+/*!
+	@brief  get the forecasts between two times, ordered by time
+	@param  from
+			epoch of the first hour (same base as getEpoch)
+	@param  to
+			epoch of the last hour, inclusive
+	@param  forecast
+			array that receives the forecasts
+	@param  maxCount
+			size of the array
+	@return number of forecasts copied
+*/
+int ChronosESP32::getForecastRange(unsigned long from, unsigned long to, HourlyForecast *forecast, int maxCount)
+{
+	from -= from % 3600UL;
+	int count = 0;
+	for (int i = 0; i < CS_FORECAST_SIZE; i++)
+	{
+		unsigned long time = _forecastTime[i];
+		if (time < CS_EPOCH_VALID || time < from || time > to)
+		{
+			continue;
+		}
+
+		// insertion sort, the store holds at most CS_FORECAST_SIZE entries
+		int j = count < maxCount ? count : maxCount - 1;
+		if (j < 0 || (count >= maxCount && time >= forecast[j].time))
+		{
+			continue;
+		}
+		while (j > 0 && forecast[j - 1].time > time)
+		{
+			forecast[j] = forecast[j - 1];
+			j--;
+		}
+		forecast[j] = forecastEntry(i);
+		if (count < maxCount)
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+/*!
+	@brief  return the time the daily weather was received, 0 if none
+*/
+unsigned long ChronosESP32::getWeatherReceived()
+{
+	return _weatherReceived;
+}
+
+/*!
+	@brief  return the time the hourly forecast was received, 0 if none
+*/
+unsigned long ChronosESP32::getForecastReceived()
+{
+	return _forecastReceived;
+}
+
+/*!
+	@brief  seconds since the daily weather was received
+	@return UINT32_MAX if none was received
+*/
+uint32_t ChronosESP32::getWeatherAge()
+{
+	unsigned long now = this->getEpoch();
+	if (_weatherReceived == 0)
+	{
+		return UINT32_MAX;
+	}
+	return now > _weatherReceived ? now - _weatherReceived : 0;
+}
+
+/*!
+	@brief  seconds since the hourly forecast was received
+	@return UINT32_MAX if none was received
+*/
+uint32_t ChronosESP32::getForecastAge()
+{
+	unsigned long now = this->getEpoch();
+	if (_forecastReceived == 0)
+	{
+		return UINT32_MAX;
+	}
+	return now > _forecastReceived ? now - _forecastReceived : 0;
+}
+
+/*!
+	@brief  daily temperatures, getWeatherCount() entries starting today
+*/
+const int16_t *ChronosESP32::getWeatherTemps()
+{
+	return _weatherTemp + weatherOffset(captureTime());
+}
+
+/*!
+	@brief  daily high temperatures, getWeatherCount() entries starting today
+*/
+const int16_t *ChronosESP32::getWeatherHighs()
+{
+	return _weatherHigh + weatherOffset(captureTime());
+}
+
+/*!
+	@brief  daily low temperatures, getWeatherCount() entries starting today
+*/
+const int16_t *ChronosESP32::getWeatherLows()
+{
+	return _weatherLow + weatherOffset(captureTime());
+}
+
+/*!
+	@brief  hourly temperatures, CS_FORECAST_SIZE entries indexed by getForecastSlot()
 */
-HourlyForecast &ChronosESP32::getForecastHour(int hour)
+const int16_t *ChronosESP32::getForecastTemps()
 {
-	return _hourlyForecast[hour % CS_FORECAST_SIZE];
+	return _forecastTemp;
+}
+
+/*!
+	@brief  start of the hour stored in each forecast slot, 0 if the slot is empty
+*/
+const unsigned long *ChronosESP32::getForecastTimes()
+{
+	return _forecastTime;
+}
+
+/*!
+	@brief  forecast store slot for an hour
+	@param  time
+			epoch (same base as getEpoch)
+*/
+int ChronosESP32::getForecastSlot(unsigned long time)
+{
+	return (time / 3600UL) % CS_FORECAST_SIZE;
+}
+
+/*!
+	@brief  number of days that passed since the daily weather was received
+	@param  now
+			current time
+*/
+int ChronosESP32::weatherOffset(const TimeSnapshot &now)
+{
+	unsigned long midnight = now.epoch - ((now.minuteOfDay * 60UL) + now.second);
+	if (_weatherStart == 0 || now.epoch < CS_EPOCH_VALID || midnight <= _weatherStart)
+	{
+		return 0;
+	}
+	unsigned long days = (midnight - _weatherStart + 43200UL) / 86400UL;
+	return days > CS_WEATHER_SIZE ? CS_WEATHER_SIZE : (int)days;
+}
+
+/*!
+	@brief  build the daily weather for an index of the packed arrays
+	@param  index
+			days from the day the weather was received, out of range gives an empty entry
+*/
+Weather ChronosESP32::weatherEntry(int index)
+{
+	Weather weather = {};
+	if (index < 0 || index >= CS_WEATHER_SIZE)
+	{
+		return weather;
+	}
+	weather.icon = _weatherIcon[index];
+	weather.day = _weatherDay[index];
+	weather.temp = _weatherTemp[index];
+	weather.high = _weatherHigh[index];
+	weather.low = _weatherLow[index];
+	weather.pressure = _weatherPressure[index];
+	weather.uv = _weatherUv[index];
+	weather.time = _weatherStart == 0 ? 0 : _weatherStart + (index * 86400UL);
+	return weather;
+}
+
+/*!
+	@brief  build the hourly forecast for a slot of the packed arrays
+	@param  slot
+			forecast slot, out of range gives an empty entry
+*/
+HourlyForecast ChronosESP32::forecastEntry(int slot)
+{
+	HourlyForecast forecast = {};
+	if (slot < 0 || slot >= CS_FORECAST_SIZE)
+	{
+		return forecast;
+	}
+	forecast.day = _forecastDay[slot];
+	forecast.hour = _forecastHour[slot];
+	forecast.icon = _forecastIcon[slot];
+	forecast.temp = _forecastTemp[slot];
+	forecast.uv = _forecastUv[slot];
+	forecast.humidity = _forecastHumidity[slot];
+	forecast.wind = _forecastWind[slot];
+	forecast.time = _forecastTime[slot];
+	return forecast;
 }
 
 /*!
@@ -451,6 +1440,9 @@ Alarm &ChronosESP32::getAlarm(int index)
 void ChronosESP32::setAlarm(int index, Alarm alarm)
 {
 	_alarms[index % CS_ALARM_SIZE] = alarm;
+	_alarmDue[index % CS_ALARM_SIZE] = 0;
+	armTimer(TIMER_ALARM, 0); // rescheduled from loop()
+	markState(STATE_ALARMS);
 }
 
 /*!
@@ -460,7 +1452,7 @@ void ChronosESP32::setAlarm(int index, Alarm alarm)
 */
 bool ChronosESP32::isAlarmActive(int index)
 {
-	return isAlarmActive(_alarms[index % CS_ALARM_SIZE]);
+	return isAlarmActive(_alarms[index % CS_ALARM_SIZE], captureTime());
 }
 
 /*!
@@ -470,31 +1462,54 @@ bool ChronosESP32::isAlarmActive(int index)
 */
 bool ChronosESP32::isAlarmActive(Alarm alarm)
 {
-	if (!alarm.enabled)
-		return false;
-
-	if (alarm.hour != this->getHour(true) || alarm.minute != this->getMinute())
-		return false;
+	return isAlarmActive(alarm, captureTime());
+}
 
-	if (alarm.repeat == 0x80 || alarm.repeat == 0x7F)
-		return true;
+/*!
+	@brief  check whether the alarm at the index is active at the snapshot time
+	@param	index
+			position of the alarm to be checked
+	@param  now
+			time snapshot
+*/
+bool ChronosESP32::isAlarmActive(int index, const TimeSnapshot &now)
+{
+	return isAlarmActive(_alarms[index % CS_ALARM_SIZE], now);
+}
 
-	int day = this->getDayofWeek(); // 0=Sun, ... 6=Sat
+/*!
+	@brief  check whether the alarm is active at the snapshot time
+	@param	alarm
+			the alarm object to be checked
+	@param  now
+			time snapshot
+*/
+bool ChronosESP32::isAlarmActive(Alarm alarm, const TimeSnapshot &now)
+{
+	if (!alarm.enabled || alarm.hour != now.hour || alarm.minute != now.minute)
+		return false;
 
-	if (day == 0) // Sunday → bit 6
-		return (alarm.repeat & (1 << 6)) != 0;
-	else // Mon–Sat → bits 0–5
-		return (alarm.repeat & (1 << (day - 1))) != 0;
+	return alarm.repeat == 0x80 || alarm.repeat == 0x7F || (alarm.repeat & now.repeatMask) != 0;
 }
 
 /*!
 	@brief  check whether any alarm is active
 */
 bool ChronosESP32::isAnyAlarmActive()
+{
+	return isAnyAlarmActive(captureTime());
+}
+
+/*!
+	@brief  check whether any alarm is active at the snapshot time
+	@param  now
+			time snapshot
+*/
+bool ChronosESP32::isAnyAlarmActive(const TimeSnapshot &now)
 {
 	for (int i = 0; i < CS_ALARM_SIZE; i++)
 	{
-		if (isAlarmActive(_alarms[i]))
+		if (isAlarmActive(_alarms[i], now))
 			return true;
 	}
 	return false;
@@ -508,65 +1523,289 @@ bool ChronosESP32::isAnyAlarmActive()
 			maximum alarms to write to the buffer
 */
 int ChronosESP32::getActiveAlarms(Alarm *alarms, int maxCount)
+{
+	return getActiveAlarms(alarms, maxCount, captureTime());
+}
+
+/*!
+	@brief  get alarms active at the snapshot time
+	@param  alarms
+			buffer to receive active alarms
+	@param  maxCount
+			maximum alarms to write to the buffer
+	@param  now
+			time snapshot
+*/
+int ChronosESP32::getActiveAlarms(Alarm *alarms, int maxCount, const TimeSnapshot &now)
 {
 	if (alarms == nullptr || maxCount <= 0)
 		return 0;
 
 	int count = 0;
-	const uint8_t hour = this->getHour(true);
-	const uint8_t minute = this->getMinute();
-	const uint8_t day = this->getDayofWeek();
-	const uint8_t repeatMask = day == 0 ? (1 << 6) : (1 << (day - 1));
-
 	for (int i = 0; i < CS_ALARM_SIZE && count < maxCount; i++)
 	{
-		Alarm &alarm = _alarms[i];
-
-		if (!alarm.enabled || alarm.hour != hour || alarm.minute != minute)
-			continue;
-
-		if (alarm.repeat == 0x80 || alarm.repeat == 0x7F || (alarm.repeat & repeatMask) != 0)
-			alarms[count++] = alarm;
+		if (isAlarmActive(_alarms[i], now))
+			alarms[count++] = _alarms[i];
 	}
 
 	return count;
 }
 
 /*!
-	@brief  send a command to the app
-	@param  command
-			command data
-	@param  length
-			command length
-	@param  force_chunked
-			override internal chunked
+	@brief  get the time of the next alarm
+			the alarms are not changed, one-shot alarms (repeat 0x80) are disabled from loop()
+	@return epoch in the same base as getEpoch(), 0 if no alarm is enabled
 */
-void ChronosESP32::sendCommand(uint8_t *command, size_t length, bool force_chunked)
+unsigned long ChronosESP32::getNextAlarmTime()
 {
-	if (!_inited)
-	{
-		// begin not called. do nothing
-		return;
-	}
+	return nextAlarm(captureTime(), nullptr);
+}
 
-	if ((length <= 20 || !_chunked) && !force_chunked)
-	{
-		// Send the entire command if it fits in one packet
-		pCharacteristicTX->setValue(command, length);
-		pCharacteristicTX->notify();
-		vTaskDelay(200 / portTICK_PERIOD_MS);
-	}
-	else
-	{
-		// Send the first 20 bytes as is (no header)
-		pCharacteristicTX->setValue(command, 20);
-		pCharacteristicTX->notify();
-		vTaskDelay(200 / portTICK_PERIOD_MS);
+/*!
+	@brief  get the index of the next alarm
+	@return alarm index, -1 if no alarm is enabled
+*/
+int ChronosESP32::getNextAlarmIndex()
+{
+	int index = -1;
+	nextAlarm(captureTime(), &index);
+	return index;
+}
 
-		// Send the remaining bytes with a header
-		const size_t maxPayloadSize = 19; // Payload size excluding header
-		uint8_t chunk[20];				  // Buffer for chunks with header
-		size_t offset = 20;				  // Start after the first 20 bytes
+/*!
+	@brief  get the number of seconds until the next alarm, eg. to set a deep sleep wakeup timer
+	@return seconds, 0 if no alarm is enabled
+*/
+unsigned long ChronosESP32::getSecondsToNextAlarm()
+{
+	TimeSnapshot now = captureTime();
+	unsigned long next = nextAlarm(now, nullptr);
+	return next > now.epoch ? next - now.epoch : 0;
+}
+
+/*!
+	@brief  find the next alarm across all alarm slots without changing them
+	@param  now
+			time snapshot
+	@param  index
+			receives the alarm index, -1 if none, may be nullptr
+	@return epoch of the next alarm, 0 if none
+*/
+unsigned long ChronosESP32::nextAlarm(const TimeSnapshot &now, int *index)
+{
+	unsigned long next = 0;
+	int nextIndex = -1;
+	for (int i = 0; i < CS_ALARM_SIZE; i++)
+	{
+		const Alarm &alarm = _alarms[i];
+		if (!alarm.enabled)
+			continue;
+
+		unsigned long due = _alarmDue[i];
+		if (alarm.repeat == 0x80 && due != 0 && now.epoch >= due)
+			continue; // a one-shot alarm that has fired, loop() disables it
+
+		unsigned long time = alarmOccurrence(alarm, now);
+		if (time != 0 && (next == 0 || time < next))
+		{
+			next = time;
+			nextIndex = i;
+		}
+	}
+
+	if (index != nullptr)
+		*index = nextIndex;
+	return next;
+}
+
+/*!
+	@brief  compute the next occurrence of an alarm
+	@param  alarm
+			the alarm object
+	@param  now
+			time snapshot
+	@return epoch after now, 0 if the alarm never fires
+*/
+unsigned long ChronosESP32::alarmOccurrence(const Alarm &alarm, const TimeSnapshot &now)
+{
+	time_t t = now.epoch + this->offset;
+	tm local;
+	localtime_r(&t, &local);
+
+	bool everyDay = alarm.repeat == 0x80 || alarm.repeat == 0x7F;
+	// today (if the time has not passed) up to the same weekday next week
+	for (int d = 0; d <= 7; d++)
+	{
+		int day = (now.dayOfWeek + d) % 7; // 0=Sun, ... 6=Sat
+		uint8_t repeatMask = day == 0 ? (1 << 6) : (1 << (day - 1));
+		if (!everyDay && (alarm.repeat & repeatMask) == 0)
+			continue;
+
+		// mktime on the local date keeps the alarm on the wall clock across DST changes
+		tm date = local;
+		date.tm_mday += d;
+		date.tm_hour = alarm.hour;
+		date.tm_min = alarm.minute;
+		date.tm_sec = 0;
+		date.tm_isdst = -1;
+		time_t fire = mktime(&date);
+		if (fire == (time_t)-1)
+			continue;
+
+		unsigned long time = (unsigned long)(fire - this->offset);
+		if (time > now.epoch)
+			return time;
+	}
+	return 0;
+}
+
+/*!
+	@brief  disable one-shot alarms that have fired and arm the timer for the next alarm
+			runs from loop(), or from begin() while restoring state
+*/
+void ChronosESP32::scheduleAlarms()
+{
+	TimeSnapshot snapshot = captureTime();
+	unsigned long now = snapshot.epoch;
+	unsigned long wake = 0;
+	uint32_t disabled = 0;
+
+	for (int i = 0; i < CS_ALARM_SIZE; i++)
+	{
+		Alarm &alarm = _alarms[i];
+		if (!alarm.enabled)
+		{
+			_alarmDue[i] = 0;
+			continue;
+		}
+		if (alarm.repeat != 0x80)
+			continue;
+
+		if (_alarmDue[i] != 0 && now >= _alarmDue[i])
+		{
+			if (now < _alarmDue[i] + 60)
+			{
+				// still active this minute, not rescheduled for tomorrow
+				if (wake == 0 || _alarmDue[i] + 60 < wake)
+					wake = _alarmDue[i] + 60;
+				continue;
+			}
+			// a one-shot alarm has fired, disable it
+			alarm.enabled = false;
+			_alarmDue[i] = 0;
+			disabled |= 1UL << i;
+			continue;
+		}
+		_alarmDue[i] = alarmOccurrence(alarm, snapshot);
+	}
+
+	unsigned long next = nextAlarm(snapshot, nullptr);
+	if (next != 0 && (wake == 0 || next < wake))
+		wake = next;
+
+	if (wake != 0)
+		armTimer(TIMER_ALARM, (wake - now) * 1000UL);
+	else
+		disarmTimer(TIMER_ALARM);
+
+	if (disabled == 0)
+		return;
+
+	markState(STATE_ALARMS);
+	for (int i = 0; i < CS_ALARM_SIZE; i++)
+	{
+		if ((disabled & (1UL << i)) && configurationReceivedCallback != nullptr)
+		{
+			Alarm &alarm = _alarms[i];
+			uint32_t value = ((uint32_t)alarm.hour << 24) | ((uint32_t)alarm.minute << 16) | ((uint32_t)alarm.repeat << 8);
+			configurationReceivedCallback(CF_ALARM, i, value); // enabled bit cleared
+		}
+	}
+}
+
+/*!
+	@brief  send a command to the app
+	@param  command
+			command data
+	@param  length
+			command length
+	@param  force_chunked
+			override internal chunked
+	@param  connHandle
+			central to send to, BLE_HS_CONN_HANDLE_NONE for every subscribed central
+*/
+void ChronosESP32::sendCommand(uint8_t *command, size_t length, bool force_chunked, uint16_t connHandle)
+{
+	if (!_inited)
+	{
+		// begin not called. do nothing
+		return;
+	}
+
+	broadcast(command, length, force_chunked, connHandle, true);
+}
+
+/*!
+	@brief  send a command to the subscribed centrals
+	@param  command
+			command data
+	@param  length
+			command length
+	@param  force_chunked
+			override internal chunked
+	@param  connHandle
+			central to send to, BLE_HS_CONN_HANDLE_NONE for every subscribed central
+	@param  paced
+			wait after each packet, callers that pace with a timer pass false
+*/
+void ChronosESP32::broadcast(const uint8_t *command, size_t length, bool force_chunked, uint16_t connHandle, bool paced)
+{
+	linkActivity(length > 20);
+
+	ChronosPeer list[CS_MAX_CONNECTIONS];
+	int count = peers(list);
+	for (int i = 0; i < count; i++)
+	{
+		if (list[i].subscribed && (connHandle == BLE_HS_CONN_HANDLE_NONE || list[i].handle == connHandle))
+		{
+			// each central gets the framing it asked for
+			sendFrame(command, length, force_chunked || (length > 20 && list[i].chunked), list[i].handle, paced);
+		}
+	}
+}
+
+/*!
+	@brief  send a command to one central
+	@param  command
+			command data
+	@param  length
+			command length
+	@param  chunked
+			split the command into 20 byte packets
+	@param  connHandle
+			central to send to
+	@param  paced
+			wait 200 ms after each packet
+*/
+void ChronosESP32::sendFrame(const uint8_t *command, size_t length, bool chunked, uint16_t connHandle, bool paced)
+{
+	TickType_t pause = paced ? 200 / portTICK_PERIOD_MS : 0;
+	if (!chunked)
+	{
+		// Send the entire command if it fits in one packet
+		notify(command, length, connHandle);
+		vTaskDelay(pause);
+	}
+	else
+	{
+		// Send the first 20 bytes as is (no header)
+		notify(command, 20, connHandle);
+		vTaskDelay(pause);
+
+		// Send the remaining bytes with a header
+		const size_t maxPayloadSize = 19; // Payload size excluding header
+		uint8_t chunk[20];				  // Buffer for chunks with header
+		size_t offset = 20;				  // Start after the first 20 bytes
 		uint8_t sequenceNumber = 0;		  // Sequence number for headers
 
 		while (offset < length)
@@ -581,9 +1820,8 @@ void ChronosESP32::sendCommand(uint8_t *command, size_t length, bool force_chunk
 			memcpy(chunk + 1, command + offset, bytesToSend);
 
 			// Send the chunk
-			pCharacteristicTX->setValue(chunk, bytesToSend + 1);
-			pCharacteristicTX->notify();
-			vTaskDelay(200 / portTICK_PERIOD_MS);
+			notify(chunk, bytesToSend + 1, connHandle);
+			vTaskDelay(pause);
 
 			// Update offset
 			offset += bytesToSend;
@@ -591,6 +1829,38 @@ void ChronosESP32::sendCommand(uint8_t *command, size_t length, bool force_chunk
 	}
 }
 
+/*!
+	@brief  send one packet through the transport of each peer
+	@param  data
+			packet data
+	@param  length
+			packet length
+	@param  connHandle
+			peer to send to, BLE_HS_CONN_HANDLE_NONE for every subscribed peer
+*/
+void ChronosESP32::notify(const uint8_t *data, size_t length, uint16_t connHandle)
+{
+	ChronosTransport *transports[CS_MAX_CONNECTIONS];
+	uint16_t handles[CS_MAX_CONNECTIONS];
+	int count = 0;
+	portENTER_CRITICAL(&_connMux);
+	for (int i = 0; i < CS_MAX_CONNECTIONS; i++)
+	{
+		ChronosConnection &conn = _conns[i];
+		if (conn.handle != BLE_HS_CONN_HANDLE_NONE && conn.subscribed && (connHandle == BLE_HS_CONN_HANDLE_NONE || conn.handle == connHandle))
+		{
+			transports[count] = conn.transport;
+			handles[count++] = conn.handle;
+		}
+	}
+	portEXIT_CRITICAL(&_connMux);
+
+	for (int i = 0; i < count; i++)
+	{
+		transports[i]->write(handles[i], data, length);
+	}
+}
+
 /*!
 	@brief  send a music control command to the app
 	@param  command
@@ -633,10 +1903,13 @@ bool ChronosESP32::capturePhoto()
 */
 void ChronosESP32::findPhone(bool state)
 {
-	_findTimer.active = state;
 	if (state)
 	{
-		_findTimer.time = millis();
+		armTimer(TIMER_FIND, CS_FIND_TIMEOUT);
+	}
+	else
+	{
+		disarmTimer(TIMER_FIND);
 	}
 	uint8_t c = state ? 0x01 : 0x00;
 	uint8_t findCmd[] = {0xAB, 0x00, 0x04, 0xFF, 0x7D, 0x80, c};
@@ -677,6 +1950,153 @@ RemoteTouch &ChronosESP32::getTouch()
 	return _touch;
 }
 
+/*!
+	@brief  return the number of queued touch events
+*/
+int ChronosESP32::getTouchEventCount()
+{
+	return _touchCount;
+}
+
+/*!
+	@brief  read the oldest queued touch event
+	@param  event
+			receives the event
+	@return false when there are no events
+*/
+bool ChronosESP32::readTouchEvent(TouchEvent &event)
+{
+	bool available = false;
+	portENTER_CRITICAL(&_touchMux);
+	if (_touchCount > 0)
+	{
+		event = _touchEvents[_touchHead];
+		_touchHead = (_touchHead + 1) % CS_TOUCH_SIZE;
+		_touchCount--;
+		available = true;
+	}
+	portEXIT_CRITICAL(&_touchMux);
+	return available;
+}
+
+/*!
+	@brief  block the calling task until a touch event is available
+	@param  event
+			receives the event
+	@param  timeout
+			maximum time to wait in milliseconds
+	@return false on timeout
+*/
+bool ChronosESP32::waitTouchEvent(TouchEvent &event, uint32_t timeout)
+{
+	if (readTouchEvent(event))
+	{
+		return true;
+	}
+	if (_touchSignal == nullptr)
+	{
+		// begin not called
+		return false;
+	}
+
+	unsigned long start = millis();
+	while (true)
+	{
+		TickType_t ticks = portMAX_DELAY;
+		if (timeout != portMAX_DELAY)
+		{
+			unsigned long elapsed = millis() - start;
+			if (elapsed >= timeout)
+			{
+				return false;
+			}
+			ticks = pdMS_TO_TICKS(timeout - elapsed);
+		}
+		if (xSemaphoreTake(_touchSignal, ticks) != pdTRUE)
+		{
+			return false;
+		}
+		if (readTouchEvent(event))
+		{
+			return true;
+		}
+		// signal left over from events that were already read, wait again
+	}
+}
+
+/*!
+	@brief  discard all queued touch events
+*/
+void ChronosESP32::clearTouchEvents()
+{
+	portENTER_CRITICAL(&_touchMux);
+	_touchCount = 0;
+	portEXIT_CRITICAL(&_touchMux);
+}
+
+/*!
+	@brief  number of touch events overwritten because the queue was full
+*/
+uint32_t ChronosESP32::getTouchDropped()
+{
+	return _touchDropped;
+}
+
+/*!
+	@brief  update the touch state and queue the resulting event
+	@param  state
+			pressed state
+	@param  x
+			x coordinate
+	@param  y
+			y coordinate
+*/
+void ChronosESP32::pushTouch(bool state, uint16_t x, uint16_t y)
+{
+	bool wasPressed = _touch.state;
+	_touch.state = state;
+	_touch.x = x;
+	_touch.y = y;
+
+	if (!state && !wasPressed)
+	{
+		// repeated release, nothing changed
+		return;
+	}
+
+	TouchEvent event;
+	event.type = !state ? TOUCH_RELEASE : (wasPressed ? TOUCH_MOVE : TOUCH_PRESS);
+	event.x = x;
+	event.y = y;
+	event.time = millis();
+
+	portENTER_CRITICAL(&_touchMux);
+	int last = (_touchHead + _touchCount + CS_TOUCH_SIZE - 1) % CS_TOUCH_SIZE;
+	if (event.type == TOUCH_MOVE && _touchCount > 0 && _touchEvents[last].type == TOUCH_MOVE)
+	{
+		// consumer is behind, only the latest position of a drag matters
+		_touchEvents[last] = event;
+	}
+	else
+	{
+		if (_touchCount == CS_TOUCH_SIZE)
+		{
+			// queue full, drop the oldest event
+			_touchHead = (_touchHead + 1) % CS_TOUCH_SIZE;
+			_touchCount--;
+			_touchDropped++;
+		}
+		_touchEvents[(_touchHead + _touchCount) % CS_TOUCH_SIZE] = event;
+		_touchCount++;
+	}
+	portEXIT_CRITICAL(&_touchMux);
+
+	if (_touchSignal != nullptr)
+	{
+		xSemaphoreGive(_touchSignal);
+	}
+}
+
 /*!
 	@brief  get the qr link at the index
 	@param	index
@@ -690,6 +2110,7 @@ String ChronosESP32::getQrAt(int index)
 void ChronosESP32::setQr(int index, String qr)
 {
 	_qrLinks[index % CS_QR_SIZE] = qr;
+	markState(STATE_QR);
 }
 
 /*!
@@ -762,6 +2183,16 @@ void ChronosESP32::setHealthRequestCallback(void (*callback)(HealthRequest, bool
 	healthRequestCallback = callback;
 }
 
+/*!
+	@brief  set the reminder callback, called when a sedentary or water reminder is due
+	@param  callback
+			callback function
+*/
+void ChronosESP32::setReminderCallback(void (*callback)(ReminderType))
+{
+	reminderCallback = callback;
+}
+
 /*!
 	@brief  send the info properties to the app
 */
@@ -890,10 +2321,9 @@ void ChronosESP32::sendRealtimeSteps(uint32_t steps, uint32_t calories)
 */
 void ChronosESP32::sendRealtimeHeartRate(uint8_t heartRate)
 {
-	// AB 00 05 FF 31 0A 49 1B
-	uint8_t heartCmd[] = {
-		0xAB, 0x00, 0x05, 0xFF, 0x31, 0x0A, heartRate, 0x1B};
-	sendCommand(heartCmd, 8);
+	uint8_t heartCmd[10];
+	uint8_t values[] = {heartRate, 0};
+	sendCommand(heartCmd, realtimeFrame(heartCmd, HEALTH_HEART_RATE, values));
 }
 
 /*!
@@ -906,10 +2336,9 @@ void ChronosESP32::sendRealtimeHeartRate(uint8_t heartRate)
 */
 void ChronosESP32::sendRealtimeBloodPressure(uint8_t systolic, uint8_t diastolic)
 {
-	// AB 00 05 FF 31 22 71 4C
-	uint8_t pressureCmd[] = {
-		0xAB, 0x00, 0x05, 0xFF, 0x31, 0x22, systolic, diastolic};
-	sendCommand(pressureCmd, 8);
+	uint8_t pressureCmd[10];
+	uint8_t values[] = {systolic, diastolic};
+	sendCommand(pressureCmd, realtimeFrame(pressureCmd, HEALTH_BLOOD_PRESSURE, values));
 }
 
 /*!
@@ -920,10 +2349,9 @@ void ChronosESP32::sendRealtimeBloodPressure(uint8_t systolic, uint8_t diastolic
 */
 void ChronosESP32::sendRealtimeBloodOxygen(uint8_t bloodOxygen)
 {
-	// AB 00 05 FF 31 12 62 30
-	uint8_t oxygenCmd[] = {
-		0xAB, 0x00, 0x05, 0xFF, 0x31, 0x12, bloodOxygen, 0x30};
-	sendCommand(oxygenCmd, 8);
+	uint8_t oxygenCmd[10];
+	uint8_t values[] = {bloodOxygen, 0};
+	sendCommand(oxygenCmd, realtimeFrame(oxygenCmd, HEALTH_BLOOD_OXYGEN, values));
 }
 
 /*!
@@ -940,10 +2368,9 @@ void ChronosESP32::sendRealtimeBloodOxygen(uint8_t bloodOxygen)
 */
 void ChronosESP32::sendRealtimeHealthData(uint8_t heartRate, uint8_t bloodOxygen, uint8_t systolic, uint8_t diastolic)
 {
-	// AB 00 07 FF 32 80 44 61 72 4B
-	uint8_t healthCmd[] = {
-		0xAB, 0x00, 0x07, 0xFF, 0x32, 0x80, heartRate, bloodOxygen, systolic, diastolic};
-	sendCommand(healthCmd, 10);
+	uint8_t healthCmd[10];
+	uint8_t values[] = {heartRate, bloodOxygen, systolic, diastolic};
+	sendCommand(healthCmd, realtimeFrame(healthCmd, HEALTH_TYPES, values));
 }
 
 /*!
@@ -971,14 +2398,14 @@ void ChronosESP32::sendRealtimeHealthData(uint8_t heartRate, uint8_t bloodOxygen
 */
 void ChronosESP32::sendStepsRecord(uint32_t steps, uint32_t calories, uint8_t hour, uint8_t day, uint8_t month, uint32_t year, uint8_t heartRate, uint8_t bloodOxygen, uint8_t systolic, uint8_t diastolic)
 {
-	uint8_t stepsCmd[] = {
-		0xAB, 0x00, 0x16, 0xFF, 0x51, 0x20,
-		(uint8_t)(year - 2000), month, day, hour,
-		(uint8_t)(steps >> 16), (uint8_t)(steps >> 8), (uint8_t)(steps),
-		(uint8_t)(calories >> 16), (uint8_t)(calories >> 8), (uint8_t)(calories),
-		heartRate, bloodOxygen, systolic, diastolic,
-		0x00, 0x00, 0x00, 0x00, 0x00};
-	sendCommand(stepsCmd, 25);
+	uint8_t stepsCmd[25];
+	DateTime dateTime = {0, 0, hour, day, month, year};
+	size_t length = healthRecordFrame(stepsCmd, HEALTH_STEPS, steps, calories, dateTime);
+	stepsCmd[16] = heartRate;
+	stepsCmd[17] = bloodOxygen;
+	stepsCmd[18] = systolic;
+	stepsCmd[19] = diastolic;
+	sendCommand(stepsCmd, length);
 }
 
 /*!
@@ -998,11 +2425,9 @@ void ChronosESP32::sendStepsRecord(uint32_t steps, uint32_t calories, uint8_t ho
 */
 void ChronosESP32::sendHeartRateRecord(uint8_t heartRate, uint8_t minute, uint8_t hour, uint8_t day, uint8_t month, uint32_t year)
 {
-	uint8_t heartCmd[] = {
-		0xAB, 0x00, 0x0A, 0xFF, 0x51, 0x11,
-		(uint8_t)(year - 2000), month, day, hour, minute,
-		heartRate, 0x00};
-	sendCommand(heartCmd, 13);
+	uint8_t heartCmd[25];
+	DateTime dateTime = {0, minute, hour, day, month, year};
+	sendCommand(heartCmd, healthRecordFrame(heartCmd, HEALTH_HEART_RATE, heartRate, 0, dateTime));
 }
 
 /*!
@@ -1024,11 +2449,9 @@ void ChronosESP32::sendHeartRateRecord(uint8_t heartRate, uint8_t minute, uint8_
 */
 void ChronosESP32::sendBloodPressureRecord(uint8_t systolic, uint8_t diastolic, uint8_t minute, uint8_t hour, uint8_t day, uint8_t month, uint32_t year)
 {
-	uint8_t pressureCmd[] = {
-		0xAB, 0x00, 0x0A, 0xFF, 0x51, 0x14,
-		(uint8_t)(year - 2000), month, day, hour, minute,
-		systolic, diastolic};
-	sendCommand(pressureCmd, 13);
+	uint8_t pressureCmd[25];
+	DateTime dateTime = {0, minute, hour, day, month, year};
+	sendCommand(pressureCmd, healthRecordFrame(pressureCmd, HEALTH_BLOOD_PRESSURE, systolic, diastolic, dateTime));
 }
 
 /*!
@@ -1048,11 +2471,9 @@ void ChronosESP32::sendBloodPressureRecord(uint8_t systolic, uint8_t diastolic,
 */
 void ChronosESP32::sendBloodOxygenRecord(uint8_t bloodOxygen, uint8_t minute, uint8_t hour, uint8_t day, uint8_t month, uint32_t year)
 {
-	uint8_t oxygenCmd[] = {
-		0xAB, 0x00, 0x0A, 0xFF, 0x51, 0x12,
-		(uint8_t)(year - 2000), month, day, hour, minute,
-		bloodOxygen, 0x00};
-	sendCommand(oxygenCmd, 13);
+	uint8_t oxygenCmd[25];
+	DateTime dateTime = {0, minute, hour, day, month, year};
+	sendCommand(oxygenCmd, healthRecordFrame(oxygenCmd, HEALTH_BLOOD_OXYGEN, bloodOxygen, 0, dateTime));
 }
 
 /*!
@@ -1074,11 +2495,9 @@ void ChronosESP32::sendBloodOxygenRecord(uint8_t bloodOxygen, uint8_t minute, ui
 */
 void ChronosESP32::sendSleepRecord(uint16_t sleepTime, SleepType type, uint8_t minute, uint8_t hour, uint8_t day, uint8_t month, uint32_t year)
 {
-	uint8_t sleepCmd[] = {
-		0xAB, 0x00, 0x0B, 0xFF, 0x52, 0x80,
-		(uint8_t)(year - 2000), month, day, hour, minute,
-		(uint8_t)(type), highByte(sleepTime), lowByte(sleepTime)};
-	sendCommand(sleepCmd, 14);
+	uint8_t sleepCmd[25];
+	DateTime dateTime = {0, minute, hour, day, month, year};
+	sendCommand(sleepCmd, healthRecordFrame(sleepCmd, HEALTH_SLEEP, sleepTime, type, dateTime));
 }
 
 /*!
@@ -1098,11 +2517,9 @@ void ChronosESP32::sendSleepRecord(uint16_t sleepTime, SleepType type, uint8_t m
 */
 void ChronosESP32::sendTemperatureRecord(float temperature, uint8_t minute, uint8_t hour, uint8_t day, uint8_t month, uint32_t year)
 {
-	uint8_t tempCmd[] = {
-		0xAB, 0x00, 0x0A, 0xFF, 0x51, 0x13,
-		(uint8_t)(year - 2000), month, day, hour, minute,
-		(uint8_t)(temperature), (uint8_t)((uint16_t)(temperature * 100.0) % 100)};
-	sendCommand(tempCmd, 13);
+	uint8_t tempCmd[25];
+	DateTime dateTime = {0, minute, hour, day, month, year};
+	sendCommand(tempCmd, healthRecordFrame(tempCmd, HEALTH_TEMPERATURE, (int32_t)(temperature * 100.0), 0, dateTime));
 }
 
 /*!
@@ -1192,172 +2609,3995 @@ void ChronosESP32::sendSleepRecord(uint16_t sleepTime, SleepType type, DateTime
 }
 
 /*!
-	@brief  charging status of the phone
+	@brief  mount the health log, a ring of CS_HEALTH_SECTOR sectors on a data partition
+			appending moves round the ring so every sector is erased equally often, the oldest sector is dropped when full
+	@param  label
+			partition label
+	@return false if the partition is missing or smaller than two sectors, or another instance has mounted the log
 */
-bool ChronosESP32::isPhoneCharging()
+bool ChronosESP32::beginHealthLog(const char *label)
 {
-	return _phoneInfo.isCharging;
+	if (!claimShared(_healthOwner))
+	{
+		// two instances appending to one ring would corrupt it
+		return false;
+	}
+	if (_healthLock == nullptr)
+	{
+		_healthLock = xSemaphoreCreateMutex();
+	}
+	xSemaphoreTake(_healthLock, portMAX_DELAY);
+
+	_healthPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+	_healthSectors = _healthPartition == nullptr ? 0 : _healthPartition->size / CS_HEALTH_SECTOR;
+	_healthHead = -1;
+	_healthSequence = 0;
+
+	// the head is the sector with the highest sequence
+	HealthSector header;
+	for (int i = 0; i < _healthSectors; i++)
+	{
+		if (readHealthSector(i, header) && (_healthHead < 0 || header.sequence > _healthSequence))
+		{
+			_healthHead = i;
+			_healthSequence = header.sequence;
+		}
+	}
+
+	bool ok = _healthSectors >= 2;
+	uint8_t *data = _healthHead < 0 ? nullptr : (uint8_t *)malloc(CS_HEALTH_SECTOR);
+	if (data != nullptr && esp_partition_read(_healthPartition, _healthHead * CS_HEALTH_SECTOR, data, CS_HEALTH_SECTOR) == ESP_OK)
+	{
+		// replay the head to restore the append position and the delta base
+		memcpy(&header, data, sizeof(header));
+		memset(&_healthCursor, 0, sizeof(_healthCursor));
+		_healthCursor.time = header.start;
+		_healthFirst = 0;
+		_healthLast = 0;
+		size_t pos = sizeof(HealthSector);
+		HealthRecord record;
+		while (decodeHealth(data, CS_HEALTH_SECTOR, pos, _healthCursor, record))
+		{
+			_healthFirst = (_healthFirst == 0 || record.time < _healthFirst) ? record.time : _healthFirst;
+			_healthLast = max(_healthLast, record.time);
+		}
+		_healthOffset = pos;
+		if (pos < CS_HEALTH_SECTOR && data[pos] != 0xFF)
+		{
+			_healthOffset = CS_HEALTH_SECTOR; // interrupted write, continue in the next sector
+		}
+	}
+	else if (_healthHead >= 0)
+	{
+		_healthOffset = CS_HEALTH_SECTOR;
+	}
+	free(data);
+	xSemaphoreGive(_healthLock);
+
+	Preferences prefs;
+	if (prefs.begin(_stateNamespace.c_str(), true))
+	{
+		if (prefs.getBytesLength("healthpos") == sizeof(_healthMark))
+		{
+			prefs.getBytes("healthpos", _healthMark, sizeof(_healthMark));
+		}
+		prefs.end();
+	}
+	for (int t = 0; t < HEALTH_TYPES; t++)
+	{
+		if (_healthMark[t].sequence > _healthSequence)
+		{
+			// the log was erased since, every record in it is new
+			memset(&_healthMark[t], 0, sizeof(_healthMark[t]));
+		}
+	}
+	for (int i = 0; i < CS_MAX_CONNECTIONS; i++)
+	{
+		resetHealthSync(_healthSyncs[i]);
+	}
+	if (!ok)
+	{
+		releaseShared(_healthOwner);
+	}
+	return ok;
 }
 
 /*!
-	@brief  battery level of the phone
+	@brief  append a record to the health log
+	@param  type
+			record type
+	@param  time
+			epoch of the record (same base as getEpoch)
+	@param  a
+			first value, see HealthType
+	@param  b
+			second value for steps (calories), blood pressure (diastolic) and sleep (SleepType)
+	@return false if the log is not mounted or the flash write failed
 */
-uint8_t ChronosESP32::getPhoneBattery()
+bool ChronosESP32::logHealth(HealthType type, unsigned long time, int32_t a, int32_t b)
 {
-	return _phoneInfo.batteryLevel;
-}
-
-/*!
-	@brief  app version code
+	if (_healthLock == nullptr || _healthSectors < 2 || type >= HEALTH_TYPES)
+	{
+		return false;
+	}
+
+	// header, zigzag varint time delta and value deltas, at most 16 bytes
+	uint8_t buffer[16];
+	uint8_t length = 0;
+	auto encode = [&](int32_t delta)
+	{
+		uint32_t value = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+		while (value >= 0x80)
+		{
+			buffer[length++] = (uint8_t)(value | 0x80);
+			value >>= 7;
+		}
+		buffer[length++] = (uint8_t)value;
+	};
+
+	xSemaphoreTake(_healthLock, portMAX_DELAY);
+	bool ok = true;
+	if (_healthHead < 0 || _healthOffset + sizeof(buffer) > CS_HEALTH_SECTOR)
+	{
+		ok = openHealthSector(time);
+	}
+	if (ok)
+	{
+		buffer[length++] = type;
+		encode((int32_t)(time - _healthCursor.time));
+		encode(a - _healthCursor.values[type][0]);
+		if (healthValues(type) > 1)
+		{
+			encode(b - _healthCursor.values[type][1]);
+		}
+		ok = esp_partition_write(_healthPartition, (_healthHead * CS_HEALTH_SECTOR) + _healthOffset, buffer, length) == ESP_OK;
+	}
+	if (ok)
+	{
+		_healthOffset += length;
+		_healthCursor.time = time;
+		_healthCursor.values[type][0] = a;
+		_healthCursor.values[type][1] = healthValues(type) > 1 ? b : 0;
+		_healthFirst = (_healthFirst == 0 || time < _healthFirst) ? time : _healthFirst;
+		_healthLast = max(_healthLast, time);
+	}
+	else
+	{
+		_healthOffset = CS_HEALTH_SECTOR; // skip whatever was partly written
+	}
+	xSemaphoreGive(_healthLock);
+	return ok;
+}
+
+/*!
+	@brief  read the records in a time range, oldest sector first
+	@param  from
+			earliest record time (inclusive)
+	@param  to
+			latest record time (inclusive)
+	@param  callback
+			called for each record without the log lock held, so it may log records, return false to stop
+	@param  types
+			bit (1 << HealthType) for each type to read
+	@return number of records passed to the callback
 */
-int ChronosESP32::getAppCode()
+int ChronosESP32::readHealth(unsigned long from, unsigned long to, bool (*callback)(const HealthRecord &), uint8_t types)
 {
-	return _phoneInfo.appCode;
+	if (callback == nullptr)
+	{
+		return 0;
+	}
+	auto visit = [](void *context, const HealthRecord &record)
+	{
+		return (*(bool (**)(const HealthRecord &))context)(record);
+	};
+	return scanHealth(from, to, types, visit, &callback);
 }
+
 /*!
-	@brief  app version name
+	@brief  visit the records in a time range, oldest sector first
+	@param  from
+			earliest record time (inclusive)
+	@param  to
+			latest record time (inclusive)
+	@param  types
+			bit (1 << HealthType) for each type to visit
+	@param  visit
+			called for each record with the context, return false to stop
+	@param  context
+			passed to visit
+	@param  position
+			optional, a valid position continues after the last record of the previous scan instead of
+			at the oldest sector, holds the position after each record while it is visited
+			and receives the position after the last record visited
+	@return number of records visited
 */
+int ChronosESP32::scanHealth(unsigned long from, unsigned long to, uint8_t types, bool (*visit)(void *, const HealthRecord &), void *context, HealthPosition *position)
+{
+	if (_healthLock == nullptr || _healthHead < 0)
+	{
+		return 0;
+	}
+	uint8_t *data = (uint8_t *)malloc(CS_HEALTH_SECTOR);
+	if (data == nullptr)
+	{
+		return 0;
+	}
 
-String ChronosESP32::getAppVersion()
+	xSemaphoreTake(_healthLock, portMAX_DELAY);
+	// the ring as it is now, sectors opened by records logged from the visitor are left for the next scan
+	int head = _healthHead;
+	int sectors = _healthSectors;
+	uint32_t newest = _healthSequence;
+	int start = 1;
+	if (position != nullptr && position->valid)
+	{
+		HealthSector header;
+		position->valid = position->sector < sectors && readHealthSector(position->sector, header) && header.sequence == position->sequence;
+		if (position->valid)
+		{
+			start = (position->sector - head + sectors) % sectors;
+			start = start == 0 ? sectors : start; // the head is visited last
+		}
+	}
+	xSemaphoreGive(_healthLock);
+
+	int count = 0;
+	bool running = head >= 0;
+	for (int i = start; i <= sectors && running; i++)
+	{
+		int sector = (head + i) % sectors; // the sector after the head is the oldest
+
+		// copy the sector under the lock, the records are visited without it so the visitor may log
+		xSemaphoreTake(_healthLock, portMAX_DELAY);
+		HealthSector header;
+		bool used = readHealthSector(sector, header) && header.sequence <= newest;
+		bool resume = used && position != nullptr && position->valid && position->sector == sector && header.sequence == position->sequence;
+		// closed sectors carry their time range, the head range is kept in memory
+		bool open = sector == _healthHead;
+		unsigned long first = open ? _healthFirst : header.first;
+		unsigned long last = open ? _healthLast : header.last;
+		if (used && !resume && (header.last != 0xFFFFFFFF || open))
+		{
+			used = last >= from && first <= to;
+		}
+		size_t length = open ? _healthOffset : CS_HEALTH_SECTOR;
+		used = used && esp_partition_read(_healthPartition, sector * CS_HEALTH_SECTOR, data, length) == ESP_OK;
+		xSemaphoreGive(_healthLock);
+		if (!used)
+			continue;
+
+		HealthCursor cursor;
+		memset(&cursor, 0, sizeof(cursor));
+		cursor.time = header.start;
+		size_t pos = sizeof(HealthSector);
+		if (resume)
+		{
+			cursor = position->cursor;
+			pos = position->pos;
+		}
+		HealthRecord record;
+		while (running && decodeHealth(data, length, pos, cursor, record))
+		{
+			if (record.time >= from && record.time <= to && (types & (1 << record.type)))
+			{
+				if (position != nullptr)
+				{
+					// the visitor can read where the record ends in the log
+					*position = {true, sector, header.sequence, pos, cursor};
+				}
+				count++;
+				running = visit(context, record);
+			}
+		}
+
+		if (position != nullptr)
+		{
+			// after the last visited record, or the end of what this sector holds so far
+			*position = {true, sector, header.sequence, pos, cursor};
+		}
+	}
+
+	free(data);
+	return count;
+}
+
+/*!
+	@brief  erase the whole health log
+*/
+void ChronosESP32::clearHealthLog()
 {
-	return _phoneInfo.appVersion;
+	if (_healthLock == nullptr || _healthSectors < 2)
+	{
+		return;
+	}
+	xSemaphoreTake(_healthLock, portMAX_DELAY);
+	esp_partition_erase_range(_healthPartition, 0, _healthSectors * CS_HEALTH_SECTOR);
+	_healthHead = -1;
+	// the sequence keeps counting, so records logged from now on are after every watermark
+	_healthOffset = 0;
+	_healthFirst = 0;
+	_healthLast = 0;
+	for (int i = 0; i < CS_MAX_CONNECTIONS; i++)
+	{
+		_healthSyncs[i].resume.valid = false;
+	}
+	xSemaphoreGive(_healthLock);
 }
 
 /*!
-	@brief  get navigation data
+	@brief  get the size, fill level and time range of the health log
 */
-Navigation &ChronosESP32::getNavigation()
+HealthLogInfo ChronosESP32::getHealthLogInfo()
 {
-	return _navigation;
+	HealthLogInfo info = {0, 0, 0, 0, 0, 0};
+	if (_healthLock == nullptr)
+	{
+		return info;
+	}
+
+	xSemaphoreTake(_healthLock, portMAX_DELAY);
+	info.size = _healthSectors * CS_HEALTH_SECTOR;
+	info.sectors = _healthSectors;
+	info.erases = _healthErases;
+	if (_healthHead >= 0)
+	{
+		info.newest = _healthLast;
+		for (int i = 1; i <= _healthSectors; i++)
+		{
+			int sector = (_healthHead + i) % _healthSectors;
+			HealthSector header;
+			if (!readHealthSector(sector, header))
+				continue;
+			if (sector == _healthHead)
+			{
+				info.used += min(_healthOffset, (uint16_t)CS_HEALTH_SECTOR);
+				info.oldest = info.oldest == 0 ? _healthFirst : info.oldest;
+			}
+			else
+			{
+				info.used += CS_HEALTH_SECTOR;
+				info.oldest = info.oldest == 0 ? header.first : info.oldest;
+			}
+		}
+	}
+	xSemaphoreGive(_healthLock);
+	return info;
 }
 
 /*!
-	@brief  get navigation icon
-	@return pointer to the icon data
+	@brief  close the head and start the next sector in the ring, erasing the oldest data
+	@param  time
+			time of the first record, the base of its delta
 */
-const uint8_t *ChronosESP32::getNavigationIcon()
+bool ChronosESP32::openHealthSector(unsigned long time)
 {
-	return _navigation.icon;
+	if (_healthHead >= 0)
+	{
+		closeHealthSector();
+	}
+
+	int sector = (_healthHead + 1) % _healthSectors;
+	if (esp_partition_erase_range(_healthPartition, sector * CS_HEALTH_SECTOR, CS_HEALTH_SECTOR) != ESP_OK)
+	{
+		return false;
+	}
+	_healthErases++;
+
+	// first and last stay erased until the sector is closed
+	HealthSector header = {CS_HEALTH_MAGIC, _healthSequence + 1, (uint32_t)time, 0xFFFFFFFF, 0xFFFFFFFF};
+	if (esp_partition_write(_healthPartition, sector * CS_HEALTH_SECTOR, &header, sizeof(header)) != ESP_OK)
+	{
+		return false;
+	}
+
+	_healthHead = sector;
+	_healthSequence = header.sequence;
+	_healthOffset = sizeof(HealthSector);
+	_healthFirst = 0;
+	_healthLast = 0;
+	memset(&_healthCursor, 0, sizeof(_healthCursor));
+	_healthCursor.time = time;
+	return true;
 }
 
-/**
-	@brief  get phone info
-	@return PhoneInfo
+/*!
+	@brief  write the time range into the head sector header
 */
-PhoneInfo &ChronosESP32::getPhoneInfo()
+void ChronosESP32::closeHealthSector()
 {
-	return _phoneInfo;
+	HealthSector header;
+	if (readHealthSector(_healthHead, header) && header.last == 0xFFFFFFFF)
+	{
+		uint32_t range[2] = {(uint32_t)_healthFirst, (uint32_t)_healthLast};
+		esp_partition_write(_healthPartition, (_healthHead * CS_HEALTH_SECTOR) + offsetof(HealthSector, first), range, sizeof(range));
+	}
 }
 
-/**
-	@brief  get music info
-	@return MusicInfo
+/*!
+	@brief  read a sector header
+	@param  sector
+			sector index in the ring
+	@param  header
+			header read
+	@return whether the sector holds log data
 */
-MusicInfo &ChronosESP32::getMusicInfo()
+bool ChronosESP32::readHealthSector(int sector, HealthSector &header)
 {
-	return _musicInfo;
+	return esp_partition_read(_healthPartition, sector * CS_HEALTH_SECTOR, &header, sizeof(header)) == ESP_OK && header.magic == CS_HEALTH_MAGIC;
 }
 
 /*!
-	@brief  get the app name from the notification id
-	@param  id
-			identifier of the app icon
+	@brief  decode the next record of a sector
+	@param  data
+			sector data
+	@param  length
+			bytes of data
+	@param  pos
+			read position, advanced past the record
+	@param  cursor
+			previous time and values, updated with the record
+	@param  record
+			decoded record
+	@return false at the end of the records
 */
-String ChronosESP32::appName(int id)
+bool ChronosESP32::decodeHealth(const uint8_t *data, size_t length, size_t &pos, HealthCursor &cursor, HealthRecord &record)
 {
-	switch (id)
+	if (pos >= length || data[pos] >= HEALTH_TYPES)
 	{
-	case 0x03:
-		return "Message";
-	case 0x04:
-		return "Mail";
-	case 0x07:
-		return "Tencent";
-	case 0x08:
-		return "Skype";
-	case 0x09:
-		return "Wechat";
-	case 0x0A:
-		return "WhatsApp";
-	case 0x0B:
-		return "Gmail";
-	case 0x0E:
-		return "Line";
-	case 0x0F:
-		return "Twitter";
-	case 0x10:
-		return "Facebook";
-	case 0x11:
-		return "Messenger";
-	case 0x12:
-		return "Instagram";
-	case 0x13:
-		return "Weibo";
-	case 0x14:
-		return "KakaoTalk";
-	case 0x16:
-		return "Viber";
-	case 0x17:
-		return "Vkontakte";
-	case 0x18:
-		return "Telegram";
-	case 0x1B:
-		return "DingTalk";
-	case 0x20:
-		return "WhatsApp Business";
-	case 0x22:
-		return "WearFit Pro";
-	case 0xC0:
-		return "Chronos";
+		return false; // erased flash reads 0xFF
+	}
+
+	size_t p = pos;
+	uint8_t type = data[p++];
+	int32_t deltas[3] = {0, 0, 0};
+	int count = 1 + healthValues(type);
+	for (int i = 0; i < count; i++)
+	{
+		uint32_t value = 0;
+		for (int shift = 0;; shift += 7)
+		{
+			if (p >= length || shift > 28)
+				return false;
+			uint8_t byte = data[p++];
+			value |= (uint32_t)(byte & 0x7F) << shift;
+			if (!(byte & 0x80))
+				break;
+		}
+		deltas[i] = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+	}
+
+	pos = p;
+	cursor.time += deltas[0];
+	cursor.values[type][0] += deltas[1];
+	cursor.values[type][1] += deltas[2];
+	record.type = (HealthType)type;
+	record.time = cursor.time;
+	record.a = cursor.values[type][0];
+	record.b = cursor.values[type][1];
+	return true;
+}
+
+/*!
+	@brief  number of values stored for a record type
+	@param  type
+			HealthType
+*/
+uint8_t ChronosESP32::healthValues(uint8_t type)
+{
+	return (type == HEALTH_STEPS || type == HEALTH_BLOOD_PRESSURE || type == HEALTH_SLEEP) ? 2 : 1;
+}
+
+/*!
+	@brief  build the record frame of a health type, the layout used by the send*Record() methods
+	@param  frame
+			receives the frame, 25 bytes
+	@param  type
+			HealthType
+	@param  a
+			first value, temperature in 1/100 degrees
+	@param  b
+			second value
+	@param  dateTime
+			time of the record
+	@return frame length, 0 for an unknown type
+*/
+size_t ChronosESP32::healthRecordFrame(uint8_t *frame, uint8_t type, int32_t a, int32_t b, const DateTime &dateTime)
+{
+	uint8_t head[] = {0xAB, 0x00, 0x0A, 0xFF, 0x51, 0x00, (uint8_t)(dateTime.year - 2000), dateTime.month, dateTime.day, dateTime.hour, dateTime.minute};
+	memset(frame, 0, 25);
+	memcpy(frame, head, sizeof(head));
+	switch (type)
+	{
+	case HEALTH_STEPS:
+		// hourly, the minute byte starts the values
+		frame[2] = 0x16;
+		frame[5] = 0x20;
+		frame[10] = (uint8_t)(a >> 16);
+		frame[11] = (uint8_t)(a >> 8);
+		frame[12] = (uint8_t)(a);
+		frame[13] = (uint8_t)(b >> 16);
+		frame[14] = (uint8_t)(b >> 8);
+		frame[15] = (uint8_t)(b);
+		return 25;
+	case HEALTH_HEART_RATE:
+		frame[5] = 0x11;
+		frame[11] = a;
+		return 13;
+	case HEALTH_BLOOD_OXYGEN:
+		frame[5] = 0x12;
+		frame[11] = a;
+		return 13;
+	case HEALTH_TEMPERATURE:
+		frame[5] = 0x13;
+		frame[11] = (uint8_t)(a / 100);
+		frame[12] = (uint8_t)(a % 100);
+		return 13;
+	case HEALTH_BLOOD_PRESSURE:
+		frame[5] = 0x14;
+		frame[11] = a;
+		frame[12] = b;
+		return 13;
+	case HEALTH_SLEEP:
+		frame[2] = 0x0B;
+		frame[4] = 0x52;
+		frame[5] = 0x80;
+		frame[11] = b;
+		frame[12] = highByte(a);
+		frame[13] = lowByte(a);
+		return 14;
 	default:
-		return "Message";
+		return 0;
+	}
+}
+
+/*!
+	@brief  answer record requests from the app with the health log
+			only records newer than the watermark of their type are sent, the healthRequestCallback is still called
+	@param  enabled
+			enable or disable state
+*/
+void ChronosESP32::setHealthSync(bool enabled)
+{
+	_healthSyncEnabled = enabled;
+}
+
+/*!
+	@brief  check whether records are being sent to the app
+*/
+bool ChronosESP32::isHealthSyncing()
+{
+	bool syncing = false;
+	for (int i = 0; i < CS_MAX_CONNECTIONS; i++)
+	{
+		syncing |= _healthSyncs[i].types != 0 || _healthSyncs[i].request != 0;
+	}
+	return syncing;
+}
+
+/*!
+	@brief  get the time of the last record of a type the app has received
+	@param  type
+			record type
+	@return epoch (same base as getEpoch), 0 if nothing was sent yet
+*/
+unsigned long ChronosESP32::getHealthWatermark(HealthType type)
+{
+	return type < HEALTH_TYPES ? _healthMark[type].time : 0;
+}
+
+/*!
+	@brief  forget the watermarks, the next request sends the whole log
+*/
+void ChronosESP32::resetHealthWatermarks()
+{
+	memset(_healthMark, 0, sizeof(_healthMark));
+	for (int i = 0; i < CS_MAX_CONNECTIONS; i++)
+	{
+		// running sessions continue from the start of the log
+		HealthSync &sync = _healthSyncs[i];
+		memset(sync.pending, 0, sizeof(sync.pending));
+		memset(sync.sent, 0, sizeof(sync.sent));
+		memset(&sync.resume, 0, sizeof(sync.resume));
+		sync.batchCount = 0;
+		sync.batchNext = 0;
+	}
+	saveHealthWatermarks();
+}
+
+/*!
+	@brief  queue a records request from a peer, the records are sent from loop()
+	@param  conn
+			peer that asked
+	@param  types
+			bit (1 << HealthType) for each requested type
+*/
+void ChronosESP32::requestHealthSync(const ChronosConnection &conn, uint8_t types)
+{
+	if (!_healthSyncEnabled || _healthSectors < 2)
+	{
+		return;
+	}
+	portENTER_CRITICAL(&_dirtyMux);
+	_healthSyncs[&conn - _conns].request |= types;
+	portEXIT_CRITICAL(&_dirtyMux);
+	armTimer(TIMER_HEALTH, 0);
+}
+
+/*!
+	@brief  send the next record of every sync session, one per peer per pass
+*/
+void ChronosESP32::streamHealth()
+{
+	bool more = false;
+	for (int i = 0; i < CS_MAX_CONNECTIONS; i++)
+	{
+		more |= streamHealth(i);
+	}
+	if (more)
+	{
+		armTimer(TIMER_HEALTH, CS_HEALTH_PACE);
+	}
+}
+
+/*!
+	@brief  send the next record of the sync session of one peer
+	@param  index
+			index of the peer in _conns
+	@return true if the session has more records
+*/
+bool ChronosESP32::streamHealth(int index)
+{
+	HealthSync &sync = _healthSyncs[index];
+	portENTER_CRITICAL(&_dirtyMux);
+	uint8_t request = sync.request;
+	bool lost = sync.lost;
+	sync.request = 0;
+	sync.lost = false;
+	portEXIT_CRITICAL(&_dirtyMux);
+	portENTER_CRITICAL(&_connMux);
+	uint16_t handle = _conns[index].handle;
+	portEXIT_CRITICAL(&_connMux);
+
+	if (lost || handle == BLE_HS_CONN_HANDLE_NONE)
+	{
+		// the window sent since the last checkpoint may not have arrived, it is resent on the next request
+		resetHealthSync(sync);
+		if (handle == BLE_HS_CONN_HANDLE_NONE)
+		{
+			return false;
+		}
+	}
+
+	uint8_t added = request & ~sync.types;
+	if (added != 0)
+	{
+		if (sync.types == 0 && commitHealthMarks(sync.pending))
+		{
+			// the link outlived the end of the last sync, its final window arrived
+			saveHealthWatermarks();
+		}
+		// new types resume from their checkpoint, the batch is refilled and the log rescanned to include them
+		sync.resume.valid = false;
+		for (int t = 0; t < HEALTH_TYPES; t++)
+		{
+			if (added & (1 << t))
+			{
+				sync.sent[t] = _healthMark[t];
+			}
+		}
+		sync.types |= added;
+		sync.batchCount = 0;
+		sync.batchNext = 0;
+	}
+	if (sync.types == 0)
+	{
+		return false;
+	}
+
+	if (sync.batchNext >= sync.batchCount)
+	{
+		// records are visited in log order, each type continues after the log position of its watermark,
+		// record times play no part, so records logged with an older or equal time are still sent
+		struct Batch
+		{
+			HealthSync *sync;
+			uint8_t count;
+		} batch = {&sync, 0};
+		auto collect = [](void *context, const HealthRecord &record)
+		{
+			Batch *batch = (Batch *)context;
+			HealthSync *sync = batch->sync;
+			HealthMark mark = {sync->resume.sequence, (uint32_t)sync->resume.pos, (uint32_t)record.time};
+			if (healthAfter(mark, sync->sent[record.type]))
+			{
+				sync->batch[batch->count] = record;
+				sync->batchMarks[batch->count++] = mark;
+			}
+			return batch->count < CS_HEALTH_BATCH;
+		};
+
+		if (!sync.resume.valid)
+		{
+			// start in the sector of the oldest watermark being synced
+			HealthMark *oldest = nullptr;
+			for (int t = 0; t < HEALTH_TYPES; t++)
+			{
+				if ((sync.types & (1 << t)) && (oldest == nullptr || healthAfter(*oldest, sync.sent[t])))
+				{
+					oldest = &sync.sent[t];
+				}
+			}
+			if (oldest != nullptr)
+			{
+				seekHealth(*oldest, sync.resume);
+			}
+		}
+		// later batches continue where the previous one stopped, types without new records do not
+		// pull the scan back to their older watermark
+		scanHealth(0, UINT32_MAX, sync.types, collect, &batch, &sync.resume);
+		sync.batchCount = batch.count;
+		sync.batchNext = 0;
+
+		if (sync.batchCount == 0)
+		{
+			// everything sent, the last window is kept once a later request shows the link survived
+			if (commitHealthMarks(sync.pending))
+			{
+				saveHealthWatermarks();
+			}
+			memcpy(sync.pending, sync.sent, sizeof(sync.pending));
+			sync.unsaved = 0;
+			sync.types = 0;
+			sync.resume.valid = false;
+			return false;
+		}
+	}
+
+	HealthMark &mark = sync.batchMarks[sync.batchNext];
+	HealthRecord &record = sync.batch[sync.batchNext++];
+	time_t t = record.time + this->offset;
+	tm local;
+	localtime_r(&t, &local);
+	DateTime dateTime = {(uint8_t)local.tm_sec, (uint8_t)local.tm_min, (uint8_t)local.tm_hour, (uint8_t)local.tm_mday, (uint8_t)(local.tm_mon + 1), (uint32_t)(local.tm_year + 1900)};
+
+	// same frames as the send*Record() methods, without their 200 ms wait, TIMER_HEALTH paces the records
+	uint8_t frame[25];
+	size_t length = healthRecordFrame(frame, record.type, record.a, record.b, dateTime);
+	if (length != 0 && _inited)
+	{
+		broadcast(frame, length, false, handle, false);
+	}
+	sync.sent[record.type] = mark;
+
+	if (++sync.unsaved >= CS_HEALTH_CHECKPOINT && !sync.lost)
+	{
+		// a record being sent does not show it arrived, but the link staying up for another
+		// window shows the previous one did, so the saved watermark lags one window behind
+		if (commitHealthMarks(sync.pending))
+		{
+			saveHealthWatermarks();
+		}
+		memcpy(sync.pending, sync.sent, sizeof(sync.pending));
+		sync.unsaved = 0;
+	}
+	return true;
+}
+
+/*!
+	@brief  drop the unconfirmed progress of a sync session, the next request resends it
+	@param  sync
+			session of a peer
+*/
+void ChronosESP32::resetHealthSync(HealthSync &sync)
+{
+	memcpy(sync.pending, _healthMark, sizeof(sync.pending));
+	memcpy(sync.sent, _healthMark, sizeof(sync.sent));
+	sync.types = 0;
+	sync.batchCount = 0;
+	sync.batchNext = 0;
+	sync.unsaved = 0;
+	sync.resume.valid = false;
+}
+
+/*!
+	@brief  advance the checkpointed watermarks, each type only moves forward since peers sync at their own pace
+	@param  marks
+			confirmed progress of a session
+	@return true if any watermark moved
+*/
+bool ChronosESP32::commitHealthMarks(const HealthMark *marks)
+{
+	bool moved = false;
+	for (int t = 0; t < HEALTH_TYPES; t++)
+	{
+		if (healthAfter(marks[t], _healthMark[t]))
+		{
+			_healthMark[t] = marks[t];
+			moved = true;
+		}
+	}
+	return moved;
+}
+
+/*!
+	@brief  position a scan at the start of the sector holding a watermark
+	@param  mark
+			watermark
+	@param  position
+			receives the position, left invalid to scan from the oldest sector if the sector was reused
+*/
+void ChronosESP32::seekHealth(const HealthMark &mark, HealthPosition &position)
+{
+	position.valid = false;
+	if (_healthLock == nullptr || mark.sequence == 0)
+	{
+		return;
+	}
+	xSemaphoreTake(_healthLock, portMAX_DELAY);
+	for (int i = 0; i < _healthSectors; i++)
+	{
+		HealthSector header;
+		if (readHealthSector(i, header) && header.sequence == mark.sequence)
+		{
+			memset(&position.cursor, 0, sizeof(position.cursor));
+			position.cursor.time = header.start;
+			position.sector = i;
+			position.sequence = header.sequence;
+			position.pos = sizeof(HealthSector);
+			position.valid = true;
+			break;
+		}
+	}
+	xSemaphoreGive(_healthLock);
+}
+
+/*!
+	@brief  compare two log positions
+	@return whether a is later in the log than b
+*/
+bool ChronosESP32::healthAfter(const HealthMark &a, const HealthMark &b)
+{
+	return a.sequence != b.sequence ? a.sequence > b.sequence : a.pos > b.pos;
+}
+
+/*!
+	@brief  persist the watermarks in NVS
+*/
+void ChronosESP32::saveHealthWatermarks()
+{
+	Preferences prefs;
+	if (prefs.begin(_stateNamespace.c_str(), false))
+	{
+		prefs.putBytes("healthpos", _healthMark, sizeof(_healthMark));
+		prefs.end();
+	}
+}
+
+/*!
+	@brief  add a raw sample to the hourly, daily and rolling buckets, safe to call from a sensor task
+	@param  type
+			sample type
+	@param  a
+			first value, an increment for steps
+	@param  b
+			second value, an increment for calories
+*/
+void ChronosESP32::addHealthSample(HealthType type, int32_t a, int32_t b)
+{
+	if (type >= HEALTH_TYPES)
+	{
+		return;
+	}
+	unsigned long local = this->getEpoch() + this->offset;
+	unsigned long hour = local / 3600;
+	unsigned long minute = local / 60;
+	int values = healthValues(type);
+	int32_t sample[2] = {a, b};
+
+	portENTER_CRITICAL(&_aggMux);
+	if (hour != _aggHourIndex)
+	{
+		rollHealthHour(hour);
+	}
+	bool first = !_aggSamples;
+	_aggSamples = true;
+	if (local / 86400 != _aggDayIndex)
+	{
+		_aggDayIndex = local / 86400;
+		memset(_aggDay, 0, sizeof(_aggDay));
+	}
+
+	int index = minute % CS_HEALTH_WINDOW;
+	if (_aggSlotMinute[index] != minute)
+	{
+		_aggSlotMinute[index] = minute;
+		memset(_aggSlots[index], 0, sizeof(_aggSlots[index]));
+	}
+
+	for (int i = 0; i < values; i++)
+	{
+		addHealthStats(_aggHour[type][i], sample[i]);
+		addHealthStats(_aggDay[type][i], sample[i]);
+		HealthSlot &slot = _aggSlots[index][type][i];
+		slot.min = (slot.count == 0 || sample[i] < slot.min) ? sample[i] : slot.min;
+		slot.max = (slot.count == 0 || sample[i] > slot.max) ? sample[i] : slot.max;
+		slot.sum += sample[i];
+		slot.count++;
+	}
+	portEXIT_CRITICAL(&_aggMux);
+
+	if (first)
+	{
+		// close the hour from loop() even if no later sample arrives
+		armTimer(TIMER_AGGREGATE, _aggFinishedCount != 0 ? 0 : (((hour + 1) * 3600) - local) * 1000UL);
+	}
+}
+
+/*!
+	@brief  get the running statistics of a sample type
+	@param  type
+			sample type
+	@param  period
+			current hour, today or the rolling window
+	@param  value
+			0 for the first value, 1 for the second (calories, diastolic)
+*/
+HealthStats ChronosESP32::getHealthStats(HealthType type, HealthPeriod period, int value)
+{
+	HealthStats stats = {0, 0, 0, 0, 0.0f};
+	if (type >= HEALTH_TYPES || value < 0 || value > 1)
+	{
+		return stats;
+	}
+	unsigned long local = this->getEpoch() + this->offset;
+	unsigned long minute = local / 60;
+
+	portENTER_CRITICAL(&_aggMux);
+	switch (period)
+	{
+	case PERIOD_HOUR:
+		if (local / 3600 == _aggHourIndex)
+			stats = _aggHour[type][value];
+		break;
+	case PERIOD_DAY:
+		if (local / 86400 == _aggDayIndex)
+			stats = _aggDay[type][value];
+		break;
+	case PERIOD_WINDOW:
+		// combine the slots of the last minutes, older slots are stale
+		for (int i = 0; i < CS_HEALTH_WINDOW; i++)
+		{
+			const HealthSlot &slot = _aggSlots[i][type][value];
+			if (slot.count == 0 || minute - _aggSlotMinute[i] >= CS_HEALTH_WINDOW)
+				continue;
+			stats.min = (stats.count == 0 || slot.min < stats.min) ? slot.min : stats.min;
+			stats.max = (stats.count == 0 || slot.max > stats.max) ? slot.max : stats.max;
+			stats.sum += slot.sum;
+			stats.count += slot.count;
+		}
+		break;
+	}
+	portEXIT_CRITICAL(&_aggMux);
+
+	stats.mean = stats.count == 0 ? 0.0f : (float)stats.sum / stats.count;
+	return stats;
+}
+
+/*!
+	@brief  get the aggregates of the current hour, in the form sendStepsRecord() takes
+*/
+HealthHour ChronosESP32::getHealthHour()
+{
+	unsigned long hour = (this->getEpoch() + this->offset) / 3600;
+	HealthStats stats[HEALTH_TYPES][2];
+	portENTER_CRITICAL(&_aggMux);
+	if (hour != _aggHourIndex)
+	{
+		rollHealthHour(hour);
+	}
+	memcpy(stats, _aggHour, sizeof(stats));
+	portEXIT_CRITICAL(&_aggMux);
+	// localtime_r takes the TZ lock, not allowed in the critical section
+	return healthHourEntry(hour, stats);
+}
+
+/*!
+	@brief  append each finished hour to the health log (steps, calories and the means of the other types)
+	@param  enabled
+			enable or disable state
+*/
+void ChronosESP32::setHealthLogHourly(bool enabled)
+{
+	_aggLogHourly = enabled;
+}
+
+/*!
+	@brief  queue the finished hour for loop() and start a new one, called with _aggMux held
+	@param  hour
+			local hour index of the new hour
+*/
+void ChronosESP32::rollHealthHour(unsigned long hour)
+{
+	if (_aggSamples)
+	{
+		// the entry is built by finishHealthHour() outside the lock
+		if (_aggFinishedCount == CS_HEALTH_HOUR_QUEUE)
+		{
+			// loop() has not run for hours, drop the oldest
+			_aggFinishedHead = (_aggFinishedHead + 1) % CS_HEALTH_HOUR_QUEUE;
+			_aggFinishedCount--;
+		}
+		int slot = (_aggFinishedHead + _aggFinishedCount++) % CS_HEALTH_HOUR_QUEUE;
+		memcpy(_aggFinished[slot], _aggHour, sizeof(_aggFinished[slot]));
+		_aggFinishedIndex[slot] = _aggHourIndex;
+	}
+	_aggHourIndex = hour;
+	_aggSamples = false;
+	memset(_aggHour, 0, sizeof(_aggHour));
+}
+
+/*!
+	@brief  build the summary of an hour, call without _aggMux held
+	@param  hour
+			local hour index
+	@param  stats
+			statistics of the hour, copied from _aggHour or _aggFinished
+*/
+HealthHour ChronosESP32::healthHourEntry(unsigned long hour, const HealthStats (&stats)[HEALTH_TYPES][2])
+{
+	HealthHour entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.time = (hour * 3600) - this->offset;
+	time_t t = entry.time + this->offset;
+	tm local;
+	localtime_r(&t, &local);
+	entry.dateTime = {(uint8_t)local.tm_sec, (uint8_t)local.tm_min, (uint8_t)local.tm_hour, (uint8_t)local.tm_mday, (uint8_t)(local.tm_mon + 1), (uint32_t)(local.tm_year + 1900)};
+
+	auto mean = [](const HealthStats &stats)
+	{
+		return stats.count == 0 ? 0 : (int32_t)(stats.sum / stats.count);
+	};
+	entry.steps = stats[HEALTH_STEPS][0].sum;
+	entry.calories = stats[HEALTH_STEPS][1].sum;
+	entry.heartRate = mean(stats[HEALTH_HEART_RATE][0]);
+	entry.bloodOxygen = mean(stats[HEALTH_BLOOD_OXYGEN][0]);
+	entry.systolic = mean(stats[HEALTH_BLOOD_PRESSURE][0]);
+	entry.diastolic = mean(stats[HEALTH_BLOOD_PRESSURE][1]);
+	entry.temperature = mean(stats[HEALTH_TEMPERATURE][0]);
+	return entry;
+}
+
+/*!
+	@brief  close the hour if it ended and deliver the finished hours, runs from loop()
+*/
+void ChronosESP32::finishHealthHour()
+{
+	unsigned long hour = (this->getEpoch() + this->offset) / 3600;
+	portENTER_CRITICAL(&_aggMux);
+	if (hour != _aggHourIndex)
+	{
+		rollHealthHour(hour);
+	}
+	bool samples = _aggSamples;
+	portEXIT_CRITICAL(&_aggMux);
+
+	if (samples)
+	{
+		unsigned long local = this->getEpoch() + this->offset;
+		armTimer(TIMER_AGGREGATE, (((hour + 1) * 3600) - local) * 1000UL);
+	}
+
+	HealthStats stats[HEALTH_TYPES][2];
+	unsigned long finished;
+	while (takeHealthHour(stats, finished))
+	{
+		deliverHealthHour(healthHourEntry(finished, stats));
+	}
+}
+
+/*!
+	@brief  take the oldest finished hour from the queue
+	@param  stats
+			receives the statistics of the hour
+	@param  finished
+			receives the local hour index
+	@return false if no hour is waiting
+*/
+bool ChronosESP32::takeHealthHour(HealthStats (&stats)[HEALTH_TYPES][2], unsigned long &finished)
+{
+	portENTER_CRITICAL(&_aggMux);
+	bool pending = _aggFinishedCount != 0;
+	if (pending)
+	{
+		memcpy(stats, _aggFinished[_aggFinishedHead], sizeof(stats));
+		finished = _aggFinishedIndex[_aggFinishedHead];
+		_aggFinishedHead = (_aggFinishedHead + 1) % CS_HEALTH_HOUR_QUEUE;
+		_aggFinishedCount--;
+	}
+	portEXIT_CRITICAL(&_aggMux);
+	return pending;
+}
+
+/*!
+	@brief  log a finished hour and pass it to the hour callback
+	@param  entry
+			summary of the hour
+*/
+void ChronosESP32::deliverHealthHour(const HealthHour &entry)
+{
+	if (_aggLogHourly)
+	{
+		logHealth(HEALTH_STEPS, entry.time, entry.steps, entry.calories);
+		if (entry.heartRate != 0)
+			logHealth(HEALTH_HEART_RATE, entry.time, entry.heartRate);
+		if (entry.bloodOxygen != 0)
+			logHealth(HEALTH_BLOOD_OXYGEN, entry.time, entry.bloodOxygen);
+		if (entry.systolic != 0)
+			logHealth(HEALTH_BLOOD_PRESSURE, entry.time, entry.systolic, entry.diastolic);
+		if (entry.temperature != 0)
+			logHealth(HEALTH_TEMPERATURE, entry.time, entry.temperature);
+	}
+	if (healthHourCallback != nullptr)
+	{
+		healthHourCallback(entry);
+	}
+}
+
+/*!
+	@brief  add a value to running statistics
+	@param  stats
+			statistics to update
+	@param  value
+			sample value
+*/
+void ChronosESP32::addHealthStats(HealthStats &stats, int32_t value)
+{
+	stats.min = (stats.count == 0 || value < stats.min) ? value : stats.min;
+	stats.max = (stats.count == 0 || value > stats.max) ? value : stats.max;
+	stats.sum += value;
+	stats.count++;
+}
+
+/*!
+	@brief  set up the realtime stream, during a measurement requested by the app the published samples are sent at this rate
+	@param  interval
+			time between frames (ms), at least CS_REALTIME_MIN_INTERVAL, 0 disables the stream
+	@param  mode
+			send the latest sample or the mean of the samples since the last frame
+*/
+void ChronosESP32::setRealtimeStream(uint32_t interval, RealtimeMode mode)
+{
+	if (interval != 0 && interval < CS_REALTIME_MIN_INTERVAL)
+	{
+		interval = CS_REALTIME_MIN_INTERVAL;
+	}
+	portENTER_CRITICAL(&_rtMux);
+	_rtInterval = interval;
+	_rtMode = mode;
+	bool active = _rtRequests != 0;
+	portEXIT_CRITICAL(&_rtMux);
+
+	if (interval == 0)
+	{
+		stopRealtime();
+	}
+	else if (active)
+	{
+		armTimer(TIMER_REALTIME, interval, true);
+	}
+}
+
+/*!
+	@brief  publish a realtime sample, ignored unless the app is measuring, safe to call from a sensor task
+	@param  type
+			HEALTH_HEART_RATE, HEALTH_BLOOD_OXYGEN or HEALTH_BLOOD_PRESSURE
+	@param  a
+			first value, systolic for blood pressure
+	@param  b
+			second value, diastolic for blood pressure
+*/
+void ChronosESP32::publishRealtime(HealthType type, uint8_t a, uint8_t b)
+{
+	if (type != HEALTH_HEART_RATE && type != HEALTH_BLOOD_OXYGEN && type != HEALTH_BLOOD_PRESSURE)
+	{
+		return;
+	}
+	portENTER_CRITICAL(&_rtMux);
+	if (_rtRequests != 0)
+	{
+		RealtimeChannel &channel = _rtChannels[type];
+		channel.sum[0] += a;
+		channel.sum[1] += b;
+		channel.latest[0] = a;
+		channel.latest[1] = b;
+		channel.count++;
+		_rtReady |= 1 << type;
+	}
+	portEXIT_CRITICAL(&_rtMux);
+}
+
+/*!
+	@brief  check whether a realtime session is running
+*/
+bool ChronosESP32::isRealtimeStreaming()
+{
+	return _rtRequests != 0;
+}
+
+/*!
+	@brief  end the realtime session, the app ends it by stopping the measurement
+*/
+void ChronosESP32::stopRealtime()
+{
+	portENTER_CRITICAL(&_rtMux);
+	_rtRequests = 0;
+	portEXIT_CRITICAL(&_rtMux);
+	disarmTimer(TIMER_REALTIME);
+}
+
+/*!
+	@brief  start or stop a measurement of the realtime session
+	@param  request
+			bit (1 << HealthType), (1 << HEALTH_TYPES) for all measurements
+	@param  state
+			measurement started or stopped by the app
+*/
+void ChronosESP32::realtimeRequest(uint8_t request, bool state)
+{
+	portENTER_CRITICAL(&_rtMux);
+	if (_rtInterval == 0)
+	{
+		portEXIT_CRITICAL(&_rtMux);
+		return;
+	}
+	bool started = state && _rtRequests == 0;
+	if (started)
+	{
+		// a new session, samples of the previous one are not sent
+		memset(_rtChannels, 0, sizeof(_rtChannels));
+		_rtReady = 0;
+	}
+	_rtRequests = state ? (_rtRequests | request) : (_rtRequests & ~request);
+	bool active = _rtRequests != 0;
+	uint32_t interval = _rtInterval;
+	portEXIT_CRITICAL(&_rtMux);
+
+	if (started)
+	{
+		armTimer(TIMER_REALTIME, interval, true);
+	}
+	else if (!active)
+	{
+		disarmTimer(TIMER_REALTIME);
+	}
+}
+
+/*!
+	@brief  send one realtime frame, concurrent measurements take turns
+*/
+void ChronosESP32::streamRealtime()
+{
+	uint8_t frame[10];
+	size_t length = 0;
+	uint8_t values[4];
+
+	portENTER_CRITICAL(&_rtMux);
+	for (int i = 0; i <= HEALTH_TYPES && length == 0; i++)
+	{
+		int request = (_rtNext + i) % (HEALTH_TYPES + 1);
+		if (!(_rtRequests & (1 << request)))
+		{
+			continue;
+		}
+		switch (request)
+		{
+		case HEALTH_HEART_RATE:
+			if (_rtReady & (1 << HEALTH_HEART_RATE))
+			{
+				takeRealtime(HEALTH_HEART_RATE, values);
+				length = realtimeFrame(frame, HEALTH_HEART_RATE, values);
+			}
+			break;
+		case HEALTH_BLOOD_OXYGEN:
+			if (_rtReady & (1 << HEALTH_BLOOD_OXYGEN))
+			{
+				takeRealtime(HEALTH_BLOOD_OXYGEN, values);
+				length = realtimeFrame(frame, HEALTH_BLOOD_OXYGEN, values);
+			}
+			break;
+		case HEALTH_BLOOD_PRESSURE:
+			if (_rtReady & (1 << HEALTH_BLOOD_PRESSURE))
+			{
+				takeRealtime(HEALTH_BLOOD_PRESSURE, values);
+				length = realtimeFrame(frame, HEALTH_BLOOD_PRESSURE, values);
+			}
+			break;
+		case HEALTH_TYPES:
+			if (_rtReady != 0)
+			{
+				// types without samples are sent as 0
+				takeRealtime(HEALTH_HEART_RATE, values);
+				takeRealtime(HEALTH_BLOOD_OXYGEN, values + 1);
+				takeRealtime(HEALTH_BLOOD_PRESSURE, values + 2);
+				length = realtimeFrame(frame, HEALTH_TYPES, values);
+			}
+			break;
+		}
+		if (length != 0)
+		{
+			_rtNext = request + 1;
+		}
+	}
+	portEXIT_CRITICAL(&_rtMux);
+
+	if (length == 0 || !_inited || !_connected)
+	{
+		return;
+	}
+	linkActivity(false);
+	notify(frame, length, BLE_HS_CONN_HANDLE_NONE); // no delay, the timer paces the frames
+}
+
+/*!
+	@brief  build a realtime measurement frame, the layout shared by the sendRealtime*() methods and the stream
+	@param  frame
+			receives the frame, 10 bytes
+	@param  type
+			HEALTH_HEART_RATE, HEALTH_BLOOD_OXYGEN, HEALTH_BLOOD_PRESSURE or HEALTH_TYPES for the combined frame
+	@param  values
+			two values, four for the combined frame (heart rate, blood oxygen, systolic, diastolic)
+	@return frame length, 0 for an unknown type
+*/
+size_t ChronosESP32::realtimeFrame(uint8_t *frame, int type, const uint8_t *values)
+{
+	uint8_t head[] = {0xAB, 0x00, 0x05, 0xFF, 0x31};
+	memcpy(frame, head, sizeof(head));
+	switch (type)
+	{
+	case HEALTH_HEART_RATE:
+		// AB 00 05 FF 31 0A 49 1B
+		frame[5] = 0x0A;
+		frame[6] = values[0];
+		frame[7] = 0x1B;
+		return 8;
+	case HEALTH_BLOOD_OXYGEN:
+		// AB 00 05 FF 31 12 62 30
+		frame[5] = 0x12;
+		frame[6] = values[0];
+		frame[7] = 0x30;
+		return 8;
+	case HEALTH_BLOOD_PRESSURE:
+		// AB 00 05 FF 31 22 71 4C
+		frame[5] = 0x22;
+		frame[6] = values[0];
+		frame[7] = values[1];
+		return 8;
+	case HEALTH_TYPES:
+		// AB 00 07 FF 32 80 44 61 72 4B
+		frame[2] = 0x07;
+		frame[4] = 0x32;
+		frame[5] = 0x80;
+		memcpy(frame + 6, values, 4);
+		return 10;
+	}
+	return 0;
+}
+
+/*!
+	@brief  read a realtime channel and start a new averaging period, called with _rtMux held
+	@param  type
+			channel
+	@param  values
+			receives the two values, the held values when no sample arrived since the last frame
+*/
+void ChronosESP32::takeRealtime(HealthType type, uint8_t *values)
+{
+	RealtimeChannel &channel = _rtChannels[type];
+	for (int i = 0; i < 2; i++)
+	{
+		values[i] = (_rtMode == REALTIME_AVERAGE && channel.count != 0) ? (channel.sum[i] + channel.count / 2) / channel.count : channel.latest[i];
+		channel.sum[i] = 0;
+	}
+	channel.count = 0;
+}
+
+/*!
+	@brief  charging status of the phone
+*/
+bool ChronosESP32::isPhoneCharging()
+{
+	return _phoneInfo.isCharging;
+}
+
+/*!
+	@brief  battery level of the phone
+*/
+uint8_t ChronosESP32::getPhoneBattery()
+{
+	return _phoneInfo.batteryLevel;
+}
+
+/*!
+	@brief  app version code
+*/
+int ChronosESP32::getAppCode()
+{
+	return _phoneInfo.appCode;
+}
+/*!
+	@brief  app version name
+*/
+
+String ChronosESP32::getAppVersion()
+{
+	return _phoneInfo.appVersion;
+}
+
+/*!
+	@brief  get navigation data
+*/
+Navigation &ChronosESP32::getNavigation()
+{
+	return _navigation;
+}
+
+/*!
+	@brief  get navigation icon
+	@return pointer to the icon data, not written by new icons until the next call
+*/
+const uint8_t *ChronosESP32::getNavigationIcon()
+{
+	return _navIcons[acquireNavIcon()];
+}
+
+/*!
+	@brief  hand the latest navigation icon to the reader, the assembly moves to another buffer
+	@return buffer index
+*/
+uint8_t ChronosESP32::acquireNavIcon()
+{
+	portENTER_CRITICAL(&_navIconMux);
+	uint8_t front = _navIconFront;
+	_navIconReader = front;
+	portEXIT_CRITICAL(&_navIconMux);
+	return front;
+}
+
+/*!
+	@brief  set whether assembled navigation icons are checked against the CRC from the app, off by default
+			the check assumes the app sends an IEEE CRC32 of the 288 icon bytes
+	@param  enabled
+			state, icons that fail the check are dropped
+*/
+void ChronosESP32::setNavigationIconCheck(bool enabled)
+{
+	_navIconCheck = enabled;
+}
+
+/*!
+	@brief  number of navigation icons dropped because of a CRC mismatch
+*/
+uint32_t ChronosESP32::getNavigationIconErrors()
+{
+	return _navIconErrors;
+}
+
+/*!
+	@brief  get the navigation icon converted to a display format, conversions are cached by icon CRC
+	@param  format
+			ICON_RGB565, ICON_ALPHA8, ICON_RGB565_2X or ICON_ALPHA8_2X
+	@param  color
+			RGB565 color of set pixels, ignored for alpha formats
+	@param  background
+			RGB565 color of clear pixels, ignored for alpha formats
+	@return pixel data, valid until CS_ICON_CACHE_SIZE other conversions are requested. nullptr if out of memory
+*/
+const uint8_t *ChronosESP32::getNavigationIcon(IconFormat format, uint16_t color, uint16_t background)
+{
+	uint8_t front = acquireNavIcon();
+	uint32_t crc = _navIconCRCs[front];
+	if (format == ICON_ALPHA8 || format == ICON_ALPHA8_2X)
+	{
+		color = 0;
+		background = 0;
+	}
+
+	// look up the conversion, otherwise take an empty or the least recently used entry
+	ChronosIcon *entry = &_iconCache[0];
+	for (int i = 0; i < CS_ICON_CACHE_SIZE; i++)
+	{
+		ChronosIcon &icon = _iconCache[i];
+		if (icon.data != nullptr && icon.crc == crc && icon.format == format && icon.color == color && icon.background == background)
+		{
+			icon.used = ++_iconCacheTick;
+			_iconCacheHits++;
+			return icon.data;
+		}
+		if (entry->data != nullptr && (icon.data == nullptr || icon.used < entry->used))
+		{
+			entry = &icon;
+		}
+	}
+	_iconCacheMisses++;
+
+	int bpp = (format == ICON_RGB565 || format == ICON_RGB565_2X) ? 2 : 1;
+	int scale = (format == ICON_RGB565_2X || format == ICON_ALPHA8_2X) ? 2 : 1;
+	size_t size = CS_ICON_SIZE * CS_ICON_SIZE * bpp * scale * scale;
+	if (entry->size != size)
+	{
+		free(entry->data);
+		entry->data = (uint8_t *)malloc(size);
+		entry->size = entry->data != nullptr ? size : 0;
+		if (entry->data == nullptr)
+		{
+			return nullptr;
+		}
+	}
+
+	expandIcon(_navIcons[front], entry->data, format, color, background);
+	entry->crc = crc;
+	entry->format = format;
+	entry->color = color;
+	entry->background = background;
+	entry->used = ++_iconCacheTick;
+	return entry->data;
+}
+
+/*!
+	@brief  free all cached icon conversions
+*/
+void ChronosESP32::clearIconCache()
+{
+	for (int i = 0; i < CS_ICON_CACHE_SIZE; i++)
+	{
+		free(_iconCache[i].data);
+		_iconCache[i].data = nullptr;
+		_iconCache[i].size = 0;
+	}
+}
+
+/*!
+	@brief  number of icon requests served from the cache
+*/
+uint32_t ChronosESP32::getIconCacheHits()
+{
+	return _iconCacheHits;
+}
+
+/*!
+	@brief  number of icon requests that needed a conversion
+*/
+uint32_t ChronosESP32::getIconCacheMisses()
+{
+	return _iconCacheMisses;
+}
+
+/*!
+	@brief  expand a 1bpp icon, a 4 pixel lookup table writes whole words instead of single pixels
+	@param  icon
+			48x48 1bpp source, MSB first
+	@param  out
+			destination, 4 byte aligned
+	@param  format
+			output format
+	@param  color
+			RGB565 color of set pixels
+	@param  background
+			RGB565 color of clear pixels
+*/
+void ChronosESP32::expandIcon(const uint8_t *icon, uint8_t *out, IconFormat format, uint16_t color, uint16_t background)
+{
+	int bpp = (format == ICON_RGB565 || format == ICON_RGB565_2X) ? 2 : 1;
+	int scale = (format == ICON_RGB565_2X || format == ICON_ALPHA8_2X) ? 2 : 1;
+	int words = bpp * scale; // output words for one nibble of 4 source pixels
+
+	// output of every nibble value, the high bit is the leftmost pixel
+	uint32_t lut[16][4];
+	for (int n = 0; n < 16; n++)
+	{
+		uint8_t *p = (uint8_t *)lut[n];
+		for (int b = 3; b >= 0; b--)
+		{
+			bool on = (n >> b) & 1;
+			for (int s = 0; s < scale; s++)
+			{
+				if (bpp == 2)
+				{
+					uint16_t px = on ? color : background;
+					memcpy(p, &px, 2);
+					p += 2;
+				}
+				else
+				{
+					*p++ = on ? 0xFF : 0x00;
+				}
+			}
+		}
+	}
+
+	int rowWords = (CS_ICON_SIZE * bpp * scale) / 4;
+	uint32_t *dst = (uint32_t *)out;
+	for (int y = 0; y < CS_ICON_SIZE; y++)
+	{
+		uint32_t *row = dst;
+		for (int x = 0; x < CS_ICON_SIZE / 8; x++)
+		{
+			uint8_t bits = *icon++;
+			const uint32_t *hi = lut[bits >> 4];
+			const uint32_t *lo = lut[bits & 0x0F];
+			for (int w = 0; w < words; w++)
+			{
+				*dst++ = hi[w];
+			}
+			for (int w = 0; w < words; w++)
+			{
+				*dst++ = lo[w];
+			}
+		}
+		if (scale == 2)
+		{
+			// repeat the row
+			memcpy(dst, row, rowWords * 4);
+			dst += rowWords;
+		}
+	}
+}
+
+/**
+	@brief  get phone info
+	@return PhoneInfo
+*/
+PhoneInfo &ChronosESP32::getPhoneInfo()
+{
+	return _phoneInfo;
+}
+
+/**
+	@brief  get music info
+	@return MusicInfo
+*/
+MusicInfo &ChronosESP32::getMusicInfo()
+{
+	return _musicInfo;
+}
+
+/*!
+	@brief  get the navigation fields changed since the last call and clear them
+	@return NavigationDirty bits
+*/
+uint32_t ChronosESP32::consumeNavigationDirty()
+{
+	return consumeDirty(_navigationDirty);
+}
+
+/*!
+	@brief  get the music fields changed since the last call and clear them
+	@return MusicDirty bits
+*/
+uint32_t ChronosESP32::consumeMusicDirty()
+{
+	return consumeDirty(_musicDirty);
+}
+
+/*!
+	@brief  get the phone info fields changed since the last call and clear them
+	@return PhoneDirty bits
+*/
+uint32_t ChronosESP32::consumePhoneDirty()
+{
+	return consumeDirty(_phoneDirty);
+}
+
+/*!
+	@brief  get the weather fields changed since the last call and clear them
+	@return WeatherDirty bits
+*/
+uint32_t ChronosESP32::consumeWeatherDirty()
+{
+	return consumeDirty(_weatherDirty);
+}
+
+/*!
+	@brief  enable or disable duplicate suppression for an opcode
+	@param  opcode
+			command byte (index 4) of the frame
+	@param  enabled
+			when true, a frame identical to the last one received for the same opcode is ignored
+*/
+void ChronosESP32::setDuplicateFilter(uint8_t opcode, bool enabled)
+{
+	if (enabled)
+		_frameFilter[opcode >> 5] |= (1UL << (opcode & 0x1F));
+	else
+		_frameFilter[opcode >> 5] &= ~(1UL << (opcode & 0x1F));
+}
+
+/*!
+	@brief  check whether duplicate suppression is enabled for an opcode
+	@param  opcode
+			command byte (index 4) of the frame
+*/
+bool ChronosESP32::isDuplicateFilterEnabled(uint8_t opcode)
+{
+	return (_frameFilter[opcode >> 5] >> (opcode & 0x1F)) & 1;
+}
+
+/*!
+	@brief  forget all cached frame hashes, the next frame of every opcode will be decoded
+*/
+void ChronosESP32::clearFrameCache()
+{
+	_frameCacheCount = 0;
+	_frameCacheNext = 0;
+}
+
+/*!
+	@brief  number of frames checked against the duplicate cache
+*/
+uint32_t ChronosESP32::getDuplicateChecks()
+{
+	return _frameChecks;
+}
+
+/*!
+	@brief  number of frames skipped because they were identical to the cached frame
+*/
+uint32_t ChronosESP32::getDuplicateHits()
+{
+	return _frameHits;
+}
+
+/*!
+	@brief  ratio of skipped frames to checked frames (0.0 - 1.0)
+*/
+float ChronosESP32::getDuplicateHitRate()
+{
+	return _frameChecks == 0 ? 0.0f : (float)_frameHits / (float)_frameChecks;
+}
+
+/*!
+	@brief  enable automatic connection parameter requests, fast during transfers and slow when idle
+	@param  enabled
+			state
+*/
+void ChronosESP32::setLinkManagement(bool enabled)
+{
+	_linkEnabled = enabled;
+	_linkIdleArmed = enabled && _bleCount > 0;
+	if (!enabled)
+	{
+		disarmTimer(TIMER_LINK);
+	}
+	else if (_bleCount > 0)
+	{
+		_linkLast = millis();
+		armTimer(TIMER_LINK, _linkIdleTimeout);
+	}
+}
+
+/*!
+	@brief  check whether automatic connection parameter requests are enabled
+*/
+bool ChronosESP32::isLinkManagementEnabled()
+{
+	return _linkEnabled;
+}
+
+/*!
+	@brief  set the connection parameters requested for a mode
+	@param  mode
+			LINK_FAST or LINK_SLOW
+	@param  params
+			intervals in 1.25 ms units, latency in connection events, timeout in 10 ms units
+*/
+void ChronosESP32::setLinkParams(LinkMode mode, LinkParams params)
+{
+	if (mode == LINK_DEFAULT)
+	{
+		return;
+	}
+	portENTER_CRITICAL(&_linkMux);
+	_linkParams[mode] = params;
+	portEXIT_CRITICAL(&_linkMux);
+}
+
+/*!
+	@brief  get the connection parameters requested for a mode
+	@param  mode
+			LINK_FAST or LINK_SLOW
+*/
+LinkParams ChronosESP32::getLinkParams(LinkMode mode)
+{
+	return _linkParams[mode];
+}
+
+/*!
+	@brief  set the inactivity period before the slow parameters are requested
+	@param  timeout
+			time in milliseconds
+*/
+void ChronosESP32::setLinkIdleTimeout(unsigned long timeout)
+{
+	_linkIdleTimeout = timeout;
+}
+
+/*!
+	@brief  request the connection parameters of a mode from the phone, ignored if already requested
+	@param  mode
+			LINK_FAST or LINK_SLOW
+*/
+void ChronosESP32::requestLinkMode(LinkMode mode)
+{
+	if (mode == LINK_DEFAULT || _bleCount == 0)
+	{
+		return;
+	}
+
+	unsigned long now = millis();
+	portENTER_CRITICAL(&_linkMux);
+	if (_linkRequest == mode && now - _linkRequestTime < CS_LINK_REQUEST_TIMEOUT)
+	{
+		portEXIT_CRITICAL(&_linkMux);
+		return;
+	}
+	_linkRequest = mode;
+	_linkRequestTime = now;
+	if (mode == LINK_FAST)
+	{
+		_linkStats.fastRequests++;
+	}
+	else
+	{
+		_linkStats.slowRequests++;
+	}
+	LinkParams params = _linkParams[mode];
+	portEXIT_CRITICAL(&_linkMux);
+
+	ChronosPeer list[CS_MAX_CONNECTIONS];
+	int count = peers(list);
+	for (int i = 0; i < count; i++)
+	{
+		if (list[i].handle < CS_TRANSPORT_HANDLE)
+		{
+			BLEDevice::getServer()->updateConnParams(list[i].handle, params.minInterval, params.maxInterval, params.latency, params.timeout);
+		}
+	}
+}
+
+/*!
+	@brief  get the connection parameter mode matching the interval granted by the phone
+*/
+LinkMode ChronosESP32::getLinkMode()
+{
+	return _linkMode;
+}
+
+/*!
+	@brief  get the time spent connected in each mode, including the current one
+*/
+LinkStats ChronosESP32::getLinkStats()
+{
+	portENTER_CRITICAL(&_linkMux);
+	accrueLinkTime(millis());
+	LinkStats stats = _linkStats;
+	portEXIT_CRITICAL(&_linkMux);
+	return stats;
+}
+
+/*!
+	@brief  clear the connection parameter statistics
+*/
+void ChronosESP32::resetLinkStats()
+{
+	portENTER_CRITICAL(&_linkMux);
+	uint16_t interval = _linkStats.interval;
+	uint16_t latency = _linkStats.latency;
+	memset(&_linkStats, 0, sizeof(_linkStats));
+	_linkStats.interval = interval;
+	_linkStats.latency = latency;
+	_linkSince = millis();
+	portEXIT_CRITICAL(&_linkMux);
+}
+
+/*!
+	@brief  add the time since the last mode change to the current mode, call with _linkMux held
+	@param  now
+			current millis()
+*/
+void ChronosESP32::accrueLinkTime(unsigned long now)
+{
+	if (_bleCount > 0)
+	{
+		uint32_t elapsed = now - _linkSince;
+		switch (_linkMode)
+		{
+		case LINK_FAST:
+			_linkStats.fastTime += elapsed;
+			break;
+		case LINK_SLOW:
+			_linkStats.slowTime += elapsed;
+			break;
+		default:
+			_linkStats.defaultTime += elapsed;
+			break;
+		}
+	}
+	_linkSince = now;
+}
+
+/*!
+	@brief  record the parameters granted by the phone and the mode their interval falls in
+	@param  interval
+			granted interval, 1.25 ms units
+	@param  latency
+			granted latency
+*/
+void ChronosESP32::grantLinkInterval(uint16_t interval, uint16_t latency)
+{
+	LinkMode mode = LINK_DEFAULT;
+	portENTER_CRITICAL(&_linkMux);
+	if (interval <= _linkParams[LINK_FAST].maxInterval)
+	{
+		mode = LINK_FAST;
+	}
+	else if (interval >= _linkParams[LINK_SLOW].minInterval)
+	{
+		mode = LINK_SLOW;
+	}
+	accrueLinkTime(millis());
+	_linkMode = mode;
+	_linkStats.interval = interval;
+	_linkStats.latency = latency;
+	portEXIT_CRITICAL(&_linkMux);
+}
+
+/*!
+	@brief  set the advertising profile, restarts the fast phase when advertising
+	@param  profile
+			advertising intervals, durations and TX power
+*/
+void ChronosESP32::setAdvertisingProfile(AdvProfile profile)
+{
+	portENTER_CRITICAL(&_advMux);
+	_advProfile = profile;
+	portEXIT_CRITICAL(&_advMux);
+
+	if (_inited && _bleCount < _maxConnections)
+	{
+		startAdvertisingPhase(ADV_FAST);
+	}
+}
+
+/*!
+	@brief  set one of the predefined advertising profiles
+	@param  preset
+			ADV_CONSTANT, ADV_BALANCED or ADV_LOW_POWER
+*/
+void ChronosESP32::setAdvertisingProfile(AdvPreset preset)
+{
+	setAdvertisingProfile(advertisingPreset(preset));
+}
+
+/*!
+	@brief  get the advertising profile
+*/
+AdvProfile ChronosESP32::getAdvertisingProfile()
+{
+	return _advProfile;
+}
+
+/*!
+	@brief  get the current advertising phase
+*/
+AdvPhase ChronosESP32::getAdvertisingPhase()
+{
+	return _advPhase;
+}
+
+/*!
+	@brief  get the time spent in each advertising phase, including the current one
+*/
+AdvStats ChronosESP32::getAdvertisingStats()
+{
+	portENTER_CRITICAL(&_advMux);
+	accrueAdvTime(millis());
+	AdvStats stats = _advStats;
+	portEXIT_CRITICAL(&_advMux);
+	return stats;
+}
+
+/*!
+	@brief  clear the advertising statistics
+*/
+void ChronosESP32::resetAdvertisingStats()
+{
+	portENTER_CRITICAL(&_advMux);
+	memset(&_advStats, 0, sizeof(_advStats));
+	_advSince = millis();
+	portEXIT_CRITICAL(&_advMux);
+}
+
+/*!
+	@brief  get the profile for a preset
+	@param  preset
+			ADV_CONSTANT, ADV_BALANCED or ADV_LOW_POWER
+*/
+AdvProfile ChronosESP32::advertisingPreset(AdvPreset preset)
+{
+	switch (preset)
+	{
+	case ADV_BALANCED:
+		return {48, 1636, 30000, CS_ADV_POWER_KEEP, CS_ADV_POWER_KEEP};
+	case ADV_LOW_POWER:
+		return {160, 3200, 10000, CS_ADV_POWER_KEEP, -12};
+	default:
+		return {0, 0, 0, CS_ADV_POWER_KEEP, CS_ADV_POWER_KEEP};
+	}
+}
+
+/*!
+	@brief  start an advertising phase with the intervals and power of the profile
+	@param  phase
+			ADV_FAST, ADV_SLOW or ADV_OFF when a connection stopped advertising
+*/
+void ChronosESP32::startAdvertisingPhase(AdvPhase phase)
+{
+	if (!_bleOwner)
+	{
+		return; // the advertising is shared, the instance that started the stack runs it
+	}
+	portENTER_CRITICAL(&_advMux);
+	accrueAdvTime(millis());
+	_advPhase = phase;
+	if (phase == ADV_FAST)
+	{
+		_advStats.fastStarts++;
+	}
+	else if (phase == ADV_SLOW)
+	{
+		_advStats.slowStarts++;
+	}
+	AdvProfile profile = _advProfile;
+	portEXIT_CRITICAL(&_advMux);
+
+	if (phase == ADV_OFF)
+	{
+		// the connection uses the original power
+		disarmTimer(TIMER_ADV);
+		setTxPower(CS_ADV_POWER_KEEP);
+		return;
+	}
+
+	uint16_t interval = phase == ADV_FAST ? profile.fastInterval : profile.slowInterval;
+	BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
+	if (pAdvertising->isAdvertising())
+	{
+		pAdvertising->stop(); // new intervals apply on the next start
+	}
+	pAdvertising->setMinInterval(interval);
+	pAdvertising->setMaxInterval(interval);
+	setTxPower(phase == ADV_FAST ? profile.fastPower : profile.slowPower);
+	pAdvertising->start();
+
+	if (phase == ADV_FAST && profile.fastDuration > 0)
+	{
+		armTimer(TIMER_ADV, profile.fastDuration);
+	}
+	else
+	{
+		disarmTimer(TIMER_ADV);
+	}
+}
+
+/*!
+	@brief  add the time since the last phase change to the current phase, call with _advMux held
+	@param  now
+			current millis()
+*/
+void ChronosESP32::accrueAdvTime(unsigned long now)
+{
+	if (_advPhase == ADV_FAST)
+	{
+		_advStats.fastTime += now - _advSince;
+	}
+	else if (_advPhase == ADV_SLOW)
+	{
+		_advStats.slowTime += now - _advSince;
+	}
+	_advSince = now;
+}
+
+/*!
+	@brief  set the TX power if it differs from the current one
+	@param  power
+			dBm, CS_ADV_POWER_KEEP restores the power from before begin()
+*/
+void ChronosESP32::setTxPower(int8_t power)
+{
+	int target = power == CS_ADV_POWER_KEEP ? _advBasePower : power;
+	if (target != _advPower)
+	{
+		BLEDevice::setPower(target);
+		_advPower = target;
+	}
+}
+
+/*!
+	@brief  record link traffic, requests the fast parameters on bulk transfers or bursts and restarts the idle timer
+	@param  bulk
+			the packet is part of a multi-packet transfer
+*/
+void ChronosESP32::linkActivity(bool bulk)
+{
+	if (!_linkEnabled || _bleCount == 0)
+	{
+		return;
+	}
+
+	unsigned long now = millis();
+	bool fast = false;
+	portENTER_CRITICAL(&_linkMux);
+	if (now - _linkBurstStart > CS_LINK_BURST_WINDOW)
+	{
+		_linkBurstStart = now;
+		_linkBurst = 0;
+	}
+	if (_linkBurst < 0xFF)
+	{
+		_linkBurst++;
+	}
+	bool pending = _linkRequest == LINK_FAST && now - _linkRequestTime < CS_LINK_REQUEST_TIMEOUT;
+	fast = !pending && (bulk || _linkBurst >= CS_LINK_BURST);
+	_linkLast = now;
+	// a running idle timer checks _linkLast when it expires, so it is not re-armed for every packet
+	bool arm = !_linkIdleArmed;
+	_linkIdleArmed = true;
+	portEXIT_CRITICAL(&_linkMux);
+
+	if (fast)
+	{
+		requestLinkMode(LINK_FAST);
+	}
+	if (arm)
+	{
+		armTimer(TIMER_LINK, _linkIdleTimeout);
+	}
+}
+
+/*!
+	@brief  set dirty bits, safe to call from the BLE task
+	@param  mask
+			dirty mask to update
+	@param  bits
+			bits to set
+*/
+void ChronosESP32::markDirty(uint32_t &mask, uint32_t bits)
+{
+	portENTER_CRITICAL(&_dirtyMux);
+	mask |= bits;
+	portEXIT_CRITICAL(&_dirtyMux);
+}
+
+/*!
+	@brief  read and clear a dirty mask
+	@param  mask
+			dirty mask to consume
+*/
+uint32_t ChronosESP32::consumeDirty(uint32_t &mask)
+{
+	portENTER_CRITICAL(&_dirtyMux);
+	uint32_t bits = mask;
+	mask = 0;
+	portEXIT_CRITICAL(&_dirtyMux);
+	return bits;
+}
+
+/*!
+	@brief  assign a string field and mark it dirty only when the content differs
+	@param  field
+			field to update
+	@param  value
+			new value
+	@param  mask
+			dirty mask of the owning struct
+	@param  bit
+			bit representing the field
+*/
+bool ChronosESP32::updateField(String &field, const String &value, uint32_t &mask, uint32_t bit)
+{
+	if (field == value)
+		return false;
+	field = value;
+	markDirty(mask, bit);
+	return true;
+}
+
+/*!
+	@brief  get the app name from the notification id
+	@param  id
+			identifier of the app icon
+*/
+String ChronosESP32::appName(int id)
+{
+	switch (id)
+	{
+	case 0x03:
+		return "Message";
+	case 0x04:
+		return "Mail";
+	case 0x07:
+		return "Tencent";
+	case 0x08:
+		return "Skype";
+	case 0x09:
+		return "Wechat";
+	case 0x0A:
+		return "WhatsApp";
+	case 0x0B:
+		return "Gmail";
+	case 0x0E:
+		return "Line";
+	case 0x0F:
+		return "Twitter";
+	case 0x10:
+		return "Facebook";
+	case 0x11:
+		return "Messenger";
+	case 0x12:
+		return "Instagram";
+	case 0x13:
+		return "Weibo";
+	case 0x14:
+		return "KakaoTalk";
+	case 0x16:
+		return "Viber";
+	case 0x17:
+		return "Vkontakte";
+	case 0x18:
+		return "Telegram";
+	case 0x1B:
+		return "DingTalk";
+	case 0x20:
+		return "WhatsApp Business";
+	case 0x22:
+		return "WearFit Pro";
+	case 0xC0:
+		return "Chronos";
+	default:
+		return "Message";
+	}
+}
+
+/*!
+	@brief  accept watchface uploads (B0/AF packets), off by default
+			experimental, the packet layout is not confirmed against what the app sends
+	@param  enabled
+			state, B0 and AF packets are ignored while disabled
+*/
+void ChronosESP32::setWatchfaceEnabled(bool enabled)
+{
+	_watchfaceEnabled = enabled;
+}
+
+/*!
+	@brief  check whether watchface uploads are accepted
+*/
+bool ChronosESP32::isWatchfaceEnabled()
+{
+	return _watchfaceEnabled;
+}
+
+/*!
+	@brief  check whether a watchface upload is in progress
+*/
+bool ChronosESP32::isWatchfaceReceiving()
+{
+	return _bulkTarget == BULK_WATCHFACE;
+}
+
+/*!
+	@brief  size of the last complete watchface, 0 if none was received
+*/
+uint32_t ChronosESP32::getWatchfaceSize()
+{
+	return _watchfaceSize;
+}
+
+/*!
+	@brief  crc32 of the last complete watchface
+*/
+uint32_t ChronosESP32::getWatchfaceCRC()
+{
+	return _watchfaceCRC;
+}
+
+/*!
+	@brief  partition that receives watchfaces, nullptr if the partition table has none
+*/
+const esp_partition_t *ChronosESP32::getWatchfacePartition()
+{
+	return esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CS_WATCHFACE_PARTITION);
+}
+
+/*!
+	@brief  handle watchface packets, B0 (size)(crc32) starts an upload, AF (sequence)(data) carries the image
+	@param  handle
+			connection the packet came from
+	@param  data
+			packet data
+	@param  length
+			packet length
+*/
+void ChronosESP32::watchfacePacket(uint16_t handle, const uint8_t *data, int length)
+{
+	if (data[0] == 0xB0)
+	{
+		// chunk info
+		if (length < 9)
+		{
+			return;
+		}
+		if (!isLinkSecure(handle))
+		{
+			// the partition is written by paired centrals only, ask the phone to pair and let it retry
+			NimBLEDevice::startSecurity(handle);
+			uint8_t frame[] = {0xB0, BULK_ERROR, 0, 0, 0, 0};
+			notify(frame, sizeof(frame), handle);
+			return;
+		}
+		_bulkConn = handle;
+		uint32_t size = (uint32_t(data[1]) << 24) | (uint32_t(data[2]) << 16) | (uint32_t(data[3]) << 8) | data[4];
+		uint32_t crc = (uint32_t(data[5]) << 24) | (uint32_t(data[6]) << 16) | (uint32_t(data[7]) << 8) | data[8];
+
+		if (_bulkTarget != BULK_NONE)
+		{
+			// a new upload while the previous one is still writing, the app has to retry
+			bulkAbort();
+			sendBulkStatus(0xB0, BULK_ERROR);
+			return;
+		}
+
+		_bulkPartition = getWatchfacePartition();
+		if (_bulkPartition == nullptr || size == 0 || size > _bulkPartition->size || !bulkBegin(BULK_WATCHFACE, size, crc))
+		{
+			sendBulkStatus(0xB0, BULK_ERROR);
+			if (configurationReceivedCallback != nullptr)
+			{
+				configurationReceivedCallback(CF_WATCHFACE, 3, 0);
+			}
+			return;
+		}
+		_watchfaceSize = 0; // the partition no longer holds the previous watchface
+
+		sendBulkStatus(0xB0, BULK_READY);
+		if (configurationReceivedCallback != nullptr)
+		{
+			configurationReceivedCallback(CF_WATCHFACE, 0, size);
+		}
+	}
+	else if (data[0] == 0xAF && _bulkTarget == BULK_WATCHFACE && !_bulkAborting)
+	{
+		// chunk data
+		if (length < 3)
+		{
+			return;
+		}
+		uint16_t seq = (data[1] << 8) | data[2];
+		if (seq != _bulkSeq)
+		{
+			// lost packet, the image would have a gap
+			bulkAbort();
+			return;
+		}
+		if (!bulkData(data + 3, length - 3))
+		{
+			// flash writer busy, the packet was dropped and has to be sent again
+			sendBulkStatus(0xB0, BULK_REWIND);
+			return;
+		}
+		_bulkSeq++;
+	}
+}
+
+/*!
+	@brief  accept firmware updates (D0/D1 packets), off by default
+			experimental, the Chronos app does not send firmware images, a sender has to implement the D0/D1 protocol
+	@param  enabled
+			state, D0 and D1 packets are ignored while disabled
+*/
+void ChronosESP32::setOtaEnabled(bool enabled)
+{
+	_otaEnabled = enabled;
+}
+
+/*!
+	@brief  check whether firmware updates are accepted
+*/
+bool ChronosESP32::isOtaEnabled()
+{
+	return _otaEnabled;
+}
+
+/*!
+	@brief  check whether a firmware update is in progress, including one waiting to be resumed
+*/
+bool ChronosESP32::isOtaRunning()
+{
+	return _bulkTarget == BULK_OTA;
+}
+
+/*!
+	@brief  get the transfer statistics of the current or last firmware update
+*/
+OtaStats ChronosESP32::getOtaStats()
+{
+	OtaStats stats = _otaStats;
+	if (_bulkTarget == BULK_OTA)
+	{
+		stats.received = _bulkReceived;
+		stats.elapsed = millis() - _otaStart;
+	}
+	stats.throughput = stats.elapsed == 0 ? 0.0f : (stats.received * 1000.0f) / stats.elapsed;
+	return stats;
+}
+
+/*!
+	@brief  keep alarms, contacts, weather, settings and qr links in NVS across reboots
+	@param  enabled
+			load the saved state in begin() and save changes after a delay
+	@param  delay
+			time after the last change before the changed sections are written (ms)
+*/
+void ChronosESP32::setStateStorage(bool enabled, unsigned long delay)
+{
+	_stateEnabled = enabled;
+	_stateDelay = delay;
+	if (enabled && _stateDirty != 0)
+	{
+		armTimer(TIMER_STATE, _stateDelay);
+	}
+	else if (!enabled)
+	{
+		disarmTimer(TIMER_STATE);
+	}
+}
+
+/*!
+	@brief  set the NVS namespace of the saved state and health watermarks, each instance that saves state needs its own
+	@param  name
+			Preferences namespace, at most 15 characters
+*/
+void ChronosESP32::setStorageNamespace(String name)
+{
+	_stateNamespace = name;
+}
+
+/*!
+	@brief  write the retained state to NVS, each section is a versioned blob with a crc32
+			sections that match what is already stored are not rewritten
+	@param  all
+			write every section instead of only the changed ones
+	@return false if a section could not be written, it stays marked as changed
+*/
+bool ChronosESP32::saveState(bool all)
+{
+	disarmTimer(TIMER_STATE);
+	portENTER_CRITICAL(&_dirtyMux);
+	uint32_t sections = all ? (uint32_t)STATE_ALL : _stateDirty;
+	_stateDirty = 0;
+	portEXIT_CRITICAL(&_dirtyMux);
+
+	if (sections == 0)
+	{
+		return true;
+	}
+
+	// serialize every section first, the BLE task changes the same fields while it decodes packets
+	uint8_t *blobs[5] = {nullptr, nullptr, nullptr, nullptr, nullptr};
+	size_t lengths[5] = {0, 0, 0, 0, 0};
+	uint32_t compared[5] = {0, 0, 0, 0, 0};
+	uint32_t failed = 0;
+	bool lock = _rxLock != nullptr && xSemaphoreGetMutexHolder(_rxLock) != xTaskGetCurrentTaskHandle();
+	if (lock)
+	{
+		xSemaphoreTake(_rxLock, portMAX_DELAY);
+	}
+	for (int i = 0; i < 5; i++)
+	{
+		uint32_t section = 1UL << i;
+		if (!(sections & section))
+			continue;
+
+		// measure first, the blob is the header followed by the payload
+		StateBuffer buffer = {nullptr, 0, 0, false, 0, false};
+		stateSection(section, buffer);
+		size_t length = sizeof(StateHeader) + buffer.pos;
+		uint8_t *data = (uint8_t *)malloc(length);
+		if (data == nullptr)
+		{
+			failed |= section;
+			continue;
+		}
+		buffer = {data + sizeof(StateHeader), length - sizeof(StateHeader), 0, false, 0, false};
+		if (!stateSection(section, buffer))
+		{
+			free(data);
+			failed |= section;
+			continue;
+		}
+
+		StateHeader header = stateHeader(section, buffer.data, buffer.pos);
+		memcpy(data, &header, sizeof(header));
+		blobs[i] = data;
+		lengths[i] = length;
+		compared[i] = crc32(buffer.data, buffer.compared ? buffer.compared : buffer.pos);
+	}
+	if (lock)
+	{
+		xSemaphoreGive(_rxLock);
+	}
+
+	Preferences prefs;
+	bool open = prefs.begin(_stateNamespace.c_str(), false);
+	for (int i = 0; i < 5; i++)
+	{
+		if (blobs[i] == nullptr)
+			continue;
+
+		uint32_t section = 1UL << i;
+		const char *key = stateKey(section);
+		if (!open)
+		{
+			failed |= section;
+		}
+		else if (all || compared[i] != _stateCRC[i] || !prefs.isKey(key))
+		{
+			if (prefs.putBytes(key, blobs[i], lengths[i]) == lengths[i])
+			{
+				_stateCRC[i] = compared[i];
+				_stateWrites++;
+			}
+			else
+			{
+				failed |= section;
+			}
+		}
+		free(blobs[i]);
+	}
+	if (open)
+	{
+		prefs.end();
+	}
+
+	if (failed != 0)
+	{
+		markState(failed);
+	}
+	return failed == 0;
+}
+
+/*!
+	@brief  restore the retained state from NVS, sections with another version or a bad crc are skipped
+	@param  sections
+			StateSection bits to restore
+	@return StateSection bits that were restored
+*/
+uint32_t ChronosESP32::loadState(uint32_t sections)
+{
+	Preferences prefs;
+	if (!prefs.begin(_stateNamespace.c_str(), true))
+	{
+		return 0; // nothing saved yet
+	}
+
+	uint32_t loaded = 0;
+	bool lock = _rxLock != nullptr && xSemaphoreGetMutexHolder(_rxLock) != xTaskGetCurrentTaskHandle();
+	for (int i = 0; i < 5; i++)
+	{
+		uint32_t section = 1UL << i;
+		const char *key = stateKey(section);
+		if (!(sections & section) || !prefs.isKey(key))
+			continue;
+
+		size_t length = prefs.getBytesLength(key);
+		if (length < sizeof(StateHeader))
+			continue;
+		uint8_t *data = (uint8_t *)malloc(length);
+		if (data == nullptr)
+			continue;
+
+		if (prefs.getBytes(key, data, length) == length)
+		{
+			// version, length, crc and array sizes must all match this build
+			StateHeader header = stateHeader(section, data + sizeof(StateHeader), length - sizeof(StateHeader));
+			StateBuffer buffer = {data + sizeof(StateHeader), length - sizeof(StateHeader), 0, true, 0, true};
+			if (memcmp(data, &header, sizeof(header)) == 0 && stateSection(section, buffer) && buffer.pos == buffer.size)
+			{
+				// the layout is valid, only now restore the fields
+				buffer.pos = 0;
+				buffer.skip = false;
+				if (lock)
+				{
+					xSemaphoreTake(_rxLock, portMAX_DELAY);
+				}
+				stateSection(section, buffer);
+				if (lock)
+				{
+					xSemaphoreGive(_rxLock);
+				}
+				_stateCRC[i] = crc32(buffer.data, buffer.compared ? buffer.compared : buffer.pos);
+				loaded |= section;
+			}
+		}
+		free(data);
+	}
+	prefs.end();
+
+	if (loaded & STATE_ALARMS)
+	{
+		scheduleAlarms();
+	}
+	if (loaded & STATE_SETTINGS)
+	{
+		scheduleReminders();
+	}
+	if (loaded & STATE_WEATHER)
+	{
+		markDirty(_weatherDirty, 0x1FF); // every WeatherDirty field
+	}
+	return loaded;
+}
+
+/*!
+	@brief  erase the saved state, the state in memory is kept
+*/
+void ChronosESP32::clearState()
+{
+	Preferences prefs;
+	if (prefs.begin(_stateNamespace.c_str(), false))
+	{
+		prefs.clear();
+		prefs.end();
+	}
+	memset(_stateCRC, 0, sizeof(_stateCRC));
+}
+
+/*!
+	@brief  get the sections changed since the last save
+	@return StateSection bits
+*/
+uint32_t ChronosESP32::getStateDirty()
+{
+	return _stateDirty;
+}
+
+/*!
+	@brief  get the number of sections written to flash since boot
+*/
+uint32_t ChronosESP32::getStateWrites()
+{
+	return _stateWrites;
+}
+
+/*!
+	@brief  mark state sections as changed and restart the save delay
+	@param  sections
+			StateSection bits
+*/
+void ChronosESP32::markState(uint32_t sections)
+{
+	portENTER_CRITICAL(&_dirtyMux);
+	_stateDirty |= sections;
+	portEXIT_CRITICAL(&_dirtyMux);
+
+	if (_stateEnabled)
+	{
+		// restarted by each change, a sync burst is saved once
+		armTimer(TIMER_STATE, _stateDelay);
+	}
+}
+
+/*!
+	@brief  NVS key of a state section
+	@param  section
+			StateSection bit
+*/
+const char *ChronosESP32::stateKey(uint32_t section)
+{
+	switch (section)
+	{
+	case STATE_SETTINGS:
+		return "settings";
+	case STATE_ALARMS:
+		return "alarms";
+	case STATE_CONTACTS:
+		return "contacts";
+	case STATE_WEATHER:
+		return "weather";
+	default:
+		return "qr";
+	}
+}
+
+/*!
+	@brief  build the header of a state section blob
+	@param  section
+			StateSection bit
+	@param  payload
+			serialized section
+	@param  length
+			payload bytes
+*/
+ChronosESP32::StateHeader ChronosESP32::stateHeader(uint32_t section, const uint8_t *payload, size_t length)
+{
+	StateHeader header;
+	memset(&header, 0, sizeof(header)); // padding is compared on load
+	header.version = CS_STATE_VERSION;
+	header.section = section;
+	header.length = length;
+	header.crc = crc32(payload, length);
+	header.sizes[0] = CS_ALARM_SIZE;
+	header.sizes[1] = CS_CONTACTS_SIZE;
+	header.sizes[2] = CS_WEATHER_SIZE;
+	header.sizes[3] = CS_FORECAST_SIZE;
+	header.sizes[4] = CS_QR_SIZE;
+	return header;
+}
+
+/*!
+	@brief  store or restore the fields of a state section, the same field list is used in both directions
+	@param  section
+			StateSection bit
+	@param  buffer
+			serialized section, measures the size when the data is nullptr
+	@return false if the buffer was too small
+*/
+bool ChronosESP32::stateSection(uint32_t section, StateBuffer &buffer)
+{
+	bool ok = true;
+	switch (section)
+	{
+	case STATE_SETTINGS:
+		ok &= buffer.field(&_hour24, sizeof(_hour24));
+		ok &= buffer.field(&_quietEnabled, sizeof(_quietEnabled));
+		ok &= buffer.field(&_quietStart, sizeof(_quietStart));
+		ok &= buffer.field(&_quietEnd, sizeof(_quietEnd));
+		ok &= buffer.field(&_sleepEnabled, sizeof(_sleepEnabled));
+		ok &= buffer.field(&_sleepStart, sizeof(_sleepStart));
+		ok &= buffer.field(&_sleepEnd, sizeof(_sleepEnd));
+		ok &= buffer.field(_reminders, sizeof(_reminders));
+		break;
+	case STATE_ALARMS:
+		ok &= buffer.field(_alarms, sizeof(_alarms));
+		break;
+	case STATE_CONTACTS:
+		ok &= buffer.field(&_sosContact, sizeof(_sosContact));
+		ok &= buffer.field(&_contactSize, sizeof(_contactSize));
+		for (int i = 0; ok && i < CS_CONTACTS_SIZE; i++)
+		{
+			ok &= buffer.text(_contacts[i].name);
+			ok &= buffer.text(_contacts[i].number);
+		}
+		if (buffer.reading && !buffer.skip)
+		{
+			_contactSize = constrain(_contactSize, 0, CS_CONTACTS_SIZE);
+		}
+		break;
+	case STATE_WEATHER:
+		ok &= buffer.field(&_weatherSize, sizeof(_weatherSize));
+		ok &= buffer.field(&_weatherStart, sizeof(_weatherStart));
+		ok &= buffer.field(_weatherTemp, sizeof(_weatherTemp));
+		ok &= buffer.field(_weatherHigh, sizeof(_weatherHigh));
+		ok &= buffer.field(_weatherLow, sizeof(_weatherLow));
+		ok &= buffer.field(_weatherPressure, sizeof(_weatherPressure));
+		ok &= buffer.field(_weatherIcon, sizeof(_weatherIcon));
+		ok &= buffer.field(_weatherDay, sizeof(_weatherDay));
+		ok &= buffer.field(_weatherUv, sizeof(_weatherUv));
+		ok &= buffer.text(_weatherCity);
+		ok &= buffer.text(_weatherLocation.city);
+		ok &= buffer.text(_weatherLocation.region);
+		ok &= buffer.text(_weatherLocation.country);
+		ok &= buffer.field(&_weatherLocation.latitude, sizeof(_weatherLocation.latitude));
+		ok &= buffer.field(&_weatherLocation.longitude, sizeof(_weatherLocation.longitude));
+		ok &= buffer.field(_forecastTemp, sizeof(_forecastTemp));
+		ok &= buffer.field(_forecastWind, sizeof(_forecastWind));
+		ok &= buffer.field(_forecastDay, sizeof(_forecastDay));
+		ok &= buffer.field(_forecastHour, sizeof(_forecastHour));
+		ok &= buffer.field(_forecastIcon, sizeof(_forecastIcon));
+		ok &= buffer.field(_forecastUv, sizeof(_forecastUv));
+		ok &= buffer.field(_forecastHumidity, sizeof(_forecastHumidity));
+		ok &= buffer.field(_forecastTime, sizeof(_forecastTime));
+		// receive times change on every sync, they are saved along but do not make the section changed
+		buffer.compared = buffer.pos;
+		ok &= buffer.field(&_weatherReceived, sizeof(_weatherReceived));
+		ok &= buffer.field(&_forecastReceived, sizeof(_forecastReceived));
+		ok &= buffer.text(_weatherTime);
+		if (buffer.reading && !buffer.skip)
+		{
+			_weatherSize = constrain(_weatherSize, 0, CS_WEATHER_SIZE);
+		}
+		break;
+	case STATE_QR:
+		for (int i = 0; ok && i < CS_QR_SIZE; i++)
+		{
+			ok &= buffer.text(_qrLinks[i]);
+		}
+		break;
+	}
+	return ok;
+}
+
+/*!
+	@brief  store or restore one field
+	@param  value
+			field address
+	@param  length
+			field size
+	@return false if the field does not fit, the position still advances while storing so the size can be measured
+*/
+bool ChronosESP32::StateBuffer::field(void *value, size_t length)
+{
+	if (reading)
+	{
+		if (pos + length > size)
+			return false;
+		if (!skip)
+		{
+			memcpy(value, data + pos, length);
+		}
+	}
+	else if (data != nullptr)
+	{
+		if (pos + length > size)
+		{
+			pos += length;
+			return false;
+		}
+		memcpy(data + pos, value, length);
+	}
+	pos += length;
+	return true;
+}
+
+/*!
+	@brief  store or restore a length prefixed string
+	@param  value
+			string field
+*/
+bool ChronosESP32::StateBuffer::text(String &value)
+{
+	uint16_t length = value.length();
+	if (reading)
+	{
+		// the length is read even when skipping, it locates the next field
+		if (pos + sizeof(length) > size)
+			return false;
+		memcpy(&length, data + pos, sizeof(length));
+		pos += sizeof(length);
+		if (pos + length > size)
+			return false;
+		if (!skip)
+		{
+			value = "";
+			value.concat((const char *)data + pos, length);
+		}
+		pos += length;
+		return true;
+	}
+	if (!field(&length, sizeof(length)))
+		return false;
+	return field((void *)value.c_str(), length);
+}
+
+/*!
+	@brief  keep the hot state (time offset, settings, alarms, latest notification headers) in RTC memory across deep sleep
+	@param  enabled
+			restore the state in begin() when waking from deep sleep, call before begin()
+	@return false if another instance already keeps its state in RTC memory
+*/
+bool ChronosESP32::setSleepRetention(bool enabled)
+{
+	if (!enabled)
+	{
+		releaseShared(_rtcOwner);
+		_rtcEnabled = false;
+		return true;
+	}
+	// there is one RTC copy, a second instance would overwrite it
+	_rtcEnabled = claimShared(_rtcOwner);
+	return _rtcEnabled;
+}
+
+/*!
+	@brief  copy the hot state to RTC memory and save changed NVS sections, call right before esp_deep_sleep_start()
+*/
+void ChronosESP32::prepareSleep()
+{
+	if (_stateEnabled && _stateDirty != 0)
+	{
+		saveState();
+	}
+	if (!_rtcEnabled)
+	{
+		// the RTC copy belongs to the instance that enabled retention
+		return;
+	}
+
+	RtcState &rtc = _rtcState;
+	memset(&rtc, 0, sizeof(rtc));
+	rtc.magic = CS_RTC_MAGIC;
+	rtc.length = sizeof(RtcState);
+	rtc.sleeps = _wakeStats.sleeps + 1;
+	rtc.offset = this->offset;
+	rtc.hour24 = _hour24;
+	rtc.chunked = _chunked;
+	rtc.notifyPhone = _notifyPhone;
+	rtc.quietEnabled = _quietEnabled;
+	rtc.sleepEnabled = _sleepEnabled;
+	rtc.quietStart = _quietStart;
+	rtc.quietEnd = _quietEnd;
+	rtc.sleepStart = _sleepStart;
+	rtc.sleepEnd = _sleepEnd;
+	memcpy(rtc.reminders, _reminders, sizeof(rtc.reminders));
+	memcpy(rtc.alarms, _alarms, sizeof(rtc.alarms));
+	memcpy(rtc.alarmDue, _alarmDue, sizeof(rtc.alarmDue));
+
+	rtc.notificationCount = min(getNotificationCount(), CS_RTC_NOTIF_SIZE);
+	for (int i = 0; i < rtc.notificationCount; i++)
+	{
+		Notification &notification = getNotificationAt(i);
+		rtc.notifications[i].icon = notification.icon;
+		copyText(rtc.notifications[i].time, sizeof(rtc.notifications[i].time), notification.time);
+		copyText(rtc.notifications[i].title, sizeof(rtc.notifications[i].title), notification.title);
+	}
+
+	rtc.crc = crc32((const uint8_t *)&rtc, offsetof(RtcState, crc));
+}
+
+/*!
+	@brief  copy a string into a fixed buffer, a multi-byte UTF-8 character that does not fit is left out whole
+	@param  out
+			destination, always terminated
+	@param  size
+			destination size in bytes
+	@param  text
+			source string
+*/
+void ChronosESP32::copyText(char *out, size_t size, const String &text)
+{
+	size_t length = min((size_t)text.length(), size - 1);
+	if (length < text.length())
+	{
+		// the first byte left out is a continuation byte, step back to the start of its character
+		while (length > 0 && ((uint8_t)text[length] & 0xC0) == 0x80)
+		{
+			length--;
+		}
+	}
+	memcpy(out, text.c_str(), length);
+	out[length] = '\0';
+}
+
+/*!
+	@brief  check whether begin() restored the state from RTC memory
+*/
+bool ChronosESP32::isWarmStart()
+{
+	return _wakeStats.warm;
+}
+
+/*!
+	@brief  get the wake to ready timings of this boot
+*/
+WakeStats ChronosESP32::getWakeStats()
+{
+	return _wakeStats;
+}
+
+/*!
+	@brief  restore the hot state saved by prepareSleep(), only after a deep sleep reset
+	@return whether the state was restored
+*/
+bool ChronosESP32::restoreSleepState()
+{
+	RtcState &rtc = _rtcState;
+	bool valid = esp_reset_reason() == ESP_RST_DEEPSLEEP && rtc.magic == CS_RTC_MAGIC && rtc.length == sizeof(RtcState) &&
+				 rtc.crc == crc32((const uint8_t *)&rtc, offsetof(RtcState, crc));
+	rtc.magic = 0; // used once, a wake without prepareSleep() is a cold start
+
+	if (!valid)
+	{
+		return false;
+	}
+
+	this->offset = rtc.offset;
+	_hour24 = rtc.hour24;
+	_chunked = rtc.chunked;
+	_notifyPhone = rtc.notifyPhone;
+	_quietEnabled = rtc.quietEnabled;
+	_sleepEnabled = rtc.sleepEnabled;
+	_quietStart = rtc.quietStart;
+	_quietEnd = rtc.quietEnd;
+	_sleepStart = rtc.sleepStart;
+	_sleepEnd = rtc.sleepEnd;
+	memcpy(_reminders, rtc.reminders, sizeof(_reminders));
+	memcpy(_alarms, rtc.alarms, sizeof(_alarms));
+	memcpy(_alarmDue, rtc.alarmDue, sizeof(_alarmDue));
+
+	// headers only, the message body is not kept
+	int count = min(min((int)rtc.notificationCount, CS_RTC_NOTIF_SIZE), CS_NOTIF_SIZE);
+	for (int i = 0; i < count; i++)
+	{
+		Notification &notification = _notifications[count - 1 - i];
+		notification.icon = rtc.notifications[i].icon;
+		notification.app = appName(notification.icon);
+		notification.time = rtc.notifications[i].time;
+		notification.title = rtc.notifications[i].title;
+		notification.message = "";
+	}
+	if (count > 0)
+	{
+		_notificationIndex = count - 1;
+	}
+
+	_wakeStats.warm = true;
+	_wakeStats.sleeps = rtc.sleeps;
+	scheduleAlarms();
+	scheduleReminders();
+	return true;
+}
+
+/*!
+	@brief  handle firmware update packets
+			D0 01 (size)(crc32) starts or resumes an update, D0 02 cancels it
+			D1 (offset)(data) carries the image
+	@param  handle
+			connection the packet came from
+	@param  data
+			packet data
+	@param  length
+			packet length
+*/
+void ChronosESP32::otaPacket(uint16_t handle, const uint8_t *data, int length)
+{
+	if (data[0] == 0xD0 && length >= 2)
+	{
+		if (!isLinkSecure(handle))
+		{
+			// only paired centrals may control an update, ask the phone to pair and let it retry
+			NimBLEDevice::startSecurity(handle);
+			uint8_t frame[] = {0xD0, BULK_ERROR, 0, 0, 0, 0};
+			notify(frame, sizeof(frame), handle);
+			return;
+		}
+		_bulkConn = handle;
+
+		if (data[1] == 0x01 && length >= 10)
+		{
+			uint32_t size = (uint32_t(data[2]) << 24) | (uint32_t(data[3]) << 16) | (uint32_t(data[4]) << 8) | data[5];
+			uint32_t crc = (uint32_t(data[6]) << 24) | (uint32_t(data[7]) << 16) | (uint32_t(data[8]) << 8) | data[9];
+
+			if (_bulkTarget == BULK_OTA && !_bulkAborting && size == _bulkSize && crc == _bulkExpectedCRC)
+			{
+				// same image after a reconnect, continue from the received count
+				disarmTimer(TIMER_OTA);
+				_otaStats.resumes++;
+				sendBulkStatus(0xD0, BULK_READY);
+				if (configurationReceivedCallback != nullptr)
+				{
+					configurationReceivedCallback(CF_OTA, 4, _bulkReceived);
+				}
+				return;
+			}
+			if (_bulkTarget != BULK_NONE)
+			{
+				bulkAbort();
+				sendBulkStatus(0xD0, BULK_ERROR);
+				return;
+			}
+
+			_bulkPartition = esp_ota_get_next_update_partition(nullptr);
+			bool ok = _bulkPartition != nullptr && size > 0 && size <= _bulkPartition->size;
+			// sequential writes erase sector by sector instead of the whole partition up front
+			ok = ok && esp_ota_begin(_bulkPartition, OTA_WITH_SEQUENTIAL_WRITES, &_otaHandle) == ESP_OK;
+			if (ok && !bulkBegin(BULK_OTA, size, crc))
+			{
+				esp_ota_abort(_otaHandle);
+				ok = false;
+			}
+			if (!ok)
+			{
+				_bulkReceived = 0;
+				sendBulkStatus(0xD0, BULK_ERROR);
+				if (configurationReceivedCallback != nullptr)
+				{
+					configurationReceivedCallback(CF_OTA, 3, 0);
+				}
+				return;
+			}
+
+			memset(&_otaStats, 0, sizeof(_otaStats));
+			_otaStats.size = size;
+			_otaStart = millis();
+			sendBulkStatus(0xD0, BULK_READY);
+			if (configurationReceivedCallback != nullptr)
+			{
+				configurationReceivedCallback(CF_OTA, 0, size);
+			}
+		}
+		else if (data[1] == 0x02)
+		{
+			bulkAbort();
+		}
+	}
+	else if (data[0] == 0xD1 && _bulkTarget == BULK_OTA && !_bulkAborting && length >= 5)
+	{
+		uint32_t offset = (uint32_t(data[1]) << 24) | (uint32_t(data[2]) << 16) | (uint32_t(data[3]) << 8) | data[4];
+		if (offset != _bulkReceived)
+		{
+			// lost or repeated packet, the app resends from the received count
+			if (offset > _bulkReceived)
+			{
+				_otaStats.rewinds++;
+				sendBulkStatus(0xD0, BULK_REWIND);
+			}
+			return;
+		}
+		if (!bulkData(data + 5, length - 5))
+		{
+			// flash writer busy, the packet was dropped
+			_otaStats.rewinds++;
+			sendBulkStatus(0xD0, BULK_REWIND);
+		}
+	}
+}
+
+/*!
+	@brief  status header of the current bulk transfer
+*/
+uint8_t ChronosESP32::bulkHeader()
+{
+	return _bulkTarget == BULK_OTA ? 0xD0 : 0xB0;
+}
+
+/*!
+	@brief  configuration event of the current bulk transfer
+*/
+Config ChronosESP32::bulkConfig()
+{
+	return _bulkTarget == BULK_OTA ? CF_OTA : CF_WATCHFACE;
+}
+
+/*!
+	@brief  start a bulk transfer, allocates the two transfer buffers and starts the flash writer
+	@param  target
+			destination of the data
+	@param  size
+			image size
+	@param  crc
+			expected crc32 of the image
+	@return false if there is not enough memory
+*/
+bool ChronosESP32::bulkBegin(BulkTarget target, uint32_t size, uint32_t crc)
+{
+	if (_bulkQueue == nullptr)
+	{
+		_bulkQueue = xQueueCreate(3, sizeof(BulkChunk)); // both buffers and an abort marker
+		_bulkFree = xSemaphoreCreateCounting(2, 2);
+		xTaskCreate(bulkWriter, "chronos_bulk", 4096, this, 1, &_bulkTask);
+	}
+
+	_bulkBuffers[0] = (uint8_t *)malloc(CS_BULK_BUFFER);
+	_bulkBuffers[1] = (uint8_t *)malloc(CS_BULK_BUFFER);
+	if (_bulkBuffers[0] == nullptr || _bulkBuffers[1] == nullptr || _bulkTask == nullptr)
+	{
+		free(_bulkBuffers[0]);
+		free(_bulkBuffers[1]);
+		_bulkBuffers[0] = nullptr;
+		_bulkBuffers[1] = nullptr;
+		return false;
+	}
+	xSemaphoreTake(_bulkFree, 0); // the first fill buffer
+
+	_bulkHeld = true;
+	_bulkFill = 0;
+	_bulkUsed = 0;
+	_bulkSeq = 0;
+	_bulkSize = size;
+	_bulkReceived = 0;
+	_bulkCRC = 0;
+	_bulkExpectedCRC = crc;
+	_bulkError = false;
+	_bulkAborting = false;
+	_bulkTarget = target;
+	return true;
+}
+
+/*!
+	@brief  append received image data, full buffers are handed to the flash writer
+			runs on the BLE host task and never waits for the writer, a packet that does not fit is dropped
+	@param  data
+			image bytes
+	@param  length
+			number of bytes
+	@return false if the packet was dropped because the flash writer still holds the buffer it needs
+*/
+bool ChronosESP32::bulkData(const uint8_t *data, size_t length)
+{
+	if (!_bulkHeld)
+	{
+		_bulkHeld = xSemaphoreTake(_bulkFree, 0) == pdTRUE;
+	}
+	// a packet that crosses into the other buffer needs it free as well, only this task takes buffers
+	if (!_bulkHeld || (_bulkUsed + length > CS_BULK_BUFFER && uxSemaphoreGetCount(_bulkFree) == 0))
+	{
+		return false;
+	}
+
+	while (length > 0 && !_bulkAborting)
+	{
+		size_t n = min(length, (size_t)(CS_BULK_BUFFER - _bulkUsed));
+		n = min(n, (size_t)(_bulkSize - _bulkReceived));
+		if (n == 0)
+		{
+			return true; // more data than announced
+		}
+
+		memcpy(_bulkBuffers[_bulkFill] + _bulkUsed, data, n);
+		_bulkCRC = crc32(data, n, _bulkCRC);
+		_bulkUsed += n;
+		_bulkReceived += n;
+		data += n;
+		length -= n;
+
+		if (_bulkReceived == _bulkSize)
+		{
+			bulkSubmit(true);
+		}
+		else if (_bulkUsed == CS_BULK_BUFFER)
+		{
+			bulkSubmit(false);
+		}
+	}
+	return true;
+}
+
+/*!
+	@brief  hand the fill buffer to the flash writer and continue in the other buffer
+	@param  last
+			the transfer is complete
+*/
+void ChronosESP32::bulkSubmit(bool last)
+{
+	// the queue holds both buffers and the abort marker, so this never has to wait
+	BulkChunk chunk = {_bulkFill, _bulkUsed, _bulkReceived - _bulkUsed, last};
+	xQueueSend(_bulkQueue, &chunk, 0);
+	if (last)
+	{
+		_bulkAborting = true; // ignore anything until bulkFinish()
+		return;
+	}
+
+	// if the writer still has the other buffer, bulkData() takes it once it is free
+	_bulkFill ^= 1;
+	_bulkUsed = 0;
+	_bulkHeld = xSemaphoreTake(_bulkFree, 0) == pdTRUE;
+
+	// acknowledges the window, the app may send up to two buffers ahead
+	sendBulkStatus(bulkHeader(), BULK_PROGRESS);
+	if (configurationReceivedCallback != nullptr)
+	{
+		configurationReceivedCallback(bulkConfig(), 1, _bulkReceived);
+	}
+}
+
+/*!
+	@brief  stop the transfer, reported as failed once the flash writer is idle
+*/
+void ChronosESP32::bulkAbort()
+{
+	if (_bulkTarget == BULK_NONE || _bulkAborting)
+	{
+		return;
+	}
+	_bulkError = true;
+	_bulkAborting = true;
+	BulkChunk marker = {_bulkFill, 0, 0, true};
+	xQueueSend(_bulkQueue, &marker, 0);
+}
+
+/*!
+	@brief  finish the transfer after the flash writer has written the last chunk, called from loop()
+*/
+void ChronosESP32::bulkFinish()
+{
+	bool ok = !_bulkError && _bulkReceived == _bulkSize && _bulkCRC == _bulkExpectedCRC;
+	uint8_t header = bulkHeader();
+	Config config = bulkConfig();
+
+	if (_bulkTarget == BULK_WATCHFACE && ok)
+	{
+		_watchfaceSize = _bulkSize;
+		_watchfaceCRC = _bulkCRC;
+	}
+	else if (_bulkTarget == BULK_OTA)
+	{
+		if (ok)
+		{
+			// esp_ota_end validates the image before it is made bootable
+			ok = esp_ota_end(_otaHandle) == ESP_OK && esp_ota_set_boot_partition(_bulkPartition) == ESP_OK;
+		}
+		else
+		{
+			esp_ota_abort(_otaHandle);
+		}
+		_otaStats.received = _bulkReceived;
+		_otaStats.elapsed = millis() - _otaStart;
+		disarmTimer(TIMER_OTA);
+	}
+
+	free(_bulkBuffers[0]);
+	free(_bulkBuffers[1]);
+	_bulkBuffers[0] = nullptr;
+	_bulkBuffers[1] = nullptr;
+	_bulkTarget = BULK_NONE;
+	_bulkAborting = false;
+
+	sendBulkStatus(header, ok ? BULK_DONE : BULK_ERROR);
+	if (configurationReceivedCallback != nullptr)
+	{
+		configurationReceivedCallback(config, ok ? 2 : 3, _bulkReceived);
+	}
+}
+
+/*!
+	@brief  write one chunk to its destination, runs on the flash writer task
+	@param  chunk
+			buffer and image position
+	@return false on a flash error
+*/
+bool ChronosESP32::bulkWrite(const BulkChunk &chunk)
+{
+	const uint8_t *data = _bulkBuffers[chunk.buffer];
+	if (_bulkTarget == BULK_WATCHFACE)
+	{
+		// chunks start on a sector boundary
+		size_t erase = (chunk.length + CS_BULK_BUFFER - 1) / CS_BULK_BUFFER * CS_BULK_BUFFER;
+		return esp_partition_erase_range(_bulkPartition, chunk.offset, erase) == ESP_OK &&
+			   esp_partition_write(_bulkPartition, chunk.offset, data, chunk.length) == ESP_OK;
+	}
+	else if (_bulkTarget == BULK_OTA)
+	{
+		unsigned long start = millis();
+		bool ok = esp_ota_write(_otaHandle, data, chunk.length) == ESP_OK;
+		_otaStats.writeTime += millis() - start;
+		return ok;
+	}
+	return false;
+}
+
+/*!
+	@brief  flash writer task, erases and writes full buffers while the BLE task fills the other one
+	@param  param
+			ChronosESP32 instance
+*/
+void ChronosESP32::bulkWriter(void *param)
+{
+	ChronosESP32 *watch = (ChronosESP32 *)param;
+	BulkChunk chunk;
+	for (;;)
+	{
+		if (xQueueReceive(watch->_bulkQueue, &chunk, portMAX_DELAY) != pdTRUE)
+		{
+			continue;
+		}
+		if (chunk.quit)
+		{
+			// the instance is going away, nothing of it is touched after the notify
+			xTaskNotifyGive(watch->_bulkCloser);
+			vTaskDelete(nullptr);
+		}
+		if (chunk.length > 0 && !watch->_bulkError && !watch->bulkWrite(chunk))
+		{
+			watch->_bulkError = true;
+		}
+		xSemaphoreGive(watch->_bulkFree);
+		if (chunk.last)
+		{
+			watch->armTimer(TIMER_BULK, 0); // report from loop()
+		}
+	}
+}
+
+/*!
+	@brief  stop the flash writer task and release the transfer queue, semaphore and buffers, an unfinished transfer is dropped
+*/
+void ChronosESP32::stopBulkWriter()
+{
+	if (_bulkTask != nullptr)
+	{
+		// queued after any pending chunks, so the writer finishes them first
+		BulkChunk quit = {0, 0, 0, false, true};
+		_bulkCloser = xTaskGetCurrentTaskHandle();
+		if (xQueueSend(_bulkQueue, &quit, pdMS_TO_TICKS(CS_BULK_QUIT_TIMEOUT)) != pdTRUE ||
+			ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CS_BULK_QUIT_TIMEOUT)) == 0)
+		{
+			// stuck in a flash operation
+			vTaskDelete(_bulkTask);
+		}
+		_bulkTask = nullptr;
+	}
+	if (_bulkQueue != nullptr)
+	{
+		vQueueDelete(_bulkQueue);
+		_bulkQueue = nullptr;
+	}
+	if (_bulkFree != nullptr)
+	{
+		vSemaphoreDelete(_bulkFree);
+		_bulkFree = nullptr;
+	}
+
+	if (_bulkTarget == BULK_OTA)
+	{
+		esp_ota_abort(_otaHandle);
+	}
+	_bulkTarget = BULK_NONE;
+	free(_bulkBuffers[0]);
+	free(_bulkBuffers[1]);
+	_bulkBuffers[0] = nullptr;
+	_bulkBuffers[1] = nullptr;
+}
+
+/*!
+	@brief  check whether a connection may start a watchface upload or a firmware update
+	@param  handle
+			connection handle
+	@return true for encrypted or bonded BLE links and for wired transports
+*/
+bool ChronosESP32::isLinkSecure(uint16_t handle)
+{
+	if (handle >= CS_TRANSPORT_HANDLE)
+	{
+		// the link itself is trusted, only attach transports whose peers may write the flash
+		return true;
+	}
+	NimBLEConnInfo info = BLEDevice::getServer()->getPeerInfoByHandle(handle);
+	return info.isEncrypted() || info.isBonded();
+}
+
+/*!
+	@brief  send a bulk transfer status to the app, (header)(status)(bytes received)
+	@param  header
+			transfer type
+	@param  status
+			BulkStatus
+*/
+void ChronosESP32::sendBulkStatus(uint8_t header, uint8_t status)
+{
+	if (!_inited || !_connected)
+	{
+		return;
+	}
+	uint8_t frame[] = {header, status, (uint8_t)(_bulkReceived >> 24), (uint8_t)(_bulkReceived >> 16), (uint8_t)(_bulkReceived >> 8), (uint8_t)(_bulkReceived)};
+	notify(frame, sizeof(frame), _bulkConn); // no delay, this runs on the BLE task during the transfer
+}
+
+/*!
+	@brief  add this instance to the ones receiving server events
+	@return false when CS_MAX_INSTANCES are already running
+*/
+bool ChronosESP32::registerInstance()
+{
+	bool added = false;
+	portENTER_CRITICAL(&_instanceMux);
+	for (int i = 0; i < CS_MAX_INSTANCES && !added; i++)
+	{
+		if (_instances[i] == nullptr)
+		{
+			_instances[i] = this;
+			added = true;
+		}
+	}
+	portEXIT_CRITICAL(&_instanceMux);
+	return added;
+}
+
+/*!
+	@brief  remove this instance from the ones receiving server events
+	@return another running instance, nullptr if none is left
+*/
+ChronosESP32 *ChronosESP32::unregisterInstance()
+{
+	ChronosESP32 *next = nullptr;
+	portENTER_CRITICAL(&_instanceMux);
+	for (int i = 0; i < CS_MAX_INSTANCES; i++)
+	{
+		if (_instances[i] == this)
+		{
+			_instances[i] = nullptr;
+		}
+		else if (_instances[i] != nullptr && next == nullptr)
+		{
+			next = _instances[i];
+		}
+	}
+	portEXIT_CRITICAL(&_instanceMux);
+	return next;
+}
+
+/*!
+	@brief  take a resource that exists once per device, eg. the RTC memory copy
+	@param  owner
+			owner of the resource, nullptr when free
+	@return false if another instance owns it
+*/
+bool ChronosESP32::claimShared(ChronosESP32 *&owner)
+{
+	portENTER_CRITICAL(&_instanceMux);
+	if (owner == nullptr)
+	{
+		owner = this;
+	}
+	bool claimed = owner == this;
+	portEXIT_CRITICAL(&_instanceMux);
+	return claimed;
+}
+
+/*!
+	@brief  give up a resource taken with claimShared()
+	@param  owner
+			owner of the resource
+*/
+void ChronosESP32::releaseShared(ChronosESP32 *&owner)
+{
+	portENTER_CRITICAL(&_instanceMux);
+	if (owner == this)
+	{
+		owner = nullptr;
+	}
+	portEXIT_CRITICAL(&_instanceMux);
+}
+
+/*!
+	@brief  copy the running instances, the callbacks run outside the lock
+	@param  list
+			receives up to CS_MAX_INSTANCES instances
+	@return number of instances
+*/
+int ChronosESP32::runningInstances(ChronosESP32 **list)
+{
+	int count = 0;
+	portENTER_CRITICAL(&_instanceMux);
+	for (int i = 0; i < CS_MAX_INSTANCES; i++)
+	{
+		if (_instances[i] != nullptr)
+		{
+			list[count++] = _instances[i];
+		}
+	}
+	portEXIT_CRITICAL(&_instanceMux);
+	return count;
+}
+
+/*!
+	@brief  forward onConnect to every running instance
+	@param  pServer
+			BLE server object
+	@param	connInfo
+			connection information
+*/
+void ChronosESP32::ServerRouter::onConnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo)
+{
+	ChronosESP32 *list[CS_MAX_INSTANCES];
+	int count = runningInstances(list);
+	for (int i = 0; i < count; i++)
+	{
+		list[i]->onConnect(pServer, connInfo);
+	}
+}
+
+/*!
+	@brief  forward onDisconnect to every running instance
+	@param  pServer
+			BLE server object
+	@param	connInfo
+			connection information
+	@param	reason
+			disconnect reason
+*/
+void ChronosESP32::ServerRouter::onDisconnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo, int reason)
+{
+	ChronosESP32 *list[CS_MAX_INSTANCES];
+	int count = runningInstances(list);
+	for (int i = 0; i < count; i++)
+	{
+		list[i]->onDisconnect(pServer, connInfo, reason);
+	}
+}
+
+/*!
+	@brief  forward onConnParamsUpdate to every running instance
+	@param	connInfo
+			connection information
+*/
+void ChronosESP32::ServerRouter::onConnParamsUpdate(NimBLEConnInfo &connInfo)
+{
+	ChronosESP32 *list[CS_MAX_INSTANCES];
+	int count = runningInstances(list);
+	for (int i = 0; i < count; i++)
+	{
+		list[i]->onConnParamsUpdate(connInfo);
+	}
+}
+
+/*!
+	@brief  forward onMTUChange to every running instance
+	@param	MTU
+			negotiated MTU
+	@param	connInfo
+			connection information
+*/
+void ChronosESP32::ServerRouter::onMTUChange(uint16_t MTU, NimBLEConnInfo &connInfo)
+{
+	ChronosESP32 *list[CS_MAX_INSTANCES];
+	int count = runningInstances(list);
+	for (int i = 0; i < count; i++)
+	{
+		list[i]->onMTUChange(MTU, connInfo);
+	}
+}
+
+/*!
+	@brief  onConnect from BLEServerCallbacks
+	@param  pServer
+			BLE server object
+	@param	connInfo
+			connection information
+*/
+void ChronosESP32::onConnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo)
+{
+	if (openConnection(connInfo.getConnHandle(), connInfo.getMTU(), &_bleTransport, false) == BLE_HS_CONN_HANDLE_NONE)
+	{
+		// every context is in use
+		pServer->disconnect(connInfo.getConnHandle());
+		return;
+	}
+
+	grantLinkInterval(connInfo.getConnInterval(), connInfo.getConnLatency());
+}
+
+/*!
+	@brief  give a new peer a connection context
+	@param  handle
+			BLE connection handle, BLE_HS_CONN_HANDLE_NONE to assign a wired one
+	@param  mtu
+			largest packet the peer accepts
+	@param  transport
+			transport the peer is reached through
+	@param  subscribed
+			the peer receives notifications without subscribing
+	@return the handle of the peer, BLE_HS_CONN_HANDLE_NONE if every context is in use
+*/
+uint16_t ChronosESP32::openConnection(uint16_t handle, uint16_t mtu, ChronosTransport *transport, bool subscribed)
+{
+	portENTER_CRITICAL(&_connMux);
+	ChronosConnection *conn = findConnection(BLE_HS_CONN_HANDLE_NONE);
+	if (conn != nullptr)
+	{
+		conn->handle = handle != BLE_HS_CONN_HANDLE_NONE ? handle : CS_TRANSPORT_HANDLE + (conn - _conns);
+		conn->mtu = mtu;
+		conn->subscribed = subscribed;
+		conn->chunked = _chunked;
+		conn->transport = transport;
+		conn->incoming.length = 0;
+		handle = conn->handle;
+		_connCount++;
+		_bleCount += transport == &_bleTransport ? 1 : 0;
+	}
+	uint8_t centrals = _bleCount;
+	uint8_t session = pService != nullptr ? _bleCount : _connCount;
+	portEXIT_CRITICAL(&_connMux);
+
+	if (conn == nullptr)
+	{
+		return BLE_HS_CONN_HANDLE_NONE;
+	}
+
+	_connected = true; // every peer can be sent to
+	if (transport == &_bleTransport)
+	{
+		// the stack stops advertising on connect, keep going while more centrals may join
+		startAdvertisingPhase(centrals < _maxConnections ? ADV_FAST : ADV_OFF);
+	}
+	if (subscribed)
+	{
+		_subscribed = true;
+		armTimer(TIMER_INFO, CS_INFO_DELAY);
+	}
+	if (!isSessionPeer(transport) || session > 1)
+	{
+		// joins the session of the peers already connected
+		notifyLoop();
+		return handle;
+	}
+
+	portENTER_CRITICAL(&_linkMux);
+	_linkMode = LINK_DEFAULT;
+	_linkRequest = LINK_DEFAULT;
+	_linkSince = millis();
+	_linkLast = _linkSince;
+	_linkIdleArmed = _linkEnabled;
+	portEXIT_CRITICAL(&_linkMux);
+
+	if (_wakeStats.connected == 0)
+	{
+		_wakeStats.connected = millis();
+	}
+	if (_linkEnabled)
+	{
+		armTimer(TIMER_LINK, _linkIdleTimeout);
+	}
+	if (connectionChangeCallback != nullptr)
+	{
+		connectionChangeCallback(true);
+	}
+	notifyLoop();
+	return handle;
+}
+
+/*!
+	@brief  check whether a peer on the transport starts and ends the session (connection callback, session state)
+			with bluetooth LE running these are the centrals, wired peers join their session
+	@param  transport
+			transport of the peer
+*/
+bool ChronosESP32::isSessionPeer(const ChronosTransport *transport)
+{
+	return transport == &_bleTransport || pService == nullptr;
+}
+
+/*!
+	@brief  onDisconnect from BLEServerCallbacks
+	@param  pServer
+			BLE server object
+	@param	connInfo
+			connection information
+	@param	reason
+			disconnect reason
+*/
+void ChronosESP32::onDisconnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo, int reason)
+{
+	closeConnection(connInfo.getConnHandle());
+}
+
+/*!
+	@brief  release the context of a peer, the session ends with the last one
+	@param  handle
+			connection handle
+*/
+void ChronosESP32::closeConnection(uint16_t handle)
+{
+	portENTER_CRITICAL(&_connMux);
+	ChronosConnection *conn = findConnection(handle);
+	const ChronosTransport *transport = nullptr;
+	if (conn != nullptr)
+	{
+		transport = conn->transport;
+		conn->handle = BLE_HS_CONN_HANDLE_NONE;
+		conn->subscribed = false;
+		conn->incoming.length = 0;
+		_connCount--;
+		_bleCount -= transport == &_bleTransport ? 1 : 0;
+	}
+	uint8_t count = _connCount;
+	uint8_t centrals = _bleCount;
+	uint8_t session = pService != nullptr ? _bleCount : _connCount;
+	bool subscribed = false;
+	for (int i = 0; i < CS_MAX_CONNECTIONS; i++)
+	{
+		subscribed |= _conns[i].handle != BLE_HS_CONN_HANDLE_NONE && _conns[i].subscribed;
+	}
+	portEXIT_CRITICAL(&_connMux);
+
+	if (conn == nullptr)
+	{
+		return; // rejected when it connected
+	}
+	// the sync session of this peer ends, loop() drops the progress it could not confirm
+	HealthSync &sync = _healthSyncs[conn - _conns];
+	portENTER_CRITICAL(&_dirtyMux);
+	sync.request = 0;
+	sync.lost = true;
+	portEXIT_CRITICAL(&_dirtyMux);
+	_subscribed = subscribed;
+	checkIncoming(false);
+	if (_bulkTarget != BULK_NONE && handle == _bulkConn)
+	{
+		_bulkConn = BLE_HS_CONN_HANDLE_NONE;
+		if (_bulkTarget == BULK_OTA)
+		{
+			armTimer(TIMER_OTA, CS_OTA_RESUME_TIMEOUT); // the app can continue after reconnecting
+		}
+		else
+		{
+			bulkAbort(); // watchface uploads do not survive a disconnect
+		}
+	}
+	_connected = count > 0;
+	if (transport == &_bleTransport && centrals < _maxConnections)
+	{
+		startAdvertisingPhase(ADV_FAST);
+	}
+	if (!isSessionPeer(transport) || session > 0)
+	{
+		// the other peers keep the session
+		notifyLoop();
+		return;
+	}
+
+	portENTER_CRITICAL(&_linkMux);
+	accrueLinkTime(millis());
+	_linkMode = LINK_DEFAULT;
+	_linkRequest = LINK_DEFAULT;
+	_linkIdleArmed = false;
+	portEXIT_CRITICAL(&_linkMux);
+	disarmTimer(TIMER_LINK);
+	stopRealtime();
+
+	_cameraReady = false;
+	clearFrameCache(); // state is partly reset below, let the next sync decode everything
+	pushTouch(false, _touch.x, _touch.y); // release touch
+
+	if (_navigation.active)
+	{
+		updateField(_navigation.active, false, _navigationDirty, NAV_DIRTY_ACTIVE);
+		if (configurationReceivedCallback != nullptr)
+		{
+			configurationReceivedCallback(CF_NAV_DATA, _navigation.active ? 1 : 0, 0);
+		}
+	}
+
+	if (connectionChangeCallback != nullptr)
+	{
+		connectionChangeCallback(false);
 	}
+	notifyLoop();
 }
 
 /*!
-	@brief  onConnect from BLEServerCallbacks
-	@param  pServer
-			BLE server object
+	@brief  onConnParamsUpdate from BLEServerCallbacks
+	@param	connInfo
+			connection information with the granted parameters
+*/
+void ChronosESP32::onConnParamsUpdate(NimBLEConnInfo &connInfo)
+{
+	grantLinkInterval(connInfo.getConnInterval(), connInfo.getConnLatency());
+}
+
+/*!
+	@brief  onMTUChange from BLEServerCallbacks
+	@param	MTU
+			negotiated MTU
 	@param	connInfo
 			connection information
 */
-void ChronosESP32::onConnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo)
+void ChronosESP32::onMTUChange(uint16_t MTU, NimBLEConnInfo &connInfo)
 {
-	_connected = true;
-	if (connectionChangeCallback != nullptr)
+	portENTER_CRITICAL(&_connMux);
+	ChronosConnection *conn = findConnection(connInfo.getConnHandle());
+	if (conn != nullptr)
 	{
-		connectionChangeCallback(true);
+		conn->mtu = MTU;
 	}
+	portEXIT_CRITICAL(&_connMux);
 }
 
 /*!
-	@brief  onDisconnect from BLEServerCallbacks
-	@param  pServer
-			BLE server object
-	@param	connInfo
-			connection information
-	@param	reason
-			disconnect reason
+	@brief  find the context of a connection
+	@param  handle
+			connection handle, BLE_HS_CONN_HANDLE_NONE finds a free slot
+	@return the context, nullptr if there is none
 */
-void ChronosESP32::onDisconnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo, int reason)
+ChronosESP32::ChronosConnection *ChronosESP32::findConnection(uint16_t handle)
 {
-	_connected = false;
-	_cameraReady = false;
-	BLEDevice::startAdvertising();
-	_touch.state = false; // release touch
+	for (int i = 0; i < CS_MAX_CONNECTIONS; i++)
+	{
+		// a closed slot is only handed out again once its last packet is decoded
+		if (_conns[i].handle == handle && (handle != BLE_HS_CONN_HANDLE_NONE || _conns[i].users == 0))
+		{
+			return &_conns[i];
+		}
+	}
+	return nullptr;
+}
 
-	if (_navigation.active)
+/*!
+	@brief  find the context of a connection and hold it while a packet is decoded, call without _connMux held
+	@param  handle
+			connection handle
+	@return the context, nullptr if the peer is not connected, pass it to releaseConnection()
+*/
+ChronosESP32::ChronosConnection *ChronosESP32::acquireConnection(uint16_t handle)
+{
+	portENTER_CRITICAL(&_connMux);
+	ChronosConnection *conn = handle == BLE_HS_CONN_HANDLE_NONE ? nullptr : findConnection(handle);
+	if (conn != nullptr)
 	{
-		_navigation.active = false;
-		if (configurationReceivedCallback != nullptr)
+		conn->users++;
+	}
+	portEXIT_CRITICAL(&_connMux);
+	return conn;
+}
+
+/*!
+	@brief  release a context held by acquireConnection()
+	@param  conn
+			the context
+*/
+void ChronosESP32::releaseConnection(ChronosConnection *conn)
+{
+	portENTER_CRITICAL(&_connMux);
+	conn->users--;
+	portEXIT_CRITICAL(&_connMux);
+}
+
+/*!
+	@brief  copy the connected centrals, the BLE task may change the contexts meanwhile
+	@param  list
+			receives up to CS_MAX_CONNECTIONS centrals
+	@return number of centrals
+*/
+int ChronosESP32::peers(ChronosPeer *list)
+{
+	int count = 0;
+	portENTER_CRITICAL(&_connMux);
+	for (int i = 0; i < CS_MAX_CONNECTIONS; i++)
+	{
+		if (_conns[i].handle != BLE_HS_CONN_HANDLE_NONE)
 		{
-			configurationReceivedCallback(CF_NAV_DATA, _navigation.active ? 1 : 0, 0);
+			list[count++] = {_conns[i].handle, _conns[i].mtu, _conns[i].subscribed, _conns[i].chunked};
 		}
 	}
+	portEXIT_CRITICAL(&_connMux);
+	return count;
+}
 
-	if (connectionChangeCallback != nullptr)
+/*!
+	@brief  arm the reassembly timeout for the earliest incomplete frame
+	@param  expire
+			first drop the frames whose rest did not arrive within CS_RX_TIMEOUT
+*/
+void ChronosESP32::checkIncoming(bool expire)
+{
+	unsigned long now = millis();
+	long next = -1;
+	for (int i = 0; i < CS_MAX_CONNECTIONS; i++)
 	{
-		connectionChangeCallback(false);
+		ChronosConnection &conn = _conns[i];
+		if (conn.handle == BLE_HS_CONN_HANDLE_NONE || conn.incoming.length == 0)
+		{
+			continue;
+		}
+		long left = CS_RX_TIMEOUT - (long)(now - conn.rxStart);
+		if (expire && left <= 0)
+		{
+			conn.incoming.length = 0;
+			continue;
+		}
+		if (next < 0 || left < next)
+		{
+			next = max(left, 0L);
+		}
+	}
+	if (next < 0)
+	{
+		disarmTimer(TIMER_RX);
+	}
+	else
+	{
+		armTimer(TIMER_RX, next);
 	}
 }
 
@@ -1374,12 +6614,25 @@ void ChronosESP32::onSubscribe(NimBLECharacteristic *pCharacteristic, NimBLEConn
 {
 	if (pCharacteristic == pCharacteristicTX)
 	{
-		_subscribed = subValue == 1;
+		bool subscribed = subValue == 1;
+		bool any = false;
+		portENTER_CRITICAL(&_connMux);
+		ChronosConnection *conn = findConnection(connInfo.getConnHandle());
+		if (conn != nullptr)
+		{
+			conn->subscribed = subscribed;
+		}
+		for (int i = 0; i < CS_MAX_CONNECTIONS; i++)
+		{
+			any |= _conns[i].handle != BLE_HS_CONN_HANDLE_NONE && _conns[i].subscribed;
+		}
+		portEXIT_CRITICAL(&_connMux);
+		_subscribed = any;
 
-		if (_subscribed)
+		if (subscribed)
 		{
-			_infoTimer.time = millis();
-			_infoTimer.active = true;
+			// after a warm wake the app already knows this watch
+			armTimer(TIMER_INFO, _wakeStats.warm && _wakeStats.ready == 0 ? CS_WARM_INFO_DELAY : CS_INFO_DELAY);
 		}
 	}
 }
@@ -1393,67 +6646,128 @@ void ChronosESP32::onSubscribe(NimBLECharacteristic *pCharacteristic, NimBLEConn
 */
 void ChronosESP32::onWrite(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo)
 {
-	std::string pData = pCharacteristic->getValue();
-	int len = pData.length();
-	if (len > 0)
+	std::string value = pCharacteristic->getValue();
+	packetReceived(connInfo.getConnHandle(), (const uint8_t *)value.data(), value.length());
+}
+
+/*!
+	@brief  handle one packet written by a peer, BLE or wired
+	@param  handle
+			connection handle of the peer
+	@param  pData
+			packet data
+	@param  len
+			packet length
+*/
+void ChronosESP32::packetReceived(uint16_t handle, const uint8_t *pData, int len)
+{
+	ChronosConnection *conn = len > 0 && _rxLock != nullptr ? acquireConnection(handle) : nullptr;
+	if (conn != nullptr)
 	{
+		xSemaphoreTake(_rxLock, portMAX_DELAY);
+
+		// continuation packets and incomplete frames are part of a bulk transfer
+		bool start = len >= 4 && (pData[0] == 0xAB || pData[0] == 0xEA) && (pData[3] == 0xFE || pData[3] == 0xFF);
+		linkActivity(!start || (pData[1] * 256 + pData[2] + 3) > len);
+
 		if (rawDataReceivedCallback != nullptr)
 		{
-			rawDataReceivedCallback((uint8_t *)pData.data(), len);
+			rawDataReceivedCallback((uint8_t *)pData, len);
 		}
 
-		if ((pData[0] == 0xAB || pData[0] == 0xEA) && (pData[3] == 0xFE || pData[3] == 0xFF))
+		if (_watchfaceEnabled && (pData[0] == 0xB0 || (pData[0] == 0xAF && _bulkTarget == BULK_WATCHFACE)))
 		{
-			// start of data, assign length from packet
-			_incomingData.length = pData[1] * 256 + pData[2] + 3;
-			// copy data to incomingBuffer
-			for (int i = 0; i < len; i++)
+			// watchface upload, raw packets outside the AB/EA framing, image data only from the peer that started it
+			if (pData[0] == 0xB0 || handle == _bulkConn)
+			{
+				watchfacePacket(handle, pData, len);
+			}
+			xSemaphoreGive(_rxLock);
+			releaseConnection(conn);
+			notifyLoop();
+			return;
+		}
+		if (_otaEnabled && (pData[0] == 0xD0 || (pData[0] == 0xD1 && _bulkTarget == BULK_OTA)))
+		{
+			// firmware update, image data is only taken from the peer that started or resumed it
+			if (pData[0] == 0xD0 || handle == _bulkConn)
 			{
-				_incomingData.data[i] = pData[i];
+				otaPacket(handle, pData, len);
 			}
+			xSemaphoreGive(_rxLock);
+			releaseConnection(conn);
+			notifyLoop();
+			return;
+		}
 
-			if (_incomingData.length <= len)
+		// each central has its own reassembly buffer, their packets may interleave
+		ChronosData &incoming = conn->incoming;
+		if (start)
+		{
+			// start of data, assign length from packet
+			incoming.length = pData[1] * 256 + pData[2] + 3;
+			if (incoming.length > CS_DATA_SIZE)
 			{
-				// complete packet assembled
-				dataReceived();
+				// does not fit in the buffer, drop it
+				incoming.length = 0;
 			}
 			else
 			{
-				// data is still being assembled
-				// Serial.println("Incomplete");
+				// copy data to incomingBuffer
+				memcpy(incoming.data, pData, min(len, CS_DATA_SIZE));
+				conn->rxStart = millis();
+
+				if (incoming.length <= len)
+				{
+					// complete packet assembled
+					dataReceived(*conn);
+					incoming.length = 0;
+				}
 			}
+			// drop the frame if the rest does not arrive in time
+			checkIncoming(false);
 		}
-		else
+		else if (incoming.length > 0)
 		{
 			int j = 20 + (pData[0] * 19); // data packet position
-			// copy data to incomingBuffer
-			for (int i = 0; i < len; i++)
+			if (j + len - 1 <= CS_DATA_SIZE)
 			{
-				_incomingData.data[j + i] = pData[i + 1];
-			}
+				// copy data to incomingBuffer, skipping the sequence byte
+				memcpy(incoming.data + j, pData + 1, len - 1);
 
-			if (_incomingData.length <= len + j - 1)
-			{
-				// complete packet assembled
-				dataReceived();
-			}
-			else
-			{
-				// data is still being assembled
-				// Serial.println("Incomplete");
+				if (incoming.length <= len + j - 1)
+				{
+					// complete packet assembled
+					dataReceived(*conn);
+					incoming.length = 0;
+					checkIncoming(false);
+				}
 			}
 		}
 
-		if (pData[0] == 0xB0)
-		{
-			// bin watchface chunk info
-		}
+		xSemaphoreGive(_rxLock);
+		releaseConnection(conn);
+		notifyLoop();
+	}
+}
 
-		if (pData[0] == 0xAF)
-		{
-			// bin watchface chunk data
-		}
+/*!
+	@brief  read a null terminated string from the incoming data
+	@param  index
+			start position, advanced past the terminating null
+	@param  len
+			length of the incoming data
+*/
+String ChronosESP32::readString(int &index, int len)
+{
+	String value = "";
+	while (index < len && _incomingData->data[index] != 0)
+	{
+		value += char(_incomingData->data[index]);
+		index++;
 	}
+	index++;
+	return value;
 }
 
 void ChronosESP32::splitTitle(const String &input, String &title, String &message, int icon)
@@ -1474,24 +6788,141 @@ void ChronosESP32::splitTitle(const String &input, String &title, String &messag
 	}
 }
 
+/*!
+	@brief  compute the crc32 (IEEE 802.3) of a buffer
+	@param  data
+			buffer to process
+	@param  length
+			number of bytes
+	@param  crc
+			previous result when computing over several buffers
+*/
+uint32_t ChronosESP32::crc32(const uint8_t *data, size_t length, uint32_t crc)
+{
+	static const uint32_t table[16] = {
+		0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+		0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+	crc = ~crc;
+	for (size_t i = 0; i < length; i++)
+	{
+		crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+		crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+	}
+	return ~crc;
+}
+
+/*!
+	@brief  identity of the incoming frame, frames with the same key overwrite the same state
+*/
+uint32_t ChronosESP32::frameKey()
+{
+	uint8_t header = _incomingData->data[0];
+	uint8_t opcode = _incomingData->data[4];
+	uint8_t sub = 0;
+	uint8_t index = 0;
+
+	if (header == 0xAB && opcode == 0x9D)
+	{
+		sub = _incomingData->data[5]; // music status, title and artist are separate frames
+	}
+	else if (header == 0xEA && opcode == 0x7E)
+	{
+		sub = _incomingData->data[5]; // city or hourly forecast
+		if (sub == 0x02)
+		{
+			index = _incomingData->data[7]; // forecast start hour
+		}
+	}
+	return ((uint32_t)header << 24) | ((uint32_t)opcode << 16) | ((uint32_t)sub << 8) | index;
+}
+
+/*!
+	@brief  check the incoming frame against the hash of the last frame with the same key
+	@return true when the frame is byte-identical and can be skipped
+*/
+bool ChronosESP32::isDuplicateFrame()
+{
+	if (!isDuplicateFilterEnabled(_incomingData->data[4]))
+	{
+		return false;
+	}
+
+	_frameChecks++;
+	uint32_t key = frameKey();
+	uint32_t hash = crc32(_incomingData->data, _incomingData->length);
+	uint8_t opcode = _incomingData->data[4];
+	if (opcode == 0x7E || opcode == 0x88 || opcode == 0x8A)
+	{
+		// weather is stored relative to the day it arrives, decode it again on a new day
+		uint16_t day = this->getDayofYear();
+		hash = crc32((const uint8_t *)&day, sizeof(day), hash);
+	}
+
+	for (int i = 0; i < _frameCacheCount; i++)
+	{
+		if (_frameKeys[i] == key)
+		{
+			if (_frameHashes[i] == hash)
+			{
+				_frameHits++;
+				return true;
+			}
+			_frameHashes[i] = hash;
+			return false;
+		}
+	}
+
+	// new key, replace the oldest entry once the cache is full
+	_frameKeys[_frameCacheNext] = key;
+	_frameHashes[_frameCacheNext] = hash;
+	_frameCacheNext = (_frameCacheNext + 1) % CS_FRAME_CACHE_SIZE;
+	if (_frameCacheCount < CS_FRAME_CACHE_SIZE)
+	{
+		_frameCacheCount++;
+	}
+	return false;
+}
+
 /*!
 	@brief  dataReceived function, called after data packets have been assembled
+	@param  conn
+			context of the central that sent the frame
 */
-void ChronosESP32::dataReceived()
+void ChronosESP32::dataReceived(ChronosConnection &conn)
 {
-	int len = _incomingData.length;
+	_incomingData = &conn.incoming;
+	int len = _incomingData->length;
+
+	if (isDuplicateFrame())
+	{
+		// identical to the last frame of this type, state is already up to date
+		if (_incomingData->data[4] == 0x7E)
+		{
+			// still counts as fresh weather
+			if (_incomingData->data[0] == 0xAB)
+			{
+				_weatherReceived = this->getEpoch();
+			}
+			else if (_incomingData->data[5] == 0x02)
+			{
+				_forecastReceived = this->getEpoch();
+			}
+		}
+		return;
+	}
 
 	if (dataReceivedCallback != nullptr)
 	{
-		dataReceivedCallback(_incomingData.data, _incomingData.length);
+		dataReceivedCallback(_incomingData->data, _incomingData->length);
 	}
-	if (_incomingData.data[0] == 0xAB)
+	if (_incomingData->data[0] == 0xAB)
 	{
-		switch (_incomingData.data[4])
+		switch (_incomingData->data[4])
 		{
 
 		case 0x20:
-			if (_incomingData.data[3] == 0xFE)
+			if (_incomingData->data[3] == 0xFE)
 			{
 				if (configurationReceivedCallback != nullptr)
 				{
@@ -1506,38 +6937,43 @@ void ChronosESP32::dataReceived()
 			}
 			break;
 		case 0x31:
-			switch (_incomingData.data[5])
+			switch (_incomingData->data[5])
 			{
 			case 0x0A:
+				realtimeRequest(1 << HEALTH_HEART_RATE, _incomingData->data[6]);
 				if (healthRequestCallback != nullptr)
 				{
-					healthRequestCallback(HR_HEART_RATE_MEASURE, _incomingData.data[6]);
+					healthRequestCallback(HR_HEART_RATE_MEASURE, _incomingData->data[6]);
 				}
 				break;
 			case 0x12:
+				realtimeRequest(1 << HEALTH_BLOOD_OXYGEN, _incomingData->data[6]);
 				if (healthRequestCallback != nullptr)
 				{
-					healthRequestCallback(HR_BLOOD_OXYGEN_MEASURE, _incomingData.data[6]);
+					healthRequestCallback(HR_BLOOD_OXYGEN_MEASURE, _incomingData->data[6]);
 				}
 				break;
 			case 0x22:
+				realtimeRequest(1 << HEALTH_BLOOD_PRESSURE, _incomingData->data[6]);
 				if (healthRequestCallback != nullptr)
 				{
-					healthRequestCallback(HR_BLOOD_PRESSURE_MEASURE, _incomingData.data[6]);
+					healthRequestCallback(HR_BLOOD_PRESSURE_MEASURE, _incomingData->data[6]);
 				}
 				break;
 			}
 			break;
 		case 0x32:
+			realtimeRequest(1 << HEALTH_TYPES, _incomingData->data[6]);
 			if (healthRequestCallback != nullptr)
 			{
-				healthRequestCallback(HR_MEASURE_ALL, _incomingData.data[6]);
+				healthRequestCallback(HR_MEASURE_ALL, _incomingData->data[6]);
 			}
 			break;
 		case 0x51:
-			switch (_incomingData.data[5])
+			switch (_incomingData->data[5])
 			{
 			case 0x80:
+				requestHealthSync(conn, (1 << HEALTH_STEPS) | (1 << HEALTH_HEART_RATE) | (1 << HEALTH_BLOOD_OXYGEN) | (1 << HEALTH_BLOOD_PRESSURE) | (1 << HEALTH_TEMPERATURE));
 				if (healthRequestCallback != nullptr)
 				{
 					healthRequestCallback(HR_STEPS_RECORDS, true);
@@ -1547,9 +6983,10 @@ void ChronosESP32::dataReceived()
 
 			break;
 		case 0x52:
-			switch (_incomingData.data[5])
+			switch (_incomingData->data[5])
 			{
 			case 0x80:
+				requestHealthSync(conn, 1 << HEALTH_SLEEP);
 				if (healthRequestCallback != nullptr)
 				{
 					healthRequestCallback(HR_SLEEP_RECORDS, true);
@@ -1559,18 +6996,26 @@ void ChronosESP32::dataReceived()
 
 			break;
 		case 0x53:
+		{
+			uint8_t hour = _incomingData->data[7];
+			uint8_t minute = _incomingData->data[8];
+			uint8_t hour2 = _incomingData->data[9];
+			uint8_t minute2 = _incomingData->data[10];
+			Reminder &water = _reminders[REMINDER_WATER];
+			water.enabled = _incomingData->data[6];
+			water.start = (hour * 60) + minute;
+			water.end = (hour2 * 60) + minute2;
+			water.interval = _incomingData->data[11];
+			scheduleReminder(REMINDER_WATER);
+			markState(STATE_SETTINGS);
 			if (configurationReceivedCallback != nullptr)
 			{
-				uint8_t hour = _incomingData.data[7];
-				uint8_t minute = _incomingData.data[8];
-				uint8_t hour2 = _incomingData.data[9];
-				uint8_t minute2 = _incomingData.data[10];
-				bool enabled = _incomingData.data[6];
-				uint32_t interval = ((uint32_t)_incomingData.data[11] << 16) | (uint16_t)_incomingData.data[6];
+				uint32_t interval = ((uint32_t)_incomingData->data[11] << 16) | (uint16_t)_incomingData->data[6];
 				uint32_t wtr = ((uint32_t)hour << 24) | ((uint32_t)minute << 16) | ((uint32_t)hour2 << 8) | ((uint32_t)minute2);
 				configurationReceivedCallback(CF_WATER, interval, wtr);
 			}
-			break;
+		}
+		break;
 
 		case 0x71:
 			if (configurationReceivedCallback != nullptr)
@@ -1581,13 +7026,13 @@ void ChronosESP32::dataReceived()
 
 		case 0x72:
 		{
-			int icon = _incomingData.data[6];
-			int state = _incomingData.data[7];
+			int icon = _incomingData->data[6];
+			int state = _incomingData->data[7];
 
 			String message = "";
 			for (int i = 8; i < len; i++)
 			{
-				message += (char)_incomingData.data[i];
+				message += (char)_incomingData->data[i];
 			}
 
 			if (icon == 0x01)
@@ -1625,15 +7070,18 @@ void ChronosESP32::dataReceived()
 		break;
 		case 0x73:
 		{
-			uint8_t hour = _incomingData.data[8];
-			uint8_t minute = _incomingData.data[9];
-			uint8_t repeat = _incomingData.data[10];
-			bool enabled = _incomingData.data[7];
-			uint32_t index = (uint32_t)_incomingData.data[6];
+			uint8_t hour = _incomingData->data[8];
+			uint8_t minute = _incomingData->data[9];
+			uint8_t repeat = _incomingData->data[10];
+			bool enabled = _incomingData->data[7];
+			uint32_t index = (uint32_t)_incomingData->data[6];
 			_alarms[index % CS_ALARM_SIZE].hour = hour;
 			_alarms[index % CS_ALARM_SIZE].minute = minute;
 			_alarms[index % CS_ALARM_SIZE].repeat = repeat;
 			_alarms[index % CS_ALARM_SIZE].enabled = enabled;
+			_alarmDue[index % CS_ALARM_SIZE] = 0;
+			armTimer(TIMER_ALARM, 0); // rescheduled from loop()
+			markState(STATE_ALARMS);
 			if (configurationReceivedCallback != nullptr)
 			{
 				uint32_t alarm = ((uint32_t)hour << 24) | ((uint32_t)minute << 16) | ((uint32_t)repeat << 8) | ((uint32_t)enabled);
@@ -1645,41 +7093,51 @@ void ChronosESP32::dataReceived()
 			if (configurationReceivedCallback != nullptr)
 			{
 				// user.step, user.age, user.height, user.weight, si, user.target/1000, temp
-				uint8_t age = _incomingData.data[7];
-				uint8_t height = _incomingData.data[8];
-				uint8_t weight = _incomingData.data[9];
-				uint8_t step = _incomingData.data[6];
+				uint8_t age = _incomingData->data[7];
+				uint8_t height = _incomingData->data[8];
+				uint8_t weight = _incomingData->data[9];
+				uint8_t step = _incomingData->data[6];
 				uint32_t u1 = ((uint32_t)age << 24) | ((uint32_t)height << 16) | ((uint32_t)weight << 8) | ((uint32_t)step);
-				uint8_t unit = _incomingData.data[10];
-				uint8_t target = _incomingData.data[11];
-				uint8_t temp = _incomingData.data[12];
+				uint8_t unit = _incomingData->data[10];
+				uint8_t target = _incomingData->data[11];
+				uint8_t temp = _incomingData->data[12];
 				uint32_t u2 = ((uint32_t)unit << 24) | ((uint32_t)target << 16) | ((uint32_t)temp << 8) | ((uint32_t)step);
 
 				configurationReceivedCallback(CF_USER, u1, u2);
 			}
 			break;
 		case 0x75:
+		{
+			uint8_t hour = _incomingData->data[7];
+			uint8_t minute = _incomingData->data[8];
+			uint8_t hour2 = _incomingData->data[9];
+			uint8_t minute2 = _incomingData->data[10];
+			Reminder &sedentary = _reminders[REMINDER_SEDENTARY];
+			sedentary.enabled = _incomingData->data[6];
+			sedentary.start = (hour * 60) + minute;
+			sedentary.end = (hour2 * 60) + minute2;
+			sedentary.interval = _incomingData->data[11];
+			scheduleReminder(REMINDER_SEDENTARY);
+			markState(STATE_SETTINGS);
 			if (configurationReceivedCallback != nullptr)
 			{
-				uint8_t hour = _incomingData.data[7];
-				uint8_t minute = _incomingData.data[8];
-				uint8_t hour2 = _incomingData.data[9];
-				uint8_t minute2 = _incomingData.data[10];
-				bool enabled = _incomingData.data[6];
-				uint32_t interval = ((uint32_t)_incomingData.data[11] << 16) | (uint16_t)_incomingData.data[6];
+				uint32_t interval = ((uint32_t)_incomingData->data[11] << 16) | (uint16_t)_incomingData->data[6];
 				uint32_t sed = ((uint32_t)hour << 24) | ((uint32_t)minute << 16) | ((uint32_t)hour2 << 8) | ((uint32_t)minute2);
 				configurationReceivedCallback(CF_SED, interval, sed);
 			}
-			break;
+		}
+		break;
 		case 0x76:
 			{
-				uint8_t hour = _incomingData.data[7];
-				uint8_t minute = _incomingData.data[8];
-				uint8_t hour2 = _incomingData.data[9];
-				uint8_t minute2 = _incomingData.data[10];
-				_quietEnabled = _incomingData.data[6];
+				uint8_t hour = _incomingData->data[7];
+				uint8_t minute = _incomingData->data[8];
+				uint8_t hour2 = _incomingData->data[9];
+				uint8_t minute2 = _incomingData->data[10];
+				_quietEnabled = _incomingData->data[6];
 				_quietStart = (hour * 60) + minute;
 				_quietEnd = (hour2 * 60) + minute2;
+				scheduleReminders();
+				markState(STATE_SETTINGS);
 				if (configurationReceivedCallback != nullptr)
 				{
 					uint32_t qt = ((uint32_t)hour << 24) | ((uint32_t)minute << 16) | ((uint32_t)hour2 << 8) | ((uint32_t)minute2);
@@ -1690,54 +7148,61 @@ void ChronosESP32::dataReceived()
 		case 0x77:
 			if (configurationReceivedCallback != nullptr)
 			{
-				configurationReceivedCallback(CF_RTW, 0, (uint32_t)_incomingData.data[6]);
+				configurationReceivedCallback(CF_RTW, 0, (uint32_t)_incomingData->data[6]);
 			}
 			break;
 		case 0x78:
 			if (configurationReceivedCallback != nullptr)
 			{
-				configurationReceivedCallback(CF_HOURLY, 0, (uint32_t)_incomingData.data[6]);
+				configurationReceivedCallback(CF_HOURLY, 0, (uint32_t)_incomingData->data[6]);
 			}
 			break;
 		case 0x79:
-			_cameraReady = ((uint8_t)_incomingData.data[6] == 1);
+			_cameraReady = ((uint8_t)_incomingData->data[6] == 1);
 			if (configurationReceivedCallback != nullptr)
 			{
-				configurationReceivedCallback(CF_CAMERA, 0, (uint32_t)_incomingData.data[6]);
+				configurationReceivedCallback(CF_CAMERA, 0, (uint32_t)_incomingData->data[6]);
 			}
 			break;
 		case 0x7B:
 			if (configurationReceivedCallback != nullptr)
 			{
-				configurationReceivedCallback(CF_LANG, 0, (uint32_t)_incomingData.data[6]);
+				configurationReceivedCallback(CF_LANG, 0, (uint32_t)_incomingData->data[6]);
 			}
 			break;
 		case 0x7C:
-			_hour24 = ((uint8_t)_incomingData.data[6] == 0);
+			_hour24 = ((uint8_t)_incomingData->data[6] == 0);
+			markState(STATE_SETTINGS);
 			if (configurationReceivedCallback != nullptr)
 			{
-				configurationReceivedCallback(CF_HR24, 0, (uint32_t)(_incomingData.data[6] == 0));
+				configurationReceivedCallback(CF_HR24, 0, (uint32_t)(_incomingData->data[6] == 0));
 			}
 			break;
 		case 0x7E:
 		{
-			_weatherTime = this->getTime("%H:%M");
-			_weatherSize = 0;
+			updateField(_weatherTime, this->getTime("%H:%M"), _weatherDirty, WEATHER_DIRTY_TIME);
+			TimeSnapshot now = captureTime();
+			unsigned long midnight = now.epoch - ((now.minuteOfDay * 60UL) + now.second);
+			_weatherReceived = now.epoch;
+			updateField(_weatherStart, now.epoch < CS_EPOCH_VALID ? 0UL : midnight, _weatherDirty, WEATHER_DIRTY_DAILY);
+			int size = 0;
 			for (int k = 0; k < (len - 6) / 2; k++)
 			{
 				if (k >= CS_WEATHER_SIZE)
 				{
 					break;
 				}
-				int icon = _incomingData.data[(k * 2) + 6] >> 4;
-				int sign = (_incomingData.data[(k * 2) + 6] & 1) ? -1 : 1;
-				int temp = ((int)_incomingData.data[(k * 2) + 7]) * sign;
-				int dy = this->getDayofWeek() + k;
-				_weather[k].day = dy % 7;
-				_weather[k].icon = icon;
-				_weather[k].temp = temp;
-				_weatherSize++;
+				int icon = _incomingData->data[(k * 2) + 6] >> 4;
+				int sign = (_incomingData->data[(k * 2) + 6] & 1) ? -1 : 1;
+				int temp = ((int)_incomingData->data[(k * 2) + 7]) * sign;
+				int dy = now.dayOfWeek + k;
+				updateField(_weatherDay[k], (uint8_t)(dy % 7), _weatherDirty, WEATHER_DIRTY_DAILY);
+				updateField(_weatherIcon[k], (uint8_t)icon, _weatherDirty, WEATHER_DIRTY_DAILY);
+				updateField(_weatherTemp[k], (int16_t)temp, _weatherDirty, WEATHER_DIRTY_DAILY);
+				size++;
 			}
+			updateField(_weatherSize, size, _weatherDirty, WEATHER_DIRTY_COUNT);
+			markState(STATE_WEATHER);
 			if (configurationReceivedCallback != nullptr)
 			{
 				configurationReceivedCallback(CF_WEATHER, 1, 0);
@@ -1752,15 +7217,16 @@ void ChronosESP32::dataReceived()
 				{
 					break;
 				}
-				int signH = (_incomingData.data[(k * 2) + 6] >> 7 & 1) ? -1 : 1;
-				int tempH = ((int)_incomingData.data[(k * 2) + 6] & 0x7F) * signH;
+				int signH = (_incomingData->data[(k * 2) + 6] >> 7 & 1) ? -1 : 1;
+				int tempH = ((int)_incomingData->data[(k * 2) + 6] & 0x7F) * signH;
 
-				int signL = (_incomingData.data[(k * 2) + 7] >> 7 & 1) ? -1 : 1;
-				int tempL = ((int)_incomingData.data[(k * 2) + 7] & 0x7F) * signL;
+				int signL = (_incomingData->data[(k * 2) + 7] >> 7 & 1) ? -1 : 1;
+				int tempL = ((int)_incomingData->data[(k * 2) + 7] & 0x7F) * signL;
 
-				_weather[k].high = tempH;
-				_weather[k].low = tempL;
+				updateField(_weatherHigh[k], (int16_t)tempH, _weatherDirty, WEATHER_DIRTY_HIGH_LOW);
+				updateField(_weatherLow[k], (int16_t)tempL, _weatherDirty, WEATHER_DIRTY_HIGH_LOW);
 			}
+			markState(STATE_WEATHER);
 			if (configurationReceivedCallback != nullptr)
 			{
 				configurationReceivedCallback(CF_WEATHER, 2, 0);
@@ -1769,19 +7235,22 @@ void ChronosESP32::dataReceived()
 		break;
 		case 0x8A:
 		{
-			_weather[0].uv = _incomingData.data[6];
-			_weather[0].pressure = (_incomingData.data[7] * 256) + _incomingData.data[8];
+			updateField(_weatherUv[0], (uint8_t)_incomingData->data[6], _weatherDirty, WEATHER_DIRTY_UV);
+			updateField(_weatherPressure[0], (uint16_t)((_incomingData->data[7] * 256) + _incomingData->data[8]), _weatherDirty, WEATHER_DIRTY_PRESSURE);
+			markState(STATE_WEATHER);
 		}
 		break;
 		case 0x7F:
 			{
-				uint8_t hour = _incomingData.data[7];
-				uint8_t minute = _incomingData.data[8];
-				uint8_t hour2 = _incomingData.data[9];
-				uint8_t minute2 = _incomingData.data[10];
-				_sleepEnabled = _incomingData.data[6];
+				uint8_t hour = _incomingData->data[7];
+				uint8_t minute = _incomingData->data[8];
+				uint8_t hour2 = _incomingData->data[9];
+				uint8_t minute2 = _incomingData->data[10];
+				_sleepEnabled = _incomingData->data[6];
 				_sleepStart = (hour * 60) + minute;
 				_sleepEnd = (hour2 * 60) + minute2;
+				scheduleReminders();
+				markState(STATE_SETTINGS);
 				if (configurationReceivedCallback != nullptr)
 				{
 					uint32_t slp = ((uint32_t)hour << 24) | ((uint32_t)minute << 16) | ((uint32_t)hour2 << 8) | ((uint32_t)minute2);
@@ -1791,13 +7260,13 @@ void ChronosESP32::dataReceived()
 			break;
 		case 0x91:
 
-			if (_incomingData.data[3] == 0xFE)
+			if (_incomingData->data[3] == 0xFE)
 			{
-				_phoneInfo.isCharging = _incomingData.data[6] == 1;
-				_phoneInfo.batteryLevel = _incomingData.data[7];
+				updateField(_phoneInfo.isCharging, _incomingData->data[6] == 1, _phoneDirty, PHONE_DIRTY_CHARGING);
+				updateField(_phoneInfo.batteryLevel, _incomingData->data[7], _phoneDirty, PHONE_DIRTY_BATTERY);
 				if (configurationReceivedCallback != nullptr)
 				{
-					configurationReceivedCallback(CF_PBAT, _incomingData.data[6], _phoneInfo.batteryLevel);
+					configurationReceivedCallback(CF_PBAT, _incomingData->data[6], _phoneInfo.batteryLevel);
 				}
 			}
 
@@ -1808,7 +7277,9 @@ void ChronosESP32::dataReceived()
 				configurationReceivedCallback(CF_TIME, 0, 0);
 			}
 
-			this->setTime(_incomingData.data[13], _incomingData.data[12], _incomingData.data[11], _incomingData.data[10], _incomingData.data[9], _incomingData.data[7] * 256 + _incomingData.data[8]);
+			this->setTime(_incomingData->data[13], _incomingData->data[12], _incomingData->data[11], _incomingData->data[10], _incomingData->data[9], _incomingData->data[7] * 256 + _incomingData->data[8]);
+			armTimer(TIMER_ALARM, 0);
+			scheduleReminders();
 
 			if (configurationReceivedCallback != nullptr)
 			{
@@ -1818,36 +7289,24 @@ void ChronosESP32::dataReceived()
 		case 0x9C:
 			if (configurationReceivedCallback != nullptr)
 			{
-				uint32_t color = ((uint32_t)_incomingData.data[5] << 16) | ((uint32_t)_incomingData.data[6] << 8) | (uint32_t)_incomingData.data[7];
-				uint32_t select = ((uint32_t)(_incomingData.data[8]) << 16) | (uint32_t)_incomingData.data[9];
+				uint32_t color = ((uint32_t)_incomingData->data[5] << 16) | ((uint32_t)_incomingData->data[6] << 8) | (uint32_t)_incomingData->data[7];
+				uint32_t select = ((uint32_t)(_incomingData->data[8]) << 16) | (uint32_t)_incomingData->data[9];
 				configurationReceivedCallback(CF_FONT, color, select);
 			}
 			break;
 		case 0x9D:
-			if (_incomingData.data[3] == 0xFE)
+			if (_incomingData->data[3] == 0xFE)
 			{
-				switch (_incomingData.data[5])
+				switch (_incomingData->data[5])
 				{
 				case 0x80:
 				{
-					_musicInfo.state = _incomingData.data[6];
-					_musicInfo.backgroundColor = ((uint32_t)_incomingData.data[7] << 16) | ((uint32_t)_incomingData.data[8] << 8) | (uint32_t)_incomingData.data[9];
-					_musicInfo.textColor = ((uint32_t)_incomingData.data[10] << 16) | ((uint32_t)_incomingData.data[11] << 8) | (uint32_t)_incomingData.data[12];
+					updateField(_musicInfo.state, _incomingData->data[6], _musicDirty, MUSIC_DIRTY_STATE);
+					updateField(_musicInfo.backgroundColor, ((uint32_t)_incomingData->data[7] << 16) | ((uint32_t)_incomingData->data[8] << 8) | (uint32_t)_incomingData->data[9], _musicDirty, MUSIC_DIRTY_BG_COLOR);
+					updateField(_musicInfo.textColor, ((uint32_t)_incomingData->data[10] << 16) | ((uint32_t)_incomingData->data[11] << 8) | (uint32_t)_incomingData->data[12], _musicDirty, MUSIC_DIRTY_TEXT_COLOR);
 					int i = 13;
-					_musicInfo.appName = "";
-					while (_incomingData.data[i] != 0 && i < len)
-					{
-						_musicInfo.appName += char(_incomingData.data[i]);
-						i++;
-					}
-					i++;
-
-					_musicInfo.packageName = "";
-					while (_incomingData.data[i] != 0 && i < len)
-					{
-						_musicInfo.packageName += char(_incomingData.data[i]);
-						i++;
-					}
+					updateField(_musicInfo.appName, readString(i, len), _musicDirty, MUSIC_DIRTY_APP_NAME);
+					updateField(_musicInfo.packageName, readString(i, len), _musicDirty, MUSIC_DIRTY_PACKAGE_NAME);
 
 					if (configurationReceivedCallback != nullptr)
 					{
@@ -1857,13 +7316,8 @@ void ChronosESP32::dataReceived()
 				break;
 				case 0x81:
 				{
-					_musicInfo.title = "";
 					int i = 7;
-					while (_incomingData.data[i] != 0 && i < len)
-					{
-						_musicInfo.title += char(_incomingData.data[i]);
-						i++;
-					}
+					updateField(_musicInfo.title, readString(i, len), _musicDirty, MUSIC_DIRTY_TITLE);
 					if (configurationReceivedCallback != nullptr)
 					{
 						configurationReceivedCallback(CF_MUSIC, 1, _musicInfo.state);
@@ -1872,13 +7326,8 @@ void ChronosESP32::dataReceived()
 				break;
 				case 0x82:
 				{
-					_musicInfo.artist = "";
 					int i = 7;
-					while (_incomingData.data[i] != 0 && i < len)
-					{
-						_musicInfo.artist += char(_incomingData.data[i]);
-						i++;
-					}
+					updateField(_musicInfo.artist, readString(i, len), _musicDirty, MUSIC_DIRTY_ARTIST);
 					if (configurationReceivedCallback != nullptr)
 					{
 						configurationReceivedCallback(CF_MUSIC, 2, _musicInfo.state);
@@ -1891,23 +7340,24 @@ void ChronosESP32::dataReceived()
 			break;
 		case 0xA2:
 		{
-			int pos = _incomingData.data[5];
+			int pos = _incomingData->data[5];
 			_contacts[pos].name = "";
 			for (int i = 6; i < len; i++)
 			{
-				_contacts[pos].name += (char)_incomingData.data[i];
+				_contacts[pos].name += (char)_incomingData->data[i];
 			}
+			markState(STATE_CONTACTS);
 		}
 		break;
 		case 0xA3:
 		{
-			int pos = _incomingData.data[5];
-			int nSize = _incomingData.data[6];
+			int pos = _incomingData->data[5];
+			int nSize = _incomingData->data[6];
 			_contacts[pos].number = "";
 			for (int i = 7; i < len; i++)
 			{
 				char digit[3];
-				sprintf(digit, "%02X", _incomingData.data[i]);
+				sprintf(digit, "%02X", _incomingData->data[i]);
 				// reverse characters
 				digit[2] = digit[0]; // save digit at 0 to 2
 				digit[0] = digit[1]; // swap 1 to 0
@@ -1917,6 +7367,7 @@ void ChronosESP32::dataReceived()
 			}
 			_contacts[pos].number.replace("A", "+");
 			_contacts[pos].number = _contacts[pos].number.substring(0, nSize);
+			markState(STATE_CONTACTS);
 
 			if (configurationReceivedCallback != nullptr && pos == (_contactSize - 1))
 			{
@@ -1925,32 +7376,34 @@ void ChronosESP32::dataReceived()
 		}
 		break;
 		case 0xA5:
-			_sosContact = _incomingData.data[6];
-			_contactSize = _incomingData.data[7];
+			_sosContact = _incomingData->data[6];
+			_contactSize = _incomingData->data[7];
+			markState(STATE_CONTACTS);
 			if (configurationReceivedCallback != nullptr)
 			{
 				configurationReceivedCallback(CF_CONTACT, 0, uint32_t(_sosContact << 8) | uint32_t(_contactSize));
 			}
 			break;
 		case 0xA8:
-			if (_incomingData.data[3] == 0xFE)
+			if (_incomingData->data[3] == 0xFE)
 			{
 				// end of qr data
-				int size = _incomingData.data[5]; // number of links received
+				int size = _incomingData->data[5]; // number of links received
 				if (configurationReceivedCallback != nullptr)
 				{
 					configurationReceivedCallback(CF_QR, 1, size);
 				}
 			}
-			if (_incomingData.data[3] == 0xFF)
+			if (_incomingData->data[3] == 0xFF)
 			{
 				// receiving qr data
-				int index = _incomingData.data[5]; // index of the curent link
+				int index = _incomingData->data[5]; // index of the curent link
 				_qrLinks[index] = "";			   // clear existing
 				for (int i = 6; i < len; i++)
 				{
-					_qrLinks[index] += (char)_incomingData.data[i];
+					_qrLinks[index] += (char)_incomingData->data[i];
 				}
+				markState(STATE_QR);
 				if (configurationReceivedCallback != nullptr)
 				{
 					configurationReceivedCallback(CF_QR, 0, index);
@@ -1958,48 +7411,37 @@ void ChronosESP32::dataReceived()
 			}
 			break;
 		case 0xBF:
-			if (_incomingData.data[3] == 0xFE)
+			if (_incomingData->data[3] == 0xFE)
 			{
-				_touch.state = _incomingData.data[5] == 1;
-				_touch.x = uint32_t(_incomingData.data[6] << 8) | uint32_t(_incomingData.data[7]);
-				_touch.y = uint32_t(_incomingData.data[8] << 8) | uint32_t(_incomingData.data[9]);
+				pushTouch(_incomingData->data[5] == 1,
+						  uint16_t(_incomingData->data[6] << 8) | uint16_t(_incomingData->data[7]),
+						  uint16_t(_incomingData->data[8] << 8) | uint16_t(_incomingData->data[9]));
 			}
 			break;
 		case 0xCA:
-			if (_incomingData.data[3] == 0xFE)
+			if (_incomingData->data[3] == 0xFE)
 			{
-				_phoneInfo.appCode = (_incomingData.data[6] * 256) + _incomingData.data[7];
-				_phoneInfo.appVersion = "";
+				updateField(_phoneInfo.appCode, (_incomingData->data[6] * 256) + _incomingData->data[7], _phoneDirty, PHONE_DIRTY_APP_CODE);
+				String appVersion = "";
 				for (int i = 8; i < len; i++)
 				{
-					_phoneInfo.appVersion += (char)_incomingData.data[i];
+					appVersion += (char)_incomingData->data[i];
 				}
+				updateField(_phoneInfo.appVersion, appVersion, _phoneDirty, PHONE_DIRTY_APP_VERSION);
 				if (configurationReceivedCallback != nullptr)
 				{
 					configurationReceivedCallback(CF_APP, _phoneInfo.appCode, 0);
 				}
-				_sendESP = true;
+				armTimer(TIMER_ESP, 0);
 			}
 			break;
 		case 0xCB:
-			if (_incomingData.data[3] == 0xFE)
+			if (_incomingData->data[3] == 0xFE)
 			{
-				_phoneInfo.sdkVersion = (_incomingData.data[6] * 256) + _incomingData.data[7];
-				_phoneInfo.manufacturer = "";
+				updateField(_phoneInfo.sdkVersion, (_incomingData->data[6] * 256) + _incomingData->data[7], _phoneDirty, PHONE_DIRTY_SDK_VERSION);
 				int i = 8;
-				while (_incomingData.data[i] != 0 && i < len)
-				{
-					_phoneInfo.manufacturer += (char)_incomingData.data[i];
-					i++;
-				}
-				i++;
-
-				_phoneInfo.model = "";
-				while (_incomingData.data[i] != 0 && i < len)
-				{
-					_phoneInfo.model += (char)_incomingData.data[i];
-					i++;
-				}
+				updateField(_phoneInfo.manufacturer, readString(i, len), _phoneDirty, PHONE_DIRTY_MANUFACTURER);
+				updateField(_phoneInfo.model, readString(i, len), _phoneDirty, PHONE_DIRTY_MODEL);
 
 				if (configurationReceivedCallback != nullptr)
 				{
@@ -2008,113 +7450,116 @@ void ChronosESP32::dataReceived()
 			}
 			break;
 		case 0xCC:
-			if (_incomingData.data[3] == 0xFE)
+			if (_incomingData->data[3] == 0xFE)
 			{
-				setChunkedTransfer(_incomingData.data[5] != 0x00);
+				// only for the central that asked, later connections start with the last setting
+				conn.chunked = _incomingData->data[5] != 0x00;
+				_chunked = conn.chunked;
 			}
 			break;
 		case 0xEE:
-			if (_incomingData.data[3] == 0xFE)
+			if (_incomingData->data[3] == 0xFE)
 			{
-				// navigation icon data received
-				uint8_t pos = _incomingData.data[6];
-				uint32_t crc = uint32_t(_incomingData.data[7] << 24) | uint32_t(_incomingData.data[8] << 16) | uint32_t(_incomingData.data[9] << 8) | uint32_t(_incomingData.data[10]);
-				for (int i = 0; i < 96; i++)
+				// navigation icon data received, 3 chunks of 96 bytes
+				uint8_t pos = _incomingData->data[6];
+				uint32_t crc = uint32_t(_incomingData->data[7] << 24) | uint32_t(_incomingData->data[8] << 16) | uint32_t(_incomingData->data[9] << 8) | uint32_t(_incomingData->data[10]);
+				if (pos >= 3 || len < 11 + 96)
+				{
+					break;
+				}
+				if (crc != _navIconPending)
+				{
+					// chunks of a new icon, discard the partial one
+					_navIconPending = crc;
+					_navIconMask = 0;
+				}
+				if (_navIconMask == 0)
+				{
+					// collect in the buffer that is neither the latest icon nor the one the UI may be drawing
+					portENTER_CRITICAL(&_navIconMux);
+					_navIconBack = 0;
+					while (_navIconBack == _navIconFront || _navIconBack == _navIconReader)
+					{
+						_navIconBack++;
+					}
+					portEXIT_CRITICAL(&_navIconMux);
+				}
+
+				uint8_t back = _navIconBack;
+				memcpy(_navIcons[back] + (96 * pos), _incomingData->data + 11, 96);
+				_navIconMask |= 1 << pos;
+				if (_navIconMask != 0x07)
+				{
+					break;
+				}
+				_navIconMask = 0;
+
+				if (_navIconCheck && crc32(_navIcons[back], CS_ICON_DATA_SIZE) != crc)
 				{
-					_navigation.icon[i + (96 * pos)] = _incomingData.data[11 + i];
+					_navIconErrors++;
+					break;
+				}
+				if (memcmp(_navIcons[back], _navIcons[_navIconFront], CS_ICON_DATA_SIZE) != 0)
+				{
+					_navIconCRCs[back] = crc;
+					portENTER_CRITICAL(&_navIconMux);
+					_navIconFront = back;
+					portEXIT_CRITICAL(&_navIconMux);
+					markDirty(_navigationDirty, NAV_DIRTY_ICON);
 				}
+				_navIconCRCs[_navIconFront] = crc;
+				memcpy(_navigation.icon, _navIcons[_navIconFront], CS_ICON_DATA_SIZE);
 
 				if (configurationReceivedCallback != nullptr)
 				{
-					configurationReceivedCallback(CF_NAV_ICON, pos, crc);
+					configurationReceivedCallback(CF_NAV_ICON, 2, crc);
 				}
 			}
 			break;
 		case 0xEF:
-			if (_incomingData.data[3] == 0xFE)
+			if (_incomingData->data[3] == 0xFE)
 			{
 				// navigation data received
-				if (_incomingData.data[5] == 0x00)
+				if (_incomingData->data[5] == 0x00)
 				{
-					_navigation.active = false;
-					_navigation.eta = "Navigation";
-					_navigation.title = "Chronos";
-					_navigation.duration = "Inactive";
-					_navigation.distance = "";
-					_navigation.speed = "";
-					_navigation.directions = "Start navigation on Google maps";
-					_navigation.hasIcon = false;
-					_navigation.isNavigation = false;
-					_navigation.iconCRC = 0xFFFFFFFF;
+					updateField(_navigation.active, false, _navigationDirty, NAV_DIRTY_ACTIVE);
+					updateField(_navigation.eta, String("Navigation"), _navigationDirty, NAV_DIRTY_ETA);
+					updateField(_navigation.title, String("Chronos"), _navigationDirty, NAV_DIRTY_TITLE);
+					updateField(_navigation.duration, String("Inactive"), _navigationDirty, NAV_DIRTY_DURATION);
+					updateField(_navigation.distance, String(""), _navigationDirty, NAV_DIRTY_DISTANCE);
+					updateField(_navigation.speed, String(""), _navigationDirty, NAV_DIRTY_SPEED);
+					updateField(_navigation.directions, String("Start navigation on Google maps"), _navigationDirty, NAV_DIRTY_DIRECTIONS);
+					updateField(_navigation.hasIcon, false, _navigationDirty, NAV_DIRTY_HAS_ICON);
+					updateField(_navigation.isNavigation, false, _navigationDirty, NAV_DIRTY_TYPE);
+					updateField(_navigation.iconCRC, (uint32_t)0xFFFFFFFF, _navigationDirty, NAV_DIRTY_ICON_CRC);
 				}
-				else if (_incomingData.data[5] == 0xFF)
+				else if (_incomingData->data[5] == 0xFF)
 				{
-					_navigation.active = true;
-					_navigation.title = "Chronos";
-					_navigation.duration = "Disabled";
-					_navigation.distance = "";
-					_navigation.speed = "";
-					_navigation.eta = "Navigation";
-					_navigation.directions = "Check Chronos app settings";
-					_navigation.hasIcon = false;
-					_navigation.isNavigation = false;
-					_navigation.iconCRC = 0xFFFFFFFF;
+					updateField(_navigation.active, true, _navigationDirty, NAV_DIRTY_ACTIVE);
+					updateField(_navigation.title, String("Chronos"), _navigationDirty, NAV_DIRTY_TITLE);
+					updateField(_navigation.duration, String("Disabled"), _navigationDirty, NAV_DIRTY_DURATION);
+					updateField(_navigation.distance, String(""), _navigationDirty, NAV_DIRTY_DISTANCE);
+					updateField(_navigation.speed, String(""), _navigationDirty, NAV_DIRTY_SPEED);
+					updateField(_navigation.eta, String("Navigation"), _navigationDirty, NAV_DIRTY_ETA);
+					updateField(_navigation.directions, String("Check Chronos app settings"), _navigationDirty, NAV_DIRTY_DIRECTIONS);
+					updateField(_navigation.hasIcon, false, _navigationDirty, NAV_DIRTY_HAS_ICON);
+					updateField(_navigation.isNavigation, false, _navigationDirty, NAV_DIRTY_TYPE);
+					updateField(_navigation.iconCRC, (uint32_t)0xFFFFFFFF, _navigationDirty, NAV_DIRTY_ICON_CRC);
 				}
-				else if (_incomingData.data[5] == 0x80)
+				else if (_incomingData->data[5] == 0x80)
 				{
-					_navigation.active = true;
-					_navigation.hasIcon = _incomingData.data[6] == 1;
-					_navigation.isNavigation = _incomingData.data[7] == 1;
-					_navigation.iconCRC = uint32_t(_incomingData.data[8] << 24) | uint32_t(_incomingData.data[9] << 16) | uint32_t(_incomingData.data[10] << 8) | uint32_t(_incomingData.data[11]);
+					updateField(_navigation.active, true, _navigationDirty, NAV_DIRTY_ACTIVE);
+					updateField(_navigation.hasIcon, _incomingData->data[6] == 1, _navigationDirty, NAV_DIRTY_HAS_ICON);
+					updateField(_navigation.isNavigation, _incomingData->data[7] == 1, _navigationDirty, NAV_DIRTY_TYPE);
+					updateField(_navigation.iconCRC, uint32_t(_incomingData->data[8] << 24) | uint32_t(_incomingData->data[9] << 16) | uint32_t(_incomingData->data[10] << 8) | uint32_t(_incomingData->data[11]), _navigationDirty, NAV_DIRTY_ICON_CRC);
 
 					int i = 12;
-					_navigation.title = "";
-					while (_incomingData.data[i] != 0 && i < len)
-					{
-						_navigation.title += char(_incomingData.data[i]);
-						i++;
-					}
-					i++;
-
-					_navigation.duration = "";
-					while (_incomingData.data[i] != 0 && i < len)
-					{
-						_navigation.duration += char(_incomingData.data[i]);
-						i++;
-					}
-					i++;
-
-					_navigation.distance = "";
-					while (_incomingData.data[i] != 0 && i < len)
-					{
-						_navigation.distance += char(_incomingData.data[i]);
-						i++;
-					}
-					i++;
-
-					_navigation.eta = "";
-					while (_incomingData.data[i] != 0 && i < len)
-					{
-						_navigation.eta += char(_incomingData.data[i]);
-						i++;
-					}
-					i++;
-
-					_navigation.directions = "";
-					while (_incomingData.data[i] != 0 && i < len)
-					{
-						_navigation.directions += char(_incomingData.data[i]);
-						i++;
-					}
-					i++;
-
-					_navigation.speed = "";
-					while (_incomingData.data[i] != 0 && i < len)
-					{
-						_navigation.speed += char(_incomingData.data[i]);
-						i++;
-					}
-					i++;
+					updateField(_navigation.title, readString(i, len), _navigationDirty, NAV_DIRTY_TITLE);
+					updateField(_navigation.duration, readString(i, len), _navigationDirty, NAV_DIRTY_DURATION);
+					updateField(_navigation.distance, readString(i, len), _navigationDirty, NAV_DIRTY_DISTANCE);
+					updateField(_navigation.eta, readString(i, len), _navigationDirty, NAV_DIRTY_ETA);
+					updateField(_navigation.directions, readString(i, len), _navigationDirty, NAV_DIRTY_DIRECTIONS);
+					updateField(_navigation.speed, readString(i, len), _navigationDirty, NAV_DIRTY_SPEED);
 				}
 				if (configurationReceivedCallback != nullptr)
 				{
@@ -2124,22 +7569,23 @@ void ChronosESP32::dataReceived()
 			break;
 		}
 	}
-	else if (_incomingData.data[0] == 0xEA)
+	else if (_incomingData->data[0] == 0xEA)
 	{
-		switch (_incomingData.data[4])
+		switch (_incomingData->data[4])
 		{
 		case 0x7E:
 			/* code */
-			switch (_incomingData.data[5])
+			switch (_incomingData->data[5])
 			{
 			case 0x01:
 			{
 				String city = "";
 				for (int c = 7; c < len; c++)
 				{
-					city += (char)_incomingData.data[c];
+					city += (char)_incomingData->data[c];
 				}
-				_weatherCity = city;
+				updateField(_weatherCity, city, _weatherDirty, WEATHER_DIRTY_CITY);
+				markState(STATE_WEATHER);
 				if (configurationReceivedCallback != nullptr)
 				{
 					configurationReceivedCallback(CF_WEATHER, 0, 1);
@@ -2148,36 +7594,53 @@ void ChronosESP32::dataReceived()
 			break;
 			case 0x02:
 			{
-				int size = _incomingData.data[6];
-				int hour = _incomingData.data[7];
-				for (int z = 0; z < size; z++)
+				int size = _incomingData->data[6];
+				int hour = _incomingData->data[7];
+
+				TimeSnapshot now = captureTime();
+				bool synced = now.epoch >= CS_EPOCH_VALID;
+				unsigned long midnight = now.epoch - ((now.minuteOfDay * 60UL) + now.second);
+				unsigned long start = midnight + (hour * 3600UL);
+				if (hour + 12 < now.hour)
 				{
-					if (hour + z >= CS_FORECAST_SIZE)
+					start += 86400UL; // list starts after midnight
+				}
+				_forecastReceived = now.epoch;
+
+				for (int z = 0; z < size && z < CS_FORECAST_SIZE; z++)
+				{
+					if (13 + (6 * z) >= len || (!synced && hour + z >= CS_FORECAST_SIZE))
 					{
 						break;
 					}
-					int icon = _incomingData.data[8 + (6 * z)] >> 4;
-					int sign = (_incomingData.data[8 + (6 * z)] & 1) ? -1 : 1;
-					int temp = ((int)_incomingData.data[9 + (6 * z)]) * sign;
-
-					_hourlyForecast[hour + z].day = this->getDayofYear();
-					_hourlyForecast[hour + z].hour = hour + z;
-					_hourlyForecast[hour + z].wind = (_incomingData.data[10 + (6 * z)] * 256) + _incomingData.data[11 + (6 * z)];
-					_hourlyForecast[hour + z].humidity = _incomingData.data[12 + (6 * z)];
-					_hourlyForecast[hour + z].uv = _incomingData.data[13 + (6 * z)];
-					_hourlyForecast[hour + z].icon = icon;
-					_hourlyForecast[hour + z].temp = temp;
+					int icon = _incomingData->data[8 + (6 * z)] >> 4;
+					int sign = (_incomingData->data[8 + (6 * z)] & 1) ? -1 : 1;
+					int temp = ((int)_incomingData->data[9 + (6 * z)]) * sign;
+
+					// hours past midnight continue into the next day
+					unsigned long time = start + (z * 3600UL);
+					int days = (time - midnight) / 86400UL;
+					int slot = synced ? getForecastSlot(time) : hour + z;
+					updateField(_forecastTime[slot], synced ? time : 0UL, _weatherDirty, WEATHER_DIRTY_FORECAST);
+					updateField(_forecastDay[slot], (uint16_t)(now.dayOfYear + days), _weatherDirty, WEATHER_DIRTY_FORECAST);
+					updateField(_forecastHour[slot], (uint8_t)((hour + z) % 24), _weatherDirty, WEATHER_DIRTY_FORECAST);
+					updateField(_forecastWind[slot], (uint16_t)((_incomingData->data[10 + (6 * z)] * 256) + _incomingData->data[11 + (6 * z)]), _weatherDirty, WEATHER_DIRTY_FORECAST);
+					updateField(_forecastHumidity[slot], (uint8_t)_incomingData->data[12 + (6 * z)], _weatherDirty, WEATHER_DIRTY_FORECAST);
+					updateField(_forecastUv[slot], (uint8_t)_incomingData->data[13 + (6 * z)], _weatherDirty, WEATHER_DIRTY_FORECAST);
+					updateField(_forecastIcon[slot], (uint8_t)icon, _weatherDirty, WEATHER_DIRTY_FORECAST);
+					updateField(_forecastTemp[slot], (int16_t)temp, _weatherDirty, WEATHER_DIRTY_FORECAST);
 				}
+				markState(STATE_WEATHER);
 			}
 			break;
-			} /* END switch (_incomingData.data[5]) */
+			} /* END switch (_incomingData->data[5]) */
 			break;
 
 		case 0x7F:
-			if (_incomingData.data[3] == 0xFE)
+			if (_incomingData->data[3] == 0xFE)
 			{
-				uint8_t payloadLen = _incomingData.data[6];
-				const uint8_t *payload = &_incomingData.data[7];
+				uint8_t payloadLen = _incomingData->data[6];
+				const uint8_t *payload = &_incomingData->data[7];
 
 				// Read coordinates (Little Endian)
 				float latitude;
@@ -2206,14 +7669,85 @@ void ChronosESP32::dataReceived()
 					country += (char)payload[index++];
 
 				// Assign to struct
-				_weatherLocation.city = city;
-				_weatherLocation.region = region;
-				_weatherLocation.country = country;
-				_weatherLocation.latitude = latitude;
-				_weatherLocation.longitude = longitude;
+				updateField(_weatherLocation.city, city, _weatherDirty, WEATHER_DIRTY_LOCATION);
+				updateField(_weatherLocation.region, region, _weatherDirty, WEATHER_DIRTY_LOCATION);
+				updateField(_weatherLocation.country, country, _weatherDirty, WEATHER_DIRTY_LOCATION);
+				updateField(_weatherLocation.latitude, latitude, _weatherDirty, WEATHER_DIRTY_LOCATION);
+				updateField(_weatherLocation.longitude, longitude, _weatherDirty, WEATHER_DIRTY_LOCATION);
+				markState(STATE_WEATHER);
 			}
 
 			break;
 		}
 	}
 }
+
+/*!
+	@brief  open a connection context for a new peer
+	@param  mtu
+			largest packet the peer accepts
+	@return handle of the peer, BLE_HS_CONN_HANDLE_NONE if the transport is not attached or every context is in use
+*/
+uint16_t ChronosTransport::peerConnected(uint16_t mtu)
+{
+	if (_watch == nullptr)
+	{
+		return BLE_HS_CONN_HANDLE_NONE;
+	}
+	// wired peers need no subscription
+	return _watch->openConnection(BLE_HS_CONN_HANDLE_NONE, mtu, this, true);
+}
+
+/*!
+	@brief  release the connection context of a peer
+	@param  handle
+			handle returned by peerConnected
+*/
+void ChronosTransport::peerDisconnected(uint16_t handle)
+{
+	if (_watch != nullptr)
+	{
+		_watch->closeConnection(handle);
+	}
+}
+
+/*!
+	@brief  pass one packet to the protocol engine, as a BLE write of the same bytes
+	@param  handle
+			handle returned by peerConnected
+	@param  data
+			packet data
+	@param  length
+			packet length
+*/
+void ChronosTransport::received(uint16_t handle, const uint8_t *data, size_t length)
+{
+	if (_watch != nullptr)
+	{
+		_watch->packetReceived(handle, data, length);
+	}
+}
+
+/*!
+	@brief  notify one packet to a central
+	@param  handle
+			connection handle
+	@param  data
+			packet data
+	@param  length
+			packet length
+*/
+bool ChronosBleTransport::write(uint16_t handle, const uint8_t *data, size_t length)
+{
+	return _tx != nullptr && _tx->notify(data, length, handle);
+}
+
+/*!
+	@brief  get the negotiated MTU of a central
+	@param  handle
+			connection handle
+*/
+uint16_t ChronosBleTransport::getMTU(uint16_t handle)
+{
+	return BLEDevice::getServer()->getPeerInfoByHandle(handle).getMTU();
+}
@@ -36,6 +36,10 @@
 #include <Arduino.h>
 #include <NimBLEDevice.h>
 #include <ESP32Time.h>
+#include <esp_partition.h>
+#include <esp_ota_ops.h>
+#include <Preferences.h>
+#include <esp_system.h>
 
 #define CS_VERSION_MAJOR 1
 #define CS_VERSION_MINOR 9
@@ -51,14 +55,86 @@
 #define CS_ALARM_SIZE 8
 #define CS_DATA_SIZE 512
 #define CS_FORECAST_SIZE 24
+#define CS_EPOCH_VALID 1577836800 // earlier times (before 2020) are treated as not synced
 #define CS_QR_SIZE 9
 #define CS_ICON_SIZE 48
 #define CS_ICON_DATA_SIZE (CS_ICON_SIZE * CS_ICON_SIZE) / 8
 #define CS_CONTACTS_SIZE 255
 
+#ifndef CS_TOUCH_SIZE
+#define CS_TOUCH_SIZE 16 // remote touch events kept until read
+#endif
+
+#ifndef CS_TIMER_SIZE
+#define CS_TIMER_SIZE 8 // application timers available through startTimer()
+#endif
+#define CS_NO_DEADLINE UINT32_MAX // returned by loop() and getTimeToNextEvent() when no timer is running
+
+#define CS_INFO_DELAY 3000	  // delay after subscribing before sending watch info (ms)
+#define CS_WARM_INFO_DELAY 500 // shorter delay for the first connection after a warm wake (ms)
+#define CS_FIND_TIMEOUT 30000 // find phone auto cancel (ms)
+#define CS_RX_TIMEOUT 2000	  // incomplete incoming packets are dropped after this (ms)
+
+#ifndef CS_FRAME_CACHE_SIZE
+#define CS_FRAME_CACHE_SIZE 16 // number of frame hashes kept for duplicate suppression
+#endif
+
+#ifndef CS_LINK_IDLE_TIMEOUT
+#define CS_LINK_IDLE_TIMEOUT 5000 // inactivity before requesting the slow connection interval (ms)
+#endif
+#define CS_LINK_BURST 4			  // packets within CS_LINK_BURST_WINDOW that request the fast connection interval
+#define CS_LINK_BURST_WINDOW 1000 // (ms)
+#define CS_LINK_REQUEST_TIMEOUT 30000 // a request without a parameter update is sent again after this (ms)
+
+#ifndef CS_ICON_CACHE_SIZE
+#define CS_ICON_CACHE_SIZE 4 // converted navigation icons kept on the heap
+#endif
+
+#ifndef CS_WATCHFACE_PARTITION
+#define CS_WATCHFACE_PARTITION "watchface" // label of the data partition that receives watchfaces
+#endif
+#define CS_BULK_BUFFER 4096	 // bulk transfer buffer (one flash sector), two are allocated during a transfer
+#define CS_OTA_RESUME_TIMEOUT 120000 // an interrupted firmware update can be resumed for this long (ms)
+#define CS_BULK_QUIT_TIMEOUT 1000	 // wait for the flash writer to finish its chunk when the instance is destroyed (ms)
+
+#ifndef CS_HEALTH_PARTITION
+#define CS_HEALTH_PARTITION "health" // label of the data partition that holds the health log
+#endif
+#define CS_HEALTH_SECTOR 4096		// log unit, erased when the ring wraps
+#define CS_HEALTH_MAGIC 0x474C4843	// marks a used log sector
+#define CS_HEALTH_BATCH 16			// records read from flash at a time while syncing
+#define CS_HEALTH_CHECKPOINT 32		// records sent between persisted watermarks
+#define CS_HEALTH_PACE 50			// ms between records sent by the sync
+#define CS_HEALTH_WINDOW 10			// minutes in the rolling health window
+#define CS_HEALTH_HOUR_QUEUE 4		// finished hours kept until loop() delivers them
+#define CS_REALTIME_INTERVAL 1000	// default transmit interval of the realtime stream (ms)
+#define CS_REALTIME_MIN_INTERVAL 200 // realtime frames are not sent faster than this (ms)
+
+#ifndef CS_STATE_NAMESPACE
+#define CS_STATE_NAMESPACE "chronos" // NVS namespace of the saved state
+#endif
+#define CS_STATE_VERSION 2		   // saved sections with another version are ignored
+#define CS_STATE_SAVE_DELAY 10000 // changes are saved this long after the last one (ms)
+
+#define CS_RTC_MAGIC 0x43525443 // marks valid state in RTC memory
+#define CS_RTC_NOTIF_SIZE 3	 // latest notification headers kept across deep sleep
+#define CS_RTC_TITLE_SIZE 32	 // title bytes kept for each of them
+
+#define CS_ADV_POWER_KEEP 127 // leave the TX power unchanged for an advertising phase
+
 #define CS_SERVICE_UUID "6e400001-b5a3-f393-e0a9-e50e24dcca9e"
 #define CS_CHARACTERISTIC_UUID_RX "6e400002-b5a3-f393-e0a9-e50e24dcca9e"
 #define CS_CHARACTERISTIC_UUID_TX "6e400003-b5a3-f393-e0a9-e50e24dcca9e"
+#ifndef CS_MAX_CONNECTIONS
+#define CS_MAX_CONNECTIONS CONFIG_BT_NIMBLE_MAX_CONNECTIONS // centrals with their own protocol state
+#endif
+#ifndef CS_MAX_INSTANCES
+#define CS_MAX_INSTANCES 4 // running instances that can share the BLE server
+#endif
+
+#define CS_MAX_TRANSPORTS 2			// wired transports attached to one instance
+#define CS_TRANSPORT_HANDLE 0xF000	// connection handles of wired peers start here, above the BLE range
+#define CS_TRANSPORT_POLL 10		// longest wait loop() returns while wired transports are attached (ms)
 
 enum Control
 {
@@ -98,6 +174,7 @@ struct Weather
 	int low;
 	int pressure;
 	int uv;
+	unsigned long time; // start of the day (same base as getEpoch), 0 if received before the time was synced
 };
 
 /**
@@ -130,13 +207,186 @@ struct HourlyForecast
 	int uv;		  // uv index
 	int humidity; // %
 	int wind;	  // wind speed km/h
+	unsigned long time; // start of the hour (same base as getEpoch), 0 if received before the time was synced
 };
 
 struct ChronosTimer
 {
-	unsigned long time;
-	long duration = 5000;
-	bool active;
+	unsigned long time;				 // start time (millis)
+	long duration = 5000;			 // time to expiry (ms)
+	bool active = false;			 // running state
+	bool repeat = false;			 // restart after expiry
+	void (*callback)(int) = nullptr; // application timer callback, receives the timer id
+};
+
+enum LinkMode
+{
+	LINK_DEFAULT = 0, // parameters chosen by the phone, used until the first request
+	LINK_FAST,		  // short interval for bulk transfers
+	LINK_SLOW,		  // long interval with slave latency while idle
+};
+
+struct LinkParams
+{
+	uint16_t minInterval; // 1.25 ms units
+	uint16_t maxInterval; // 1.25 ms units
+	uint16_t latency;	  // connection events the watch may skip
+	uint16_t timeout;	  // supervision timeout, 10 ms units
+};
+
+struct LinkStats
+{
+	uint32_t defaultTime;  // ms connected with an interval outside both modes
+	uint32_t fastTime;	   // ms connected with a granted LINK_FAST interval
+	uint32_t slowTime;	   // ms connected with a granted LINK_SLOW interval
+	uint32_t fastRequests; // number of LINK_FAST requests sent
+	uint32_t slowRequests; // number of LINK_SLOW requests sent
+	uint16_t interval;	   // interval granted by the phone, 1.25 ms units
+	uint16_t latency;	   // latency granted by the phone
+};
+
+enum AdvPhase
+{
+	ADV_OFF = 0, // connected or not running
+	ADV_FAST,	 // after begin() or a disconnect, for quick reconnection
+	ADV_SLOW,	 // background advertising once the fast phase ends
+};
+
+enum AdvPreset
+{
+	ADV_CONSTANT = 0, // stack default interval, never slows down
+	ADV_BALANCED,	  // 30 ms for 30 s, then 1022.5 ms
+	ADV_LOW_POWER,	  // 100 ms for 10 s, then 2000 ms at reduced TX power
+};
+
+struct AdvProfile
+{
+	uint16_t fastInterval; // 0.625 ms units, 0 for the stack default
+	uint16_t slowInterval; // 0.625 ms units, 0 for the stack default
+	uint32_t fastDuration; // ms of fast advertising, 0 never switches to slow
+	int8_t fastPower;	   // dBm, CS_ADV_POWER_KEEP for unchanged
+	int8_t slowPower;	   // dBm, CS_ADV_POWER_KEEP for unchanged
+};
+
+struct AdvStats
+{
+	uint32_t fastTime;	 // ms spent in ADV_FAST
+	uint32_t slowTime;	 // ms spent in ADV_SLOW
+	uint32_t fastStarts; // number of fast phases started
+	uint32_t slowStarts; // number of slow phases started
+};
+
+enum IconFormat
+{
+	ICON_RGB565 = 0, // 48x48, 2 bytes per pixel (native byte order)
+	ICON_ALPHA8,	 // 48x48, 1 byte per pixel (0x00 or 0xFF)
+	ICON_RGB565_2X,	 // 96x96, 2 bytes per pixel (native byte order)
+	ICON_ALPHA8_2X,	 // 96x96, 1 byte per pixel (0x00 or 0xFF)
+};
+
+struct ChronosIcon
+{
+	uint32_t crc;		 // icon CRC from the app
+	uint16_t color;		 // RGB565 foreground
+	uint16_t background; // RGB565 background
+	uint8_t format;		 // IconFormat
+	uint32_t used;		 // last use, for LRU eviction
+	size_t size;		 // allocated bytes
+	uint8_t *data;		 // converted pixels, nullptr when the slot is empty
+};
+
+struct OtaStats
+{
+	uint32_t size;		 // image size
+	uint32_t received;	 // bytes received
+	uint32_t elapsed;	 // ms from start to completion, or until now while running
+	uint32_t writeTime;	 // ms spent in esp_ota_write
+	uint32_t resumes;	 // reconnects that continued the transfer
+	uint32_t rewinds;	 // out of order packets the app had to resend from
+	float throughput;	 // received bytes per second
+};
+
+struct DateTime
+{
+	uint8_t second;
+	uint8_t minute;
+	uint8_t hour;
+	uint8_t day;
+	uint8_t month;
+	uint32_t year;
+};
+
+enum HealthType
+{
+	HEALTH_STEPS = 0,	   // a = steps, b = calories
+	HEALTH_HEART_RATE,	   // a = bpm
+	HEALTH_BLOOD_OXYGEN,   // a = %
+	HEALTH_BLOOD_PRESSURE, // a = systolic, b = diastolic
+	HEALTH_TEMPERATURE,	   // a = 0.01 degrees celsius
+	HEALTH_SLEEP,		   // a = minutes, b = SleepType
+	HEALTH_TYPES,		   // number of types
+};
+
+struct HealthRecord
+{
+	HealthType type;
+	unsigned long time; // epoch (same base as getEpoch)
+	int32_t a;			// first value, see HealthType
+	int32_t b;			// second value, 0 for single value types
+};
+
+enum HealthPeriod
+{
+	PERIOD_HOUR = 0, // current hour
+	PERIOD_DAY,		 // today
+	PERIOD_WINDOW,	 // last CS_HEALTH_WINDOW minutes
+};
+
+enum RealtimeMode
+{
+	REALTIME_LATEST = 0, // send the newest sample
+	REALTIME_AVERAGE,	 // send the mean of the samples since the last frame
+};
+
+struct HealthStats
+{
+	uint32_t count; // samples
+	int64_t sum;
+	int32_t min;
+	int32_t max;
+	float mean; // sum / count, 0 without samples
+};
+
+struct HealthHour
+{
+	unsigned long time;	 // start of the hour (same base as getEpoch)
+	DateTime dateTime;	 // local start of the hour
+	uint32_t steps;		 // sum of the step samples
+	uint32_t calories;	 // sum of the calorie samples
+	uint8_t heartRate;	 // mean, 0 without samples
+	uint8_t bloodOxygen; // mean, 0 without samples
+	uint8_t systolic;	 // mean, 0 without samples
+	uint8_t diastolic;	 // mean, 0 without samples
+	int16_t temperature; // mean 0.01 degrees celsius, 0 without samples
+};
+
+struct HealthLogInfo
+{
+	uint32_t size;		  // partition bytes
+	uint32_t used;		  // bytes holding records
+	uint16_t sectors;	  // sectors in the ring
+	uint32_t erases;	  // sectors erased since boot
+	unsigned long oldest; // earliest record time, 0 if empty
+	unsigned long newest; // latest record time, 0 if empty
+};
+
+struct WakeStats
+{
+	bool warm;			// state restored from RTC memory after deep sleep
+	uint32_t sleeps;	// deep sleep cycles since power on
+	uint32_t started;	// ms from boot until begin() returned
+	uint32_t connected; // ms from boot until the phone connected, 0 until then
+	uint32_t ready;		// ms from boot until the watch info was sent, 0 until then
 };
 
 struct ChronosData
@@ -145,6 +395,14 @@ struct ChronosData
 	uint8_t data[CS_DATA_SIZE];
 };
 
+struct ChronosPeer
+{
+	uint16_t handle; // NimBLE connection handle
+	uint16_t mtu;
+	bool subscribed; // notifications enabled on the TX characteristic
+	bool chunked;	 // frames over 20 bytes are split for this central
+};
+
 struct Alarm
 {
 	uint8_t hour;
@@ -161,6 +419,32 @@ struct Setting
 	bool enabled;
 };
 
+enum ReminderType
+{
+	REMINDER_SEDENTARY = 0, // sedentary reminder (CF_SED)
+	REMINDER_WATER,			// water reminder (CF_WATER)
+};
+
+struct Reminder
+{
+	bool enabled;
+	uint16_t start;	   // start of the window, minute of the day
+	uint16_t end;	   // end of the window, minute of the day (may be lower than start)
+	uint16_t interval; // minutes between reminders
+};
+
+struct TimeSnapshot
+{
+	unsigned long epoch;  // same base as getEpoch()
+	uint8_t second;		  // 0-59
+	uint8_t minute;		  // 0-59
+	uint8_t hour;		  // 0-23
+	uint8_t dayOfWeek;	  // 0=Sun, ... 6=Sat
+	uint16_t dayOfYear;	  // 0-365
+	uint16_t minuteOfDay; // hour * 60 + minute
+	uint8_t repeatMask;	  // alarm repeat bit of dayOfWeek (Mon-Sat bits 0-5, Sun bit 6)
+};
+
 struct RemoteTouch
 {
 	bool state;
@@ -168,6 +452,21 @@ struct RemoteTouch
 	uint32_t y;
 };
 
+enum TouchType
+{
+	TOUCH_PRESS = 0, // finger down
+	TOUCH_MOVE,		 // position changed while pressed
+	TOUCH_RELEASE,	 // finger up
+};
+
+struct TouchEvent
+{
+	TouchType type;
+	uint16_t x;
+	uint16_t y;
+	unsigned long time; // millis() when the event was received
+};
+
 struct Navigation
 {
 	bool active = false;		  // whether running or not
@@ -189,16 +488,6 @@ struct Contact
 	String number;
 };
 
-struct DateTime
-{
-	uint8_t second;
-	uint8_t minute;
-	uint8_t hour;
-	uint8_t day;
-	uint8_t month;
-	uint32_t year;
-};
-
 struct PhoneInfo
 {
 	bool isCharging;
@@ -221,6 +510,66 @@ struct MusicInfo
 	String packageName;
 };
 
+enum NavigationDirty
+{
+	NAV_DIRTY_ACTIVE = 1 << 0,		  // active state changed
+	NAV_DIRTY_TYPE = 1 << 1,		  // isNavigation changed
+	NAV_DIRTY_HAS_ICON = 1 << 2,	  // hasIcon changed
+	NAV_DIRTY_DISTANCE = 1 << 3,	  // distance changed
+	NAV_DIRTY_DURATION = 1 << 4,	  // duration changed
+	NAV_DIRTY_ETA = 1 << 5,			  // eta changed
+	NAV_DIRTY_TITLE = 1 << 6,		  // title changed
+	NAV_DIRTY_DIRECTIONS = 1 << 7,	  // directions changed
+	NAV_DIRTY_SPEED = 1 << 8,		  // speed changed
+	NAV_DIRTY_ICON = 1 << 9,		  // icon data changed
+	NAV_DIRTY_ICON_CRC = 1 << 10,	  // iconCRC changed
+};
+
+enum MusicDirty
+{
+	MUSIC_DIRTY_STATE = 1 << 0,		   // playback state changed
+	MUSIC_DIRTY_TEXT_COLOR = 1 << 1,   // text color changed
+	MUSIC_DIRTY_BG_COLOR = 1 << 2,	   // background color changed
+	MUSIC_DIRTY_TITLE = 1 << 3,		   // title changed
+	MUSIC_DIRTY_ARTIST = 1 << 4,	   // artist changed
+	MUSIC_DIRTY_APP_NAME = 1 << 5,	   // app name changed
+	MUSIC_DIRTY_PACKAGE_NAME = 1 << 6, // package name changed
+};
+
+enum PhoneDirty
+{
+	PHONE_DIRTY_CHARGING = 1 << 0,	   // charging state changed
+	PHONE_DIRTY_BATTERY = 1 << 1,	   // battery level changed
+	PHONE_DIRTY_APP_CODE = 1 << 2,	   // app version code changed
+	PHONE_DIRTY_SDK_VERSION = 1 << 3,  // sdk version changed
+	PHONE_DIRTY_APP_VERSION = 1 << 4,  // app version name changed
+	PHONE_DIRTY_MANUFACTURER = 1 << 5, // manufacturer changed
+	PHONE_DIRTY_MODEL = 1 << 6,		   // model changed
+};
+
+enum WeatherDirty
+{
+	WEATHER_DIRTY_CITY = 1 << 0,	  // weather city changed
+	WEATHER_DIRTY_TIME = 1 << 1,	  // weather update time changed
+	WEATHER_DIRTY_COUNT = 1 << 2,	  // number of weather days changed
+	WEATHER_DIRTY_DAILY = 1 << 3,	  // daily icon, day or temp changed
+	WEATHER_DIRTY_HIGH_LOW = 1 << 4,  // daily high or low changed
+	WEATHER_DIRTY_UV = 1 << 5,		  // uv index changed
+	WEATHER_DIRTY_PRESSURE = 1 << 6,  // pressure changed
+	WEATHER_DIRTY_FORECAST = 1 << 7,  // hourly forecast changed
+	WEATHER_DIRTY_LOCATION = 1 << 8,  // weather location changed
+};
+
+enum StateSection
+{
+	STATE_SETTINGS = 1 << 0, // 24 hour mode, quiet hours, sleep time, reminders
+	STATE_ALARMS = 1 << 1,	 // alarms
+	STATE_CONTACTS = 1 << 2, // contacts and sos index
+	STATE_WEATHER = 1 << 3,	 // daily weather, hourly forecast, city and location
+	STATE_QR = 1 << 4,		 // qr links
+	STATE_ALL = 0x1F,
+};
+
 enum Config
 {
 	CF_TIME = 0, // time - (a 0 = before, 1 = after setting)
@@ -248,6 +597,8 @@ enum Config
 	CF_CONTACT,	 // contacts data received
 	CF_SYNCED,	 // data sync completed (esp32 can go to sleep if needed)
 	CF_MUSIC,	 // music info received (b = 0 paused, b = 1 playing)
+	CF_WATCHFACE, // watchface upload (a = 0 started, 1 progress, 2 complete, 3 failed) (b = image size or bytes received)
+	CF_OTA,		  // firmware update (a = 0 started, 1 progress, 2 complete, 3 failed, 4 resumed) (b = image size or bytes received)
 };
 
 enum HealthRequest
@@ -310,21 +661,64 @@ enum ChronosScreen
 	CF_VIEWE_28_240x320 = 0x86,  // Viewe ESP32 240x320
 };
 
+class ChronosESP32;
+
+// a link to the app, frames are exchanged as the packets a BLE central would write and receive
+class ChronosTransport
+{
+public:
+	virtual ~ChronosTransport() {}
+	virtual bool write(uint16_t handle, const uint8_t *data, size_t length) = 0; // send one packet to a peer
+	virtual uint16_t getMTU(uint16_t handle) = 0;								  // largest packet the peer accepts
+	virtual void poll() {}														  // read the input, called from loop()
+	virtual void close() {}														  // drop the peers, called from stop()
+
+protected:
+	uint16_t peerConnected(uint16_t mtu);								   // returns the handle of the new peer, BLE_HS_CONN_HANDLE_NONE if none is free
+	void peerDisconnected(uint16_t handle);
+	void received(uint16_t handle, const uint8_t *data, size_t length); // pass one packet to the protocol engine
+
+	friend class ChronosESP32;
+	ChronosESP32 *_watch = nullptr; // set by begin() or addTransport()
+};
+
+// the TX characteristic of a ChronosESP32 instance, the RX side arrives through its callbacks
+class ChronosBleTransport : public ChronosTransport
+{
+public:
+	bool write(uint16_t handle, const uint8_t *data, size_t length) override;
+	uint16_t getMTU(uint16_t handle) override;
+
+protected:
+	friend class ChronosESP32;
+	BLECharacteristic *_tx = nullptr;
+};
+
 class ChronosESP32 : public BLEServerCallbacks, public BLECharacteristicCallbacks, public ESP32Time
 {
 
 public:
 	// library
 	ChronosESP32();
+	~ChronosESP32();
 	ChronosESP32(String name, ChronosScreen screen = CF_ESP32_240x240); // set the BLE name
 	void begin();														// initializes BLE server
+	void begin(AdvProfile profile);										// initializes BLE server with an advertising profile
+	void begin(ChronosTransport &transport);							// initializes the protocol engine on a wired transport, without BLE
+	bool addTransport(ChronosTransport &transport);						// serve the app on another transport as well
 	void stop(bool clearAll = true);									// stop the BLE server
-	void loop();														// handles routine functions
+	uint32_t loop();													// handles routine functions, returns ms until the next deadline or CS_NO_DEADLINE
 	bool isRunning();													// check whether BLE server is inited and running
 	void setName(String name);											// set the BLE name (call before begin)
+	void setServiceUUID(String service, String rx = CS_CHARACTERISTIC_UUID_RX, String tx = CS_CHARACTERISTIC_UUID_TX); // GATT service of this instance (call before begin)
 	void setScreen(ChronosScreen screen);								// set the screen config (call before begin)
 	void setChunkedTransfer(bool chunked);
 	bool isSubscribed();
+	void setMaxConnections(uint8_t count); // centrals connected at once, up to CS_MAX_CONNECTIONS
+	int getConnectionCount();
+	ChronosPeer getConnection(int index);
+	uint32_t getTimeToNextEvent();			   // ms until the next internal or application deadline
+	void setLoopNotifyTask(TaskHandle_t task); // task notified when loop() has new work
 
 	// watch
 	bool isConnected();
@@ -344,18 +738,49 @@ public:
 	int getWeatherCount();
 	String getWeatherCity();
 	String getWeatherTime();
-	Weather &getWeatherAt(int index);
-	HourlyForecast &getForecastHour(int hour);
+	Weather getWeatherAt(int index);
+	HourlyForecast getForecastHour(int hour);
 	WeatherLocation &getWeatherLocation();
+	bool getWeatherOn(unsigned long time, Weather &weather);			// daily weather for the day containing time
+	bool getForecastAt(unsigned long time, HourlyForecast &forecast); // forecast for the hour containing time
+	int getForecastRange(unsigned long from, unsigned long to, HourlyForecast *forecast, int maxCount);
+	unsigned long getWeatherReceived();	 // epoch of the last daily weather, 0 if none
+	unsigned long getForecastReceived(); // epoch of the last hourly forecast, 0 if none
+	uint32_t getWeatherAge();			 // seconds since the last daily weather, UINT32_MAX if none
+	uint32_t getForecastAge();			 // seconds since the last hourly forecast, UINT32_MAX if none
+
+	// packed weather arrays, for graphs that scan one field
+	const int16_t *getWeatherTemps();		 // getWeatherCount() entries starting today
+	const int16_t *getWeatherHighs();		 // getWeatherCount() entries starting today
+	const int16_t *getWeatherLows();		 // getWeatherCount() entries starting today
+	const int16_t *getForecastTemps();		 // CS_FORECAST_SIZE entries indexed by getForecastSlot()
+	const unsigned long *getForecastTimes(); // start of the hour in each slot, 0 if empty
+	int getForecastSlot(unsigned long time); // slot of the hour containing time
 
 	// extras
 	RemoteTouch &getTouch();
+	int getTouchEventCount();
+	bool readTouchEvent(TouchEvent &event);
+	bool waitTouchEvent(TouchEvent &event, uint32_t timeout = portMAX_DELAY);
+	void clearTouchEvents();
+	uint32_t getTouchDropped();
 	String getQrAt(int index);
 	void setQr(int index, String qr);
 
 	// settings
 	bool isQuietActive();
 	bool isSleepActive();
+	bool isQuietActive(const TimeSnapshot &now);
+	bool isSleepActive(const TimeSnapshot &now);
+
+	// reminders, suppressed during quiet hours and sleep time
+	Reminder &getReminder(ReminderType type);
+	void setReminder(ReminderType type, Reminder reminder);
+	unsigned long getNextReminderTime(ReminderType type); // epoch (same base as getEpoch), 0 if none
+
+	// time snapshot, one time conversion shared by schedule queries
+	TimeSnapshot captureTime();			   // take a new snapshot now
+	const TimeSnapshot &getTimeSnapshot(); // snapshot taken by the last loop() call
 
 	// alarms
 	Alarm &getAlarm(int index);
@@ -364,9 +789,21 @@ public:
 	bool isAlarmActive(Alarm alarm);
 	bool isAnyAlarmActive();
 	int getActiveAlarms(Alarm *alarms, int maxCount = CS_ALARM_SIZE);
+	bool isAlarmActive(int index, const TimeSnapshot &now);
+	bool isAlarmActive(Alarm alarm, const TimeSnapshot &now);
+	bool isAnyAlarmActive(const TimeSnapshot &now);
+	int getActiveAlarms(Alarm *alarms, int maxCount, const TimeSnapshot &now);
+	unsigned long getNextAlarmTime();	   // epoch of the next alarm (same base as getEpoch), 0 if none
+	int getNextAlarmIndex();			   // index of the next alarm, -1 if none
+	unsigned long getSecondsToNextAlarm(); // seconds until the next alarm, 0 if none
+
+	// timers, run from loop()
+	int startTimer(unsigned long duration, void (*callback)(int), bool repeat = false);
+	void stopTimer(int id);
+	bool isTimerActive(int id);
 
 	// control
-	void sendCommand(uint8_t *command, size_t length, bool force_chunked = false);
+	void sendCommand(uint8_t *command, size_t length, bool force_chunked = false, uint16_t connHandle = BLE_HS_CONN_HANDLE_NONE); // one central, or all subscribed ones
 	void musicControl(Control command);
 	void setVolume(uint8_t level);
 	bool capturePhoto();
@@ -385,10 +822,78 @@ public:
 
 	// navigation
 	Navigation &getNavigation();
-	const uint8_t *getNavigationIcon();
+	const uint8_t *getNavigationIcon();			  // last complete icon, valid until the next call
+	void setNavigationIconCheck(bool enabled); // verify assembled icons against the CRC sent by the app (off by default)
+	uint32_t getNavigationIconErrors();		  // icons dropped because of a CRC mismatch
+	const uint8_t *getNavigationIcon(IconFormat format, uint16_t color = 0xFFFF, uint16_t background = 0x0000); // converted icon, cached by CRC
+	void clearIconCache();
+	uint32_t getIconCacheHits();
+	uint32_t getIconCacheMisses();
 
 	MusicInfo &getMusicInfo();
 
+	// watchface upload (experimental, off by default)
+	void setWatchfaceEnabled(bool enabled);
+	bool isWatchfaceEnabled();
+	bool isWatchfaceReceiving();
+	uint32_t getWatchfaceSize(); // size of the last complete watchface, 0 if none
+	uint32_t getWatchfaceCRC();	 // crc32 of the last complete watchface
+	const esp_partition_t *getWatchfacePartition();
+
+	// firmware update (experimental, off by default)
+	void setOtaEnabled(bool enabled);
+	bool isOtaEnabled();
+	bool isOtaRunning();
+	OtaStats getOtaStats();
+
+	// retained state, kept in NVS across reboots
+	void setStateStorage(bool enabled, unsigned long delay = CS_STATE_SAVE_DELAY); // load in begin() and save after changes
+	void setStorageNamespace(String name);			 // NVS namespace of this instance, at most 15 characters
+	bool saveState(bool all = false);				 // write the changed sections, or all of them
+	uint32_t loadState(uint32_t sections = STATE_ALL); // returns the StateSection bits restored
+	void clearState();								 // erase the saved state
+	uint32_t getStateDirty();						 // StateSection bits changed since the last save
+	uint32_t getStateWrites();						 // sections written to flash
+
+	// deep sleep, hot state kept in RTC memory
+	bool setSleepRetention(bool enabled); // restore the state in begin() after deep sleep (call before begin), false if another instance has it
+	void prepareSleep();				  // copy the state to RTC memory, call before esp_deep_sleep_start()
+	bool isWarmStart();					  // begin() restored the state from RTC memory
+	WakeStats getWakeStats();
+
+	// changed fields since the last call (NavigationDirty, MusicDirty, PhoneDirty, WeatherDirty bits)
+	uint32_t consumeNavigationDirty();
+	uint32_t consumeMusicDirty();
+	uint32_t consumePhoneDirty();
+	uint32_t consumeWeatherDirty();
+
+	// duplicate frame suppression
+	void setDuplicateFilter(uint8_t opcode, bool enabled);
+	bool isDuplicateFilterEnabled(uint8_t opcode);
+	void clearFrameCache();
+	uint32_t getDuplicateChecks();
+	uint32_t getDuplicateHits();
+	float getDuplicateHitRate();
+
+	// connection parameters
+	void setLinkManagement(bool enabled);
+	bool isLinkManagementEnabled();
+	void setLinkParams(LinkMode mode, LinkParams params);
+	LinkParams getLinkParams(LinkMode mode);
+	void setLinkIdleTimeout(unsigned long timeout);
+	void requestLinkMode(LinkMode mode);
+	LinkMode getLinkMode();
+	LinkStats getLinkStats();
+	void resetLinkStats();
+
+	// advertising
+	void setAdvertisingProfile(AdvProfile profile);
+	void setAdvertisingProfile(AdvPreset preset);
+	AdvProfile getAdvertisingProfile();
+	AdvPhase getAdvertisingPhase();
+	AdvStats getAdvertisingStats();
+	void resetAdvertisingStats();
+	static AdvProfile advertisingPreset(AdvPreset preset);
 
 	// contacts
 	void setContact(int index, Contact contact);
@@ -419,6 +924,29 @@ public:
 	void sendTemperatureRecord(float temperature, DateTime dateTime);
 	void sendSleepRecord(uint16_t sleepTime, SleepType type, DateTime dateTime);
 
+	// health log, a ring of flash sectors with delta encoded records
+	bool beginHealthLog(const char *label = CS_HEALTH_PARTITION); // returns false without the partition
+	bool logHealth(HealthType type, unsigned long time, int32_t a, int32_t b = 0);
+	int readHealth(unsigned long from, unsigned long to, bool (*callback)(const HealthRecord &), uint8_t types = 0xFF); // bit (1 << HealthType) per type
+	void clearHealthLog();
+	HealthLogInfo getHealthLogInfo();
+	void setHealthSync(bool enabled); // answer record requests from the log, sending only new records
+	bool isHealthSyncing();
+	unsigned long getHealthWatermark(HealthType type); // latest record time the app received
+	void resetHealthWatermarks();
+
+	// health aggregation, raw samples to hourly, daily and rolling buckets
+	void addHealthSample(HealthType type, int32_t a, int32_t b = 0); // steps and calories are increments
+	HealthStats getHealthStats(HealthType type, HealthPeriod period, int value = 0); // value 1 selects b
+	HealthHour getHealthHour();										  // current hour so far, ready for sendStepsRecord
+	void setHealthLogHourly(bool enabled);							  // append each finished hour to the health log
+
+	// realtime streaming, samples published at sensor rate are sent at a fixed rate while the app measures
+	void setRealtimeStream(uint32_t interval = CS_REALTIME_INTERVAL, RealtimeMode mode = REALTIME_LATEST); // interval 0 disables
+	void publishRealtime(HealthType type, uint8_t a, uint8_t b = 0);									// safe to call from a sensor task
+	bool isRealtimeStreaming();
+	void stopRealtime();
+
 	// helper functions for ESP32Time
 	int getHourC();					   // return hour based on 24-hour variable (0-12 or 0-23)
 	String getHourZ();				   // return zero padded hour string based on 24-hour variable (00-12 or 00-23)
@@ -432,12 +960,16 @@ public:
 	void setDataCallback(void (*callback)(uint8_t *, int));
 	void setRawDataCallback(void (*callback)(uint8_t *, int));
 	void setHealthRequestCallback(void (*callback)(HealthRequest, bool));
+	void setReminderCallback(void (*callback)(ReminderType));
+	void setHealthHourCallback(void (*callback)(HealthHour)); // each finished hour, called from loop()
 
 private:
+	friend class ChronosTransport;
+
 	String _watchName = "Chronos ESP32";
 	String _address;
-	bool _inited;
-	bool _subscribed;
+	bool _inited = false;
+	bool _subscribed = false;
 	uint8_t _batteryLevel;
 	bool _isCharging;
 	bool _connected;
@@ -451,24 +983,54 @@ private:
 	uint16_t _sleepStart = 0;
 	uint16_t _sleepEnd = 0;
 
+	TimeSnapshot _timeSnapshot;
+
+	Reminder _reminders[2];
+	unsigned long _reminderTime[2] = {0, 0};
+
 	bool _notifyPhone = true;
-	bool _sendESP;
-	bool _chunked;
+	bool _chunked = false; // default for new connections
 
 	Notification _notifications[CS_NOTIF_SIZE];
 	int _notificationIndex;
 
-	Weather _weather[CS_WEATHER_SIZE];
+	// daily weather, one array per field, index 0 is the day the weather was received
+	int16_t _weatherTemp[CS_WEATHER_SIZE];
+	int16_t _weatherHigh[CS_WEATHER_SIZE];
+	int16_t _weatherLow[CS_WEATHER_SIZE];
+	uint16_t _weatherPressure[CS_WEATHER_SIZE];
+	uint8_t _weatherIcon[CS_WEATHER_SIZE];
+	uint8_t _weatherDay[CS_WEATHER_SIZE]; // day of week
+	uint8_t _weatherUv[CS_WEATHER_SIZE];
+	unsigned long _weatherStart = 0; // start of the day at index 0, 0 if received before the time was synced
 	String _weatherCity;
 	String _weatherTime;
 	int _weatherSize;
 	WeatherLocation _weatherLocation;
 
-	HourlyForecast _hourlyForecast[CS_FORECAST_SIZE];
+	// hourly forecast, one array per field, slot is the epoch hour modulo the size
+	int16_t _forecastTemp[CS_FORECAST_SIZE];
+	uint16_t _forecastWind[CS_FORECAST_SIZE];
+	uint16_t _forecastDay[CS_FORECAST_SIZE]; // day of year
+	uint8_t _forecastHour[CS_FORECAST_SIZE];
+	uint8_t _forecastIcon[CS_FORECAST_SIZE];
+	uint8_t _forecastUv[CS_FORECAST_SIZE];
+	uint8_t _forecastHumidity[CS_FORECAST_SIZE];
+	unsigned long _forecastTime[CS_FORECAST_SIZE];
+
+	unsigned long _weatherReceived = 0;
+	unsigned long _forecastReceived = 0;
 
 	RemoteTouch _touch;
+	TouchEvent _touchEvents[CS_TOUCH_SIZE];
+	uint8_t _touchHead = 0;	 // next event to read
+	uint8_t _touchCount = 0; // queued events
+	uint32_t _touchDropped = 0;
+	portMUX_TYPE _touchMux = portMUX_INITIALIZER_UNLOCKED;
+	SemaphoreHandle_t _touchSignal = nullptr;
 
 	Alarm _alarms[CS_ALARM_SIZE];
+	unsigned long _alarmDue[CS_ALARM_SIZE] = {0}; // scheduled time of one-shot (0x80) alarms, 0 if not scheduled
 
 	String _qrLinks[CS_QR_SIZE];
 
@@ -476,19 +1038,317 @@ private:
 	int _sosContact;
 	int _contactSize;
 
-	ChronosTimer _infoTimer;
-	ChronosTimer _findTimer;
-
-	ChronosData _incomingData;
+	enum TimerId
+	{
+		TIMER_INFO = 0, // send watch info after subscribing
+		TIMER_FIND,		// find phone auto cancel
+		TIMER_BATTERY,	// send the battery level
+		TIMER_ESP,		// send esp info
+		TIMER_RX,		// incoming packet reassembly timeout
+		TIMER_SEDENTARY, // sedentary reminder
+		TIMER_WATER,	// water reminder
+		TIMER_LINK,		// switch to the slow connection interval when idle
+		TIMER_ADV,		// end of the fast advertising phase
+		TIMER_BULK,		// bulk transfer written to flash
+		TIMER_OTA,		// end of the firmware update resume window
+		TIMER_STATE,	// save the changed state sections
+		TIMER_HEALTH,	// send the next health record
+		TIMER_AGGREGATE, // end of the aggregation hour
+		TIMER_REALTIME, // send the next realtime frame
+		TIMER_ALARM,	// next alarm or end of a one-shot alarm minute
+		TIMER_INTERNAL, // number of internal timers, application timers follow
+		TIMER_COUNT = TIMER_INTERNAL + CS_TIMER_SIZE,
+	};
+
+	ChronosTimer _timers[TIMER_COUNT];
+	unsigned long _nextDeadline = 0; // earliest expiry of the active timers
+	bool _timerPending = false;		 // whether any timer is active
+	portMUX_TYPE _timerMux = portMUX_INITIALIZER_UNLOCKED;
+	TaskHandle_t _loopTask = nullptr;
+
+	struct ChronosConnection
+	{
+		uint16_t handle; // BLE_HS_CONN_HANDLE_NONE for a free slot
+		uint16_t mtu;
+		bool subscribed;
+		bool chunked;
+		ChronosTransport *transport;
+		unsigned long rxStart; // first packet of the frame being assembled (millis)
+		ChronosData incoming;
+		uint8_t users; // packets being decoded, the slot is not reused until they are done
+	};
+
+	ChronosConnection _conns[CS_MAX_CONNECTIONS];
+	ChronosBleTransport _bleTransport;
+	ChronosTransport *_transports[CS_MAX_TRANSPORTS]; // wired transports, polled from loop()
+	uint8_t _transportCount = 0;
+	SemaphoreHandle_t _rxLock = nullptr; // packets from BLE and wired peers are decoded one at a time
+	uint8_t _connCount = 0;		 // BLE centrals and wired peers
+	uint8_t _bleCount = 0;		 // BLE centrals, they decide advertising and the session
+	uint8_t _maxConnections = 1; // BLE centrals
+	portMUX_TYPE _connMux = portMUX_INITIALIZER_UNLOCKED;
+	ChronosData *_incomingData = nullptr; // frame being decoded, owned by the connection that sent it
 	ChronosData _outgoingData;
 
 	ChronosScreen _screenConf = CS_240x240_128_CTF;
 
 	Navigation _navigation;
+	uint8_t _navIcons[3][CS_ICON_DATA_SIZE]; // latest, handed to the reader and being assembled
+	volatile uint8_t _navIconFront = 0;
+	uint8_t _navIconReader = 0;		// buffer last returned by getNavigationIcon(), never written
+	uint8_t _navIconBack = 1;		// buffer the chunks are collected in
+	uint8_t _navIconMask = 0;		// chunks received into the back buffer
+	uint32_t _navIconPending = 0;	// CRC of the icon being assembled
+	uint32_t _navIconCRCs[3] = {0, 0, 0}; // CRC of each buffer
+	portMUX_TYPE _navIconMux = portMUX_INITIALIZER_UNLOCKED;
+	bool _navIconCheck = false; // the algorithm behind the app's iconCRC is not confirmed
+	uint32_t _navIconErrors = 0;
+
+	ChronosIcon _iconCache[CS_ICON_CACHE_SIZE];
+	uint32_t _iconCacheTick = 0;
+	uint32_t _iconCacheHits = 0;
+	uint32_t _iconCacheMisses = 0;
+
+	enum BulkTarget
+	{
+		BULK_NONE = 0,
+		BULK_WATCHFACE,
+		BULK_OTA,
+	};
+	enum BulkStatus
+	{
+		BULK_READY = 0x00,
+		BULK_PROGRESS = 0x01,
+		BULK_DONE = 0x02,
+		BULK_REWIND = 0x03, // resend from the received count
+		BULK_ERROR = 0xFF,
+	};
+	struct BulkChunk
+	{
+		uint8_t buffer;	 // index into _bulkBuffers
+		uint16_t length; // 0 for the abort marker
+		uint32_t offset; // position in the image
+		bool last;		 // finish the transfer after this chunk
+		bool quit;		 // stop the flash writer task
+	};
+
+	volatile BulkTarget _bulkTarget = BULK_NONE;
+	uint16_t _bulkConn = BLE_HS_CONN_HANDLE_NONE; // central sending the transfer
+	uint8_t *_bulkBuffers[2] = {nullptr, nullptr};
+	uint8_t _bulkFill = 0;	 // buffer being filled by the BLE task
+	bool _bulkHeld = false;	 // the fill buffer is free, false while the flash writer still has it
+	uint16_t _bulkUsed = 0;	 // bytes in the fill buffer
+	uint16_t _bulkSeq = 0;	 // next expected data packet
+	uint32_t _bulkSize = 0;	 // image size
+	uint32_t _bulkReceived = 0;
+	uint32_t _bulkCRC = 0; // running crc32 of the received bytes
+	uint32_t _bulkExpectedCRC = 0;
+	volatile bool _bulkError = false;
+	bool _bulkAborting = false;
+	const esp_partition_t *_bulkPartition = nullptr;
+	QueueHandle_t _bulkQueue = nullptr;
+	SemaphoreHandle_t _bulkFree = nullptr; // buffers available for filling
+	TaskHandle_t _bulkTask = nullptr;	   // flash writer
+	TaskHandle_t _bulkCloser = nullptr;   // task waiting for the flash writer to quit
+	bool _watchfaceEnabled = false; // the B0/AF layout is not confirmed against app traffic
+	bool _otaEnabled = false;		// D0/D1 packets are ignored unless enabled
+	uint32_t _watchfaceSize = 0;
+	uint32_t _watchfaceCRC = 0;
+	esp_ota_handle_t _otaHandle = 0;
+	unsigned long _otaStart = 0; // transfer start (millis)
+	OtaStats _otaStats;
+
+	struct StateBuffer
+	{
+		uint8_t *data; // nullptr while measuring
+		size_t size;   // capacity, or bytes to read
+		size_t pos;
+		bool reading;	 // restore fields instead of storing them
+		size_t compared; // payload bytes checked for changes before saving, 0 for all
+		bool skip;		 // reading only checks the layout, the fields are not changed
+		bool field(void *value, size_t length);
+		bool text(String &value);
+	};
+	struct StateHeader
+	{
+		uint16_t version; // CS_STATE_VERSION
+		uint16_t section; // StateSection bit
+		uint32_t length;  // payload bytes after the header
+		uint32_t crc;	  // crc32 of the payload
+		uint16_t sizes[5]; // CS_ALARM_SIZE, CS_CONTACTS_SIZE, CS_WEATHER_SIZE, CS_FORECAST_SIZE and CS_QR_SIZE of the build that saved it
+	};
+
+	bool _stateEnabled = false;
+	unsigned long _stateDelay = CS_STATE_SAVE_DELAY;
+	uint32_t _stateDirty = 0;
+	uint32_t _stateCRC[5] = {0, 0, 0, 0, 0}; // crc of the compared payload last saved or loaded, unchanged sections are not rewritten
+	uint32_t _stateWrites = 0;
+
+	struct RtcState
+	{
+		uint32_t magic;	  // CS_RTC_MAGIC
+		uint16_t length;  // sizeof(RtcState), changes with the layout
+		uint16_t sleeps;  // deep sleep cycles since power on
+		long offset;	  // ESP32Time offset, the clock itself keeps running in deep sleep
+		bool hour24;
+		bool chunked;
+		bool notifyPhone;
+		bool quietEnabled;
+		bool sleepEnabled;
+		uint16_t quietStart;
+		uint16_t quietEnd;
+		uint16_t sleepStart;
+		uint16_t sleepEnd;
+		Reminder reminders[2];
+		Alarm alarms[CS_ALARM_SIZE];
+		unsigned long alarmDue[CS_ALARM_SIZE];
+		uint8_t notificationCount;
+		struct
+		{
+			uint8_t icon;
+			char time[6];
+			char title[CS_RTC_TITLE_SIZE];
+		} notifications[CS_RTC_NOTIF_SIZE]; // latest first
+		uint32_t crc; // crc32 of the fields above
+	};
+
+	bool _rtcEnabled = false;
+	WakeStats _wakeStats = {false, 0, 0, 0, 0};
+	static RtcState _rtcState;
+
+	struct HealthSector
+	{
+		uint32_t magic;	   // CS_HEALTH_MAGIC
+		uint32_t sequence; // increases with every sector opened, the highest is the head
+		uint32_t start;	   // base of the first time delta
+		uint32_t first;	   // earliest record time, written when the sector is closed
+		uint32_t last;	   // latest record time, written when the sector is closed
+	};
+	struct HealthCursor
+	{
+		unsigned long time;				 // time of the previous record
+		int32_t values[HEALTH_TYPES][2]; // previous values of each type
+	};
+	struct HealthPosition
+	{
+		bool valid;
+		int sector;		   // sector to continue in
+		uint32_t sequence; // sequence of that sector, the position is stale once it is reused
+		size_t pos;		   // offset after the last visited record
+		HealthCursor cursor;
+	};
+	struct HealthMark
+	{
+		uint32_t sequence; // sector sequence of the record, 0 before the first record
+		uint32_t pos;	   // offset after the record in that sector
+		uint32_t time;	   // record time, reported by getHealthWatermark()
+	};
+
+	const esp_partition_t *_healthPartition = nullptr;
+	uint16_t _healthSectors = 0;
+	int _healthHead = -1;		  // sector being appended, -1 when the log is empty
+	uint32_t _healthSequence = 0; // sequence of the head sector
+	uint16_t _healthOffset = 0;	  // append position in the head sector
+	unsigned long _healthFirst = 0;
+	unsigned long _healthLast = 0;
+	uint32_t _healthErases = 0;
+	HealthCursor _healthCursor;
+	SemaphoreHandle_t _healthLock = nullptr;
+	bool _healthSyncEnabled = false;
+	HealthMark _healthMark[HEALTH_TYPES]; // checkpointed watermarks, kept in NVS
+
+	struct HealthSync
+	{
+		uint8_t request;				  // types requested by the peer, taken by loop()
+		uint8_t types;					  // types being sent
+		volatile bool lost;				  // the peer disconnected, unconfirmed progress is dropped
+		HealthMark pending[HEALTH_TYPES]; // progress at the last checkpoint, kept once the link outlives the next window
+		HealthMark sent[HEALTH_TYPES];	  // latest record sent in this session
+		HealthPosition resume;			  // where the next batch continues in the log
+		HealthRecord batch[CS_HEALTH_BATCH];
+		HealthMark batchMarks[CS_HEALTH_BATCH]; // log position of each batch record
+		uint8_t batchCount;
+		uint8_t batchNext;
+		uint16_t unsaved; // records sent since the last checkpoint
+	};
+	HealthSync _healthSyncs[CS_MAX_CONNECTIONS]; // sync session of each peer, same index as _conns
+
+	struct HealthSlot
+	{
+		int32_t sum;
+		int32_t min;
+		int32_t max;
+		uint16_t count;
+	};
+
+	HealthStats _aggHour[HEALTH_TYPES][2];
+	HealthStats _aggDay[HEALTH_TYPES][2];
+	HealthSlot _aggSlots[CS_HEALTH_WINDOW][HEALTH_TYPES][2]; // one per minute
+	unsigned long _aggSlotMinute[CS_HEALTH_WINDOW];		  // local minute held by each slot
+	unsigned long _aggHourIndex = 0;					  // local hour of _aggHour
+	unsigned long _aggDayIndex = 0;						  // local day of _aggDay
+	HealthStats _aggFinished[CS_HEALTH_HOUR_QUEUE][HEALTH_TYPES][2]; // finished hours waiting for loop(), oldest first from _aggFinishedHead
+	unsigned long _aggFinishedIndex[CS_HEALTH_HOUR_QUEUE];			 // local hour of each entry
+	uint8_t _aggFinishedHead = 0;
+	uint8_t _aggFinishedCount = 0;
+	bool _aggSamples = false; // the current hour has samples
+	bool _aggLogHourly = false;
+	portMUX_TYPE _aggMux = portMUX_INITIALIZER_UNLOCKED;
+
+	struct RealtimeChannel
+	{
+		uint32_t sum[2];
+		uint16_t count;	   // samples since the last frame
+		uint8_t latest[2]; // held until the next sample
+	};
+
+	RealtimeChannel _rtChannels[HEALTH_TYPES];
+	uint32_t _rtInterval = 0;
+	RealtimeMode _rtMode = REALTIME_LATEST;
+	uint8_t _rtRequests = 0; // bit (1 << HealthType) per measurement, bit HEALTH_TYPES for all
+	uint8_t _rtReady = 0;	 // types with a sample in this session
+	uint8_t _rtNext = 0;	 // request to try first, concurrent requests take turns
+	portMUX_TYPE _rtMux = portMUX_INITIALIZER_UNLOCKED;
 
 	PhoneInfo _phoneInfo;
 	MusicInfo _musicInfo;
 
+	uint32_t _navigationDirty = 0;
+	uint32_t _musicDirty = 0;
+	uint32_t _phoneDirty = 0;
+	uint32_t _weatherDirty = 0;
+	portMUX_TYPE _dirtyMux = portMUX_INITIALIZER_UNLOCKED;
+
+	uint32_t _frameFilter[8];					// opcode bitmap, 256 bits
+	uint32_t _frameKeys[CS_FRAME_CACHE_SIZE];	// frame identity (header, opcode, sub type)
+	uint32_t _frameHashes[CS_FRAME_CACHE_SIZE]; // crc32 of the last payload for the key
+	uint8_t _frameCacheCount = 0;
+	uint8_t _frameCacheNext = 0;
+	uint32_t _frameChecks = 0;
+	uint32_t _frameHits = 0;
+
+	bool _linkEnabled = false;
+	LinkMode _linkMode = LINK_DEFAULT;	  // mode of the interval granted by the phone
+	LinkMode _linkRequest = LINK_DEFAULT; // mode last requested from the phone
+	unsigned long _linkRequestTime = 0;	  // when _linkRequest was sent (millis)
+	LinkParams _linkParams[3];
+	unsigned long _linkIdleTimeout = CS_LINK_IDLE_TIMEOUT;
+	unsigned long _linkSince = 0; // start of the current mode (millis)
+	unsigned long _linkLast = 0;  // last link traffic (millis)
+	bool _linkIdleArmed = false;  // TIMER_LINK is running, traffic only moves _linkLast
+	unsigned long _linkBurstStart = 0;
+	uint8_t _linkBurst = 0; // packets in the current burst window
+	LinkStats _linkStats;
+	portMUX_TYPE _linkMux = portMUX_INITIALIZER_UNLOCKED;
+
+	AdvProfile _advProfile;
+	AdvPhase _advPhase = ADV_OFF;
+	unsigned long _advSince = 0; // start of the current phase (millis)
+	int _advBasePower = 0;		 // TX power before any phase changed it (dBm)
+	int _advPower = 0;			 // TX power set by the current phase (dBm)
+	AdvStats _advStats;
+	portMUX_TYPE _advMux = portMUX_INITIALIZER_UNLOCKED;
+
 	void (*connectionChangeCallback)(bool) = nullptr;
 	void (*notificationReceivedCallback)(Notification) = nullptr;
 	void (*ringerAlertCallback)(String, bool) = nullptr;
@@ -496,28 +1356,162 @@ private:
 	void (*dataReceivedCallback)(uint8_t *, int) = nullptr;
 	void (*rawDataReceivedCallback)(uint8_t *, int) = nullptr;
 	void (*healthRequestCallback)(HealthRequest, bool) = nullptr;
+	void (*reminderCallback)(ReminderType) = nullptr;
+	void (*healthHourCallback)(HealthHour) = nullptr;
+
+	void pushTouch(bool state, uint16_t x, uint16_t y);
+	void scheduleAlarms();
+	unsigned long nextAlarm(const TimeSnapshot &now, int *index);
+	unsigned long alarmOccurrence(const Alarm &alarm, const TimeSnapshot &now);
+
+	void armTimer(int id, unsigned long duration, bool repeat = false, void (*callback)(int) = nullptr);
+	void disarmTimer(int id);
+	void runTimers();
+	void timerExpired(int id);
+	void notifyLoop();
+	bool isWindowActive(bool enabled, uint16_t start, uint16_t end, uint16_t now);
+	void scheduleReminder(ReminderType type);
+	void scheduleReminders();
+	void reminderExpired(ReminderType type);
+	void linkActivity(bool bulk);
+	void accrueLinkTime(unsigned long now);
+	void grantLinkInterval(uint16_t interval, uint16_t latency);
+	void startAdvertisingPhase(AdvPhase phase);
+	void accrueAdvTime(unsigned long now);
+	int weatherOffset(const TimeSnapshot &now);
+	Weather weatherEntry(int index);
+	void watchfacePacket(uint16_t handle, const uint8_t *data, int length);
+	void otaPacket(uint16_t handle, const uint8_t *data, int length);
+	bool isLinkSecure(uint16_t handle);
+	uint8_t bulkHeader();
+	Config bulkConfig();
+	bool bulkBegin(BulkTarget target, uint32_t size, uint32_t crc);
+	bool bulkData(const uint8_t *data, size_t length);
+	void bulkSubmit(bool last);
+	void bulkAbort();
+	void bulkFinish();
+	bool bulkWrite(const BulkChunk &chunk);
+	void sendBulkStatus(uint8_t header, uint8_t status);
+	static void bulkWriter(void *param);
+	void stopBulkWriter();
+	uint8_t acquireNavIcon();
+	static void expandIcon(const uint8_t *icon, uint8_t *out, IconFormat format, uint16_t color, uint16_t background);
+	HourlyForecast forecastEntry(int slot);
+	void markState(uint32_t sections);
+	bool stateSection(uint32_t section, StateBuffer &buffer);
+	StateHeader stateHeader(uint32_t section, const uint8_t *payload, size_t length);
+	static const char *stateKey(uint32_t section);
+	bool restoreSleepState();
+	bool openHealthSector(unsigned long time);
+	void closeHealthSector();
+	bool readHealthSector(int sector, HealthSector &header);
+	static bool decodeHealth(const uint8_t *data, size_t length, size_t &pos, HealthCursor &cursor, HealthRecord &record);
+	static uint8_t healthValues(uint8_t type);
+	int scanHealth(unsigned long from, unsigned long to, uint8_t types, bool (*visit)(void *, const HealthRecord &), void *context, HealthPosition *position = nullptr);
+	void requestHealthSync(const ChronosConnection &conn, uint8_t types);
+	void streamHealth();
+	bool streamHealth(int index);
+	void resetHealthSync(HealthSync &sync);
+	bool commitHealthMarks(const HealthMark *marks);
+	void saveHealthWatermarks();
+	void seekHealth(const HealthMark &mark, HealthPosition &position);
+	static bool healthAfter(const HealthMark &a, const HealthMark &b);
+	size_t healthRecordFrame(uint8_t *frame, uint8_t type, int32_t a, int32_t b, const DateTime &dateTime);
+	void broadcast(const uint8_t *command, size_t length, bool force_chunked, uint16_t connHandle, bool paced);
+	void rollHealthHour(unsigned long hour);
+	HealthHour healthHourEntry(unsigned long hour, const HealthStats (&stats)[HEALTH_TYPES][2]);
+	void finishHealthHour();
+	bool takeHealthHour(HealthStats (&stats)[HEALTH_TYPES][2], unsigned long &finished);
+	void deliverHealthHour(const HealthHour &entry);
+	static void addHealthStats(HealthStats &stats, int32_t value);
+	void realtimeRequest(uint8_t request, bool state);
+	void streamRealtime();
+	void takeRealtime(HealthType type, uint8_t *values);
+	static size_t realtimeFrame(uint8_t *frame, int type, const uint8_t *values);
+	void setTxPower(int8_t power);
 
 	void sendInfo();
 	void sendBattery();
 	void sendESP();
 
 	void splitTitle(const String &input, String &title, String &message, int icon);
+	String readString(int &index, int len);
+
+	void markDirty(uint32_t &mask, uint32_t bits);
+	uint32_t consumeDirty(uint32_t &mask);
+	bool updateField(String &field, const String &value, uint32_t &mask, uint32_t bit);
+	template <typename T>
+	bool updateField(T &field, T value, uint32_t &mask, uint32_t bit)
+	{
+		if (field == value)
+			return false;
+		field = value;
+		markDirty(mask, bit);
+		return true;
+	}
 
 	String appName(int id);
+	static void copyText(char *out, size_t size, const String &text);
 	String flashMode(FlashMode_t mode);
 
 	// from BLEServerCallbacks
 	virtual void onConnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo) override;
 	virtual void onDisconnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo, int reason) override;
+	virtual void onConnParamsUpdate(NimBLEConnInfo &connInfo) override;
+	virtual void onMTUChange(uint16_t MTU, NimBLEConnInfo &connInfo) override;
 
 	// from BLECharacteristicCallbacks
 	virtual void onWrite(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) override;
 	virtual void onSubscribe(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo, uint16_t subValue) override;
 
-	void dataReceived();
-
-	static BLECharacteristic *pCharacteristicTX;
-	static BLECharacteristic *pCharacteristicRX;
+	void beginEngine(bool ble);
+	uint16_t openConnection(uint16_t handle, uint16_t mtu, ChronosTransport *transport, bool subscribed);
+	bool isSessionPeer(const ChronosTransport *transport);
+	void closeConnection(uint16_t handle);
+	void packetReceived(uint16_t handle, const uint8_t *pData, int len);
+	void dataReceived(ChronosConnection &conn);
+	ChronosConnection *findConnection(uint16_t handle);
+	ChronosConnection *acquireConnection(uint16_t handle);
+	void releaseConnection(ChronosConnection *conn);
+	int peers(ChronosPeer *list);
+	void checkIncoming(bool expire);
+	void sendFrame(const uint8_t *command, size_t length, bool chunked, uint16_t connHandle, bool paced = true);
+	void notify(const uint8_t *data, size_t length, uint16_t connHandle);
+	bool isDuplicateFrame();
+	uint32_t frameKey();
+
+	static uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc = 0);
+
+	String _serviceUUID = CS_SERVICE_UUID;
+	String _rxUUID = CS_CHARACTERISTIC_UUID_RX;
+	String _txUUID = CS_CHARACTERISTIC_UUID_TX;
+	String _stateNamespace = CS_STATE_NAMESPACE;
+	bool _bleOwner = false; // this instance started the stack and runs the advertising
+
+	BLEService *pService = nullptr;
+	BLECharacteristic *pCharacteristicTX = nullptr;
+	BLECharacteristic *pCharacteristicRX = nullptr;
+
+	// the server takes one callback object, it forwards the events to every running instance
+	class ServerRouter : public BLEServerCallbacks
+	{
+		void onConnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo) override;
+		void onDisconnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo, int reason) override;
+		void onConnParamsUpdate(NimBLEConnInfo &connInfo) override;
+		void onMTUChange(uint16_t MTU, NimBLEConnInfo &connInfo) override;
+	};
+
+	static ServerRouter _serverRouter;
+	static ChronosESP32 *_instances[CS_MAX_INSTANCES];
+	static portMUX_TYPE _instanceMux;
+	static ChronosESP32 *_rtcOwner;	   // instance using the RTC memory copy
+	static ChronosESP32 *_healthOwner; // instance using the health log partition
+
+	bool registerInstance();
+	ChronosESP32 *unregisterInstance();
+	static int runningInstances(ChronosESP32 **list);
+	bool claimShared(ChronosESP32 *&owner);
+	void releaseShared(ChronosESP32 *&owner);
 };
 
 #endif
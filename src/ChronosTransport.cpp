@@ -0,0 +1,210 @@
+/*
+   MIT License
+
+  Copyright (c) 2023 Felix Biego
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  ______________  _____
+  ___  __/___  /_ ___(_)_____ _______ _______
+  __  /_  __  __ \__  / _  _ \__  __ `/_  __ \
+  _  __/  _  /_/ /_  /  /  __/_  /_/ / / /_/ /
+  /_/     /_.___/ /_/   \___/ _\__, /  \____/
+							  /____/
+
+*/
+
+#include <Arduino.h>
+#include "ChronosTransport.h"
+
+/*!
+	@brief  Constructor for ChronosStreamTransport
+	@param  stream
+			serial port or other stream connected to the app
+	@param  mtu
+			largest packet sent to the peer, at most CS_STREAM_MTU
+*/
+ChronosStreamTransport::ChronosStreamTransport(Stream &stream, uint16_t mtu) : ChronosStreamTransport(mtu)
+{
+	_stream = &stream;
+}
+
+/*!
+	@brief  Constructor for ChronosStreamTransport, the subclass sets the stream
+	@param  mtu
+			largest packet sent to the peer, at most CS_STREAM_MTU
+*/
+ChronosStreamTransport::ChronosStreamTransport(uint16_t mtu)
+{
+	_mtu = min(mtu, (uint16_t)CS_STREAM_MTU);
+}
+
+/*!
+	@brief  send one packet after the sync byte and its length
+	@param  handle
+			ignored, a stream has one peer
+	@param  data
+			packet data
+	@param  length
+			packet length
+*/
+bool ChronosStreamTransport::write(uint16_t /* handle */, const uint8_t *data, size_t length)
+{
+	uint8_t prefix[] = {CS_STREAM_SYNC, (uint8_t)(length >> 8), (uint8_t)(length)};
+	return _stream->write(prefix, 3) == 3 && _stream->write(data, length) == length;
+}
+
+/*!
+	@brief  get the largest packet sent to the peer
+	@param  handle
+			ignored, a stream has one peer
+*/
+uint16_t ChronosStreamTransport::getMTU(uint16_t /* handle */)
+{
+	return _mtu;
+}
+
+/*!
+	@brief  read the available input, a serial line counts as connected from the first poll
+*/
+void ChronosStreamTransport::poll()
+{
+	if (_handle == BLE_HS_CONN_HANDLE_NONE)
+	{
+		_handle = peerConnected(_mtu);
+		if (_handle == BLE_HS_CONN_HANDLE_NONE)
+		{
+			return;
+		}
+	}
+	readPackets();
+}
+
+/*!
+	@brief  drop the peer
+*/
+void ChronosStreamTransport::close()
+{
+	if (_handle != BLE_HS_CONN_HANDLE_NONE)
+	{
+		peerDisconnected(_handle);
+		_handle = BLE_HS_CONN_HANDLE_NONE;
+	}
+	_rxPos = 0;
+}
+
+/*!
+	@brief  split the available input into packets and pass them on
+			after a lost or corrupted byte the input is skipped up to the next sync byte
+*/
+void ChronosStreamTransport::readPackets()
+{
+	if (_rxPos > 0 && millis() - _rxTime > CS_STREAM_TIMEOUT)
+	{
+		// the rest of the packet was lost, a new one starts with the next sync byte
+		_rxPos = 0;
+	}
+	while (_stream->available() > 0)
+	{
+		int c = _stream->read();
+		if (c < 0)
+		{
+			break;
+		}
+		_rxTime = millis();
+		if (_rxPos == 0)
+		{
+			_rxPos = c == CS_STREAM_SYNC ? 1 : 0;
+			continue;
+		}
+		if (_rxPos < 3)
+		{
+			// length, big endian
+			_rxLength = _rxPos == 1 ? (c << 8) : (_rxLength | c);
+			_rxPos++;
+			if (_rxPos == 3 && (_rxLength == 0 || _rxLength > CS_STREAM_MTU))
+			{
+				// not a packet this side sends, resynchronize
+				_rxPos = 0;
+			}
+			continue;
+		}
+		_rx[_rxPos - 3] = c;
+		_rxPos++;
+		if (_rxPos - 3 == _rxLength)
+		{
+			received(_handle, _rx, _rxLength);
+			_rxPos = 0;
+		}
+	}
+}
+
+/*!
+	@brief  Constructor for ChronosTcpTransport
+	@param  port
+			TCP port to listen on
+*/
+ChronosTcpTransport::ChronosTcpTransport(uint16_t port) : ChronosStreamTransport(CS_STREAM_MTU), _server(port)
+{
+	_stream = &_client;
+}
+
+/*!
+	@brief  accept a client and read its input, WiFi has to be started before the first poll
+*/
+void ChronosTcpTransport::poll()
+{
+	if (!_listening)
+	{
+		_server.begin();
+		_listening = true;
+	}
+	if (_handle != BLE_HS_CONN_HANDLE_NONE && !_client.connected())
+	{
+		ChronosStreamTransport::close();
+		_client.stop();
+	}
+	if (_handle == BLE_HS_CONN_HANDLE_NONE)
+	{
+		WiFiClient client = _server.accept();
+		if (!client)
+		{
+			return;
+		}
+		_client = client;
+		_client.setNoDelay(true); // packets are small and paced by the engine
+		_rxPos = 0;
+		_handle = peerConnected(_mtu);
+		if (_handle == BLE_HS_CONN_HANDLE_NONE)
+		{
+			_client.stop();
+			return;
+		}
+	}
+	readPackets();
+}
+
+/*!
+	@brief  drop the client
+*/
+void ChronosTcpTransport::close()
+{
+	ChronosStreamTransport::close();
+	_client.stop();
+}
@@ -0,0 +1,82 @@
+/*
+   MIT License
+
+  Copyright (c) 2023 Felix Biego
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  ______________  _____
+  ___  __/___  /_ ___(_)_____ _______ _______
+  __  /_  __  __ \__  / _  _ \__  __ `/_  __ \
+  _  __/  _  /_/ /_  /  /  __/_  /_/ / / /_/ /
+  /_/     /_.___/ /_/   \___/ _\__, /  \____/
+							  /____/
+
+*/
+
+#ifndef CHRONOSTRANSPORT_H
+#define CHRONOSTRANSPORT_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include "ChronosESP32.h"
+
+#define CS_STREAM_MTU 514 // largest packet on a stream transport, as a BLE write with the 517 byte MTU
+#define CS_TCP_PORT 9300  // default port of the TCP transport
+#define CS_STREAM_SYNC 0xC5    // first byte of every packet on a stream transport
+#define CS_STREAM_TIMEOUT 100  // a packet whose next byte does not arrive within this time is dropped (ms)
+
+// one peer on a Stream, eg. a UART, each packet is sent after CS_STREAM_SYNC and its length (2 bytes, big endian)
+class ChronosStreamTransport : public ChronosTransport
+{
+public:
+	ChronosStreamTransport(Stream &stream, uint16_t mtu = CS_STREAM_MTU);
+	bool write(uint16_t handle, const uint8_t *data, size_t length) override;
+	uint16_t getMTU(uint16_t handle) override;
+	void poll() override;
+	void close() override;
+
+protected:
+	ChronosStreamTransport(uint16_t mtu);
+	void readPackets();
+
+	Stream *_stream = nullptr;
+	uint16_t _mtu;
+	uint16_t _handle = BLE_HS_CONN_HANDLE_NONE;
+	uint16_t _rxLength = 0; // length of the packet being read
+	uint16_t _rxPos = 0;	// bytes read, including the sync byte and length
+	unsigned long _rxTime = 0; // last byte of the packet being read (millis)
+	uint8_t _rx[CS_STREAM_MTU];
+};
+
+// one peer at a time on a TCP port, with the framing of ChronosStreamTransport
+class ChronosTcpTransport : public ChronosStreamTransport
+{
+public:
+	ChronosTcpTransport(uint16_t port = CS_TCP_PORT);
+	void poll() override;
+	void close() override;
+
+protected:
+	WiFiServer _server;
+	WiFiClient _client;
+	bool _listening = false;
+};
+
+#endif